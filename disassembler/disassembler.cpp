@@ -1,13 +1,16 @@
 #include <string.h>
+#include <algorithm>
 
 #include "disassembler.h"
 #include "elf-parser.h"
 #include "instruction.h"
 #include "module.h"
+#include "option.h"
+#include "parallel.h"
 
-_DInst Disassembler::_dInst;
-_CodeInfo Disassembler::_ci;
-_DecodedInst Disassembler::_decodedInst;
+__thread _DInst Disassembler::_dInst;
+__thread _CodeInfo Disassembler::_ci = {0, 0, NULL, 0x1000, Decode64Bits, DF_NONE};
+__thread _DecodedInst Disassembler::_decodedInst;
 
 void Disassembler::init()
 {
@@ -71,6 +74,31 @@ static BOOL objdump_error_correction(Module *module, P_ADDRX instr_addr)
         return true;
 }
 
+#ifdef _C10
+//objdump desyncs at these addresses of libcrypto, the instructions actually start at the corrected addresses
+typedef struct{
+    P_ADDRX addr;
+    P_ADDRX corrected_addr;
+}RESYNC_ENTRY;
+
+static const RESYNC_ENTRY libcrypto_resync_table[] = {
+    {0x8fffb, 0x90000}, {0x90002, 0x90003}, {0x90005, 0x90004}, {0xa4e21, 0xa4e20}, {0xa5292, 0xa5290},
+};
+#endif
+
+static P_ADDRX correct_resync_addr(Module *module, P_ADDRX instr_addr)
+{
+#ifdef _C10
+    if(module->get_name()=="libcrypto.so.1.0.0"){
+        for(SIZE idx = 0; idx<sizeof(libcrypto_resync_table)/sizeof(RESYNC_ENTRY); idx++){
+            if(libcrypto_resync_table[idx].addr==instr_addr)
+                return libcrypto_resync_table[idx].corrected_addr;
+        }
+    }
+#endif
+    return instr_addr;
+}
+
 void Disassembler::disassemble_module(Module *module)
 {
     /*Use objdump tools to split the code and data*/
@@ -94,20 +122,7 @@ void Disassembler::disassemble_module(Module *module)
         // 4.1 get instruction offset
         P_ADDRX instr_addr;
         sscanf(line_buf, "%lx\n", &instr_addr);
-#ifdef _C10
-        if(module->get_name()=="libcrypto.so.1.0.0"){
-            if(instr_addr==0x8fffb)
-                instr_addr = 0x90000;
-            else if(instr_addr==0x90002)
-                instr_addr = 0x90003;
-            else if(instr_addr==0x90005)
-                instr_addr = 0x90004;
-            else if(instr_addr==0xa4e21)
-                instr_addr = 0xa4e20;
-            else if(instr_addr==0xa5292)
-                instr_addr = 0xa5290;
-        }
-#endif
+        instr_addr = correct_resync_addr(module, instr_addr);
         // skip data region
         if(!objdump_error_correction(module, instr_addr))
             continue;
@@ -132,34 +147,13 @@ void Disassembler::disassemble_module(Module *module)
         instr = disassemble_instruction(instr_off, module, line_buf);
         // 4.4 record instruction
         if(instr){
-            module->insert_instr(instr);
-            // 4.4.1 record branch targets
-            if(instr->is_direct_call() || instr->is_condition_branch() || instr->is_direct_jump())
-                module->insert_br_target(instr->get_target_offset(), instr_off);
-            // 4.4.2 record maybe 0h aligned entries
+            record_instruction(module, instr, has_nop_instrs);
+            // record maybe 0h aligned entries
             if(instr->is_ret() || instr->is_jump() || instr->is_ud2() || instr->is_hlt()){
                 F_SIZE next_offset = instr->get_next_offset();
                 if(module->is_in_x_section_in_off(next_offset) && module->read_1byte_code_in_off(next_offset)==0)//align 0h
                     maybe_0h_align_start_instrs.insert(instr);
             }
-            // 4.4.3 record nop aligned entries
-            if(instr->is_nop())
-                has_nop_instrs = true;
-            else{
-                if(has_nop_instrs)// && is_0h_align(instr_off))
-                    module->insert_align_entry(instr_off);
-                has_nop_instrs = false;
-            }
-            // 4.4.4 record indirect jump
-            if(instr->is_indirect_jump())
-                module->insert_indirect_jump(instr->get_instr_offset());
-            // 4.4.5 record direct call target(maybe function)
-            if(instr->is_direct_call())
-                module->insert_call_target(instr->get_target_offset());
-            // 4.4.6 record gs segmentation
-            if(instr->has_gs_seg()){
-                module->insert_gs_instr_offset(instr_off);
-            }
         }
     }
     free(line_buf);
@@ -238,70 +232,215 @@ void Disassembler::disassemble_module(Module *module)
         module->insert_align_entry(*it);
     // 7. fix objdump error2 : due to br instructions' targets are not disassemble instruction aligned!
 #if 0 // check br targets are true now, if check_br_targets failed, you should open these codes    
+    fix_unaligned_br_targets(module);
+#endif    
+}
+
+void Disassembler::record_instruction(Module *module, Instruction *instr, BOOL &has_nop_instrs)
+{
+    F_SIZE instr_off = instr->get_instr_offset();
+    module->insert_instr(instr);
+    // 1. record branch targets
+    if(instr->is_direct_call() || instr->is_condition_branch() || instr->is_direct_jump())
+        module->insert_br_target(instr->get_target_offset(), instr_off);
+    // 2. record nop aligned entries
+    if(instr->is_nop())
+        has_nop_instrs = true;
+    else{
+        if(has_nop_instrs)// && is_0h_align(instr_off))
+            module->insert_align_entry(instr_off);
+        has_nop_instrs = false;
+    }
+    // 3. record indirect jump
+    if(instr->is_indirect_jump())
+        module->insert_indirect_jump(instr_off);
+    // 4. record direct call target(maybe function)
+    if(instr->is_direct_call())
+        module->insert_call_target(instr->get_target_offset());
+    // 5. record gs segmentation
+    if(instr->has_gs_seg()){
+        module->insert_gs_instr_offset(instr_off);
+    }
+}
+
+static BOOL is_special_encode(const UINT8 *code)
+{
+    if(code[0]==0xdf && code[1]==0xc0)//FFREEP ST0
+        return true;
+    else if(code[0]==0xc7 && code[1]==0xf8 && (*(INT32*)&code[2])==0)//xbeginq
+        return true;
+    else if(code[0]==0xc6 && code[1]==0xf8)//xabort
+        return true;
+    else if(code[0]==0x0f && code[1]==0x1 && code[2]==0xd5)//xend
+        return true;
+    else
+        return false;
+}
+
+#define SWEEP_BATCH_NUM 0x1000
+
+void Disassembler::linear_sweep_region(Module *module, F_SIZE region_start, F_SIZE region_end)
+{
+    _DInst *dinsts = new _DInst[SWEEP_BATCH_NUM];
+    _CodeInfo ci;
+    ci.dt = Decode64Bits;
+    ci.features = DF_NONE;
+    BOOL has_nop_instrs = false;
+    P_ADDRX load_base = module->get_pt_x_load_base();
+    F_SIZE curr_off = region_start;
+    BOOL has_skipped_data = false;
+    
+    while(curr_off<region_end){
+        // 1. skip data region, and resume decoding at the corrected address after it (the same as the objdump path)
+        if(!objdump_error_correction(module, curr_off + load_base)){
+            curr_off++;
+            has_skipped_data = true;
+            continue;
+        }
+        if(has_skipped_data){
+            curr_off = correct_resync_addr(module, curr_off + load_base) - load_base;
+            has_skipped_data = false;
+            if(curr_off>=region_end)
+                break;
+        }
+        // 2. decompose one batch of instructions (each instruction is decoded only once)
+        ci.code = module->get_code_offset_ptr(curr_off);
+        ci.codeLen = region_end - curr_off;
+        ci.codeOffset = curr_off;
+        UINT32 dinst_count = 0;
+        distorm_decompose(&ci, dinsts, SWEEP_BATCH_NUM, &dinst_count);
+        FATAL(dinst_count==0, "linear sweep failed at %lx in module %s\n", curr_off, module->get_path().c_str());
+        // 3. handle the decomposed instructions
+        for(UINT32 idx = 0; idx<dinst_count; idx++){
+            const _DInst &dinst = dinsts[idx];
+            ASSERT(dinst.addr==curr_off);
+            BOOL need_redecode = false;
+            // 3.1 meet data region, re-decompose after skipping
+            if(!objdump_error_correction(module, curr_off + load_base))
+                break;
+            // 3.2 construct instruction
+            Instruction *instr = NULL;
+            if(dinst.flags==FLAG_NOT_DECODABLE || is_special_encode(module->get_code_offset_ptr(curr_off))){
+                instr = disassemble_instruction(curr_off, module);
+                if(!instr){//invalid byte
+                    curr_off++;
+                    continue;
+                }
+                need_redecode = instr->get_instr_size()!=dinst.size;
+            }else
+                instr = construct_instruction(dinst, module);
+            // 3.3 record instruction
+            record_instruction(module, instr, has_nop_instrs);
+            curr_off = instr->get_next_offset();
+            // 3.4 skip 0h aligned padding after ret/jmp/ud2/hlt
+            if((instr->is_ret() || instr->is_jump() || instr->is_ud2() || instr->is_hlt()) && \
+                curr_off<region_end && module->read_1byte_code_in_off(curr_off)==0){
+                F_SIZE padding_end = curr_off;
+                while(padding_end<region_end && module->read_1byte_code_in_off(padding_end)==0)
+                    padding_end++;
+                if(padding_end<region_end && is_0h_align(padding_end)){
+                    module->insert_align_entry(padding_end);
+                    curr_off = padding_end;
+                    need_redecode = true;
+                }
+            }
+            
+            if(need_redecode)
+                break;
+        }
+    }
+
+    delete [] dinsts;
+}
+
+void Disassembler::linear_sweep_module(Module *module)
+{
+    ElfParser *elf = module->_elf;
+    // 1. linear sweep each x section
+    for(UINT32 idx = 0; idx<(UINT32)elf->get_x_section_num(); idx++){
+        F_SIZE region_start, region_end;
+        elf->get_x_region_off(idx, region_start, region_end);
+        linear_sweep_region(module, region_start, region_end);
+    }
+    // 2. fix br targets which are not instruction aligned
+    fix_unaligned_br_targets(module);
+}
+
+void Disassembler::fix_unaligned_br_targets(Module *module)
+{
 fix_again: 
-    F_SIZE br_target = 0;
     for(Module::BR_TARGETS_ITERATOR it = module->_br_targets.begin(); it!=module->_br_targets.end(); it++){
-        if((*it)!=br_target)//multiset handling
-            br_target = *it;
-        else
+        F_SIZE target_offset = it->first;
+        if(!module->is_in_x_section_in_off(target_offset) || module->is_instr_entry_in_off(target_offset, false))
             continue;
-            
-        F_SIZE target_offset = *it;
-        if(!module->is_instr_entry_in_off(target_offset, false)){
-            //judge is prefix. instruction or not 
-            target_offset -= 1;
-            Instruction *instr = module->get_instr_by_off(target_offset);
-            
-            if(!(instr && instr->has_lock_and_repeat_prefix())){
-                target_offset ++;
-                // fix objdump error!
-                std::vector<Instruction *> new_generated_instr;
-                Instruction *target_instr = NULL;
-                F_SIZE next_offset_of_target_instr = target_offset;
-                do{
-                    target_instr = disassemble_instruction(next_offset_of_target_instr, module);
-                    ASSERT(target_instr);
-                    target_instr->dump_file_inst();
-                    new_generated_instr.push_back(target_instr);
-                    next_offset_of_target_instr = target_instr->get_next_offset();
-                }while(!module->is_instr_entry_in_off(next_offset_of_target_instr, false));
-                //erase
-                std::vector<Instruction*> erased_instrs;
-                module->erase_instr_range(target_offset, next_offset_of_target_instr, erased_instrs);
-                //record instructions    
-                BOOL br_target_is_changed = false;
-                for(std::vector<Instruction*>::iterator it = new_generated_instr.begin();\
-                    it!=new_generated_instr.end(); it++){
-                    Instruction *instruction = *it;
-                    module->insert_instr(instruction);
-                    // record branch targets
-                    if(instruction->is_direct_call() || instruction->is_condition_branch() || instruction->is_direct_jump()){
-                        br_target_is_changed = true;
-                        module->insert_br_target(instruction->get_target_offset(), instruction->get_instr_offset());
-                    }
-                }
-                if(br_target_is_changed)
-                    goto fix_again;
+        //judge is prefix. instruction or not 
+        Instruction *instr = module->get_instr_by_off(target_offset - 1);
+        if(instr && instr->has_lock_and_repeat_prefix())
+            continue;
+        // re-disassemble from the target until meeting the aligned instruction
+        std::vector<Instruction *> new_generated_instr;
+        Instruction *target_instr = NULL;
+        F_SIZE next_offset_of_target_instr = target_offset;
+        do{
+            target_instr = disassemble_instruction(next_offset_of_target_instr, module);
+            ASSERT(target_instr);
+            new_generated_instr.push_back(target_instr);
+            next_offset_of_target_instr = target_instr->get_next_offset();
+        }while(module->is_in_x_section_in_off(next_offset_of_target_instr) && \
+            !module->is_instr_entry_in_off(next_offset_of_target_instr, false));
+        //erase
+        std::vector<Instruction*> erased_instrs;
+        module->erase_instr_range(target_offset, next_offset_of_target_instr, erased_instrs);
+        //record instructions    
+        BOOL br_target_is_changed = false;
+        for(std::vector<Instruction*>::iterator iter = new_generated_instr.begin();\
+            iter!=new_generated_instr.end(); iter++){
+            Instruction *instruction = *iter;
+            module->insert_instr(instruction);
+            // record branch targets
+            if(instruction->is_direct_call() || instruction->is_condition_branch() || instruction->is_direct_jump()){
+                br_target_is_changed = true;
+                module->insert_br_target(instruction->get_target_offset(), instruction->get_instr_offset());
             }
         }
+        if(br_target_is_changed)
+            goto fix_again;
     }
-#endif    
+}
+
+void Disassembler::disassemble_elf(ElfParser *elf, void *arg)
+{
+    Module *module = new Module(elf);
+    if(Options::_use_objdump)
+        disassemble_module(module);
+    else
+        linear_sweep_module(module);
+    if(module->get_name()=="freqmine"){
+        Instruction *instr = module->find_instr_by_off(0x1ed08, false);
+        module->erase_br_target(instr->get_target_offset(), 0x1ed08);
+        module->erase_instr(instr);
+    }
+    module->check_br_targets();
+}
+
+static BOOL elf_is_larger(ElfParser *a, ElfParser *b)
+{
+    return a->get_pt_x_size() > b->get_pt_x_size();
 }
 
 void Disassembler::disassemble_all_modules()
 {
+    // 1.sort elfs by the code size, the largest one is disassembled first
+    std::vector<ElfParser*> elfs;
     ElfParser::PARSED_ELF_ITERATOR it = ElfParser::_all_parsed_elfs.begin();
     for(;it!=ElfParser::_all_parsed_elfs.end();it++){
-        ElfParser *elf = it->second;
-        Module *module = new Module(elf);
-        disassemble_module(module);
-        if(module->get_name()=="freqmine"){
-            Instruction *instr = module->find_instr_by_off(0x1ed08, false);
-            module->erase_br_target(instr->get_target_offset(), 0x1ed08);
-            module->erase_instr(instr);
-        }
-        module->check_br_targets();
-    } 
+        //static analysis result is reused from db cache
+        if(!it->second->is_db_cached())
+            elfs.push_back(it->second);
+    }
+    std::stable_sort(elfs.begin(), elfs.end(), elf_is_larger);
+    // 2.disassemble elfs concurrently
+    ParallelHandler<ElfParser*>(elfs, disassemble_elf).run(Options::_analysis_thread_num);
 }
 
 Instruction *Disassembler::disassemble_instruction(const F_SIZE instr_off, const Module *module, \
@@ -345,39 +484,9 @@ Instruction *Disassembler::disassemble_instruction(const F_SIZE instr_off, const
         distorm_decompose(&_ci, &_dInst, 1, &dinstcount);
     ASSERT(_dInst.addr == instr_off);
 
-    if(dinstcount==1){
-		switch(META_GET_FC(_dInst.meta)){
-            case FC_NONE:
-                return new SequenceInstr(_dInst, module);
-			case FC_CALL:
-                {
-                    if(_dInst.ops[0].type==O_PC)//direct call
-                        return new DirectCallInstr(_dInst, module);
-                    else
-                        return new IndirectCallInstr(_dInst, module);
-                }
-			case FC_RET:
-                return new RetInstr(_dInst, module);
-            case FC_SYS:
-                return new SysInstr(_dInst, module);
-			case FC_UNC_BRANCH:
-                {
-                    if(_dInst.ops[0].type==O_PC)//direct jump
-                        return new DirectJumpInstr(_dInst, module);
-                    else
-                        return new IndirectJumpInstr(_dInst, module);
-                }
-			case FC_CND_BRANCH:
-				return new ConditionBrInstr(_dInst, module);
-            case FC_INT:
-                return new IntInstr(_dInst, module);
-			case FC_CMOV:
-				return new CmovInstr(_dInst, module);
-            default:
-                ASSERTM(0, "unkown type!\n");
-            return NULL;
-		}
-    }else{
+    if(dinstcount==1)
+        return construct_instruction(_dInst, module);
+    else{
         //failed diasm instructions
         const static std::string failed_disasm_instrs[4] = {//only for vector instructions
             "vfnmaddsd",
@@ -385,8 +494,8 @@ Instruction *Disassembler::disassemble_instruction(const F_SIZE instr_off, const
             "vfmaddss",
             "vfmsubsd",
         };
-        if(!objdump_line_buf)
-            return NULL;
+        if(!objdump_line_buf)//no objdump result, decode the fma4 instruction by encode
+            return decode_fma4_instruction(instr_off, module) ? new SequenceInstr(_dInst, module) : NULL;
         //find failed instructions, if found generate it!
         for(INT32 idx = 0; idx<4; idx++){
             if(strstr(objdump_line_buf, failed_disasm_instrs[idx].c_str())){
@@ -420,6 +529,76 @@ Instruction *Disassembler::disassemble_instruction(const F_SIZE instr_off, const
     }
 }
 
+BOOL Disassembler::decode_fma4_instruction(const F_SIZE instr_off, const Module *module)
+{
+    const UINT8 *code = module->get_code_offset_ptr(instr_off);
+    // 1. fma4 instructions: vex3(c4) + map 0f3a + 66 implied prefix + opcode(5ch-5fh, 68h-7fh) + modrm [+ sib] [+ disp] + is4
+    if(code[0]!=0xc4 || (code[1]&0x1f)!=0x3 || (code[2]&0x3)!=0x1)
+        return false;
+    UINT8 opcode = code[3];
+    if(!((opcode>=0x5c && opcode<=0x5f) || (opcode>=0x68 && opcode<=0x7f)))
+        return false;
+    // 2. calculate the instruction size
+    UINT8 mod = code[4]>>6;
+    UINT8 rm = code[4]&0x7;
+    UINT8 size = 5;//vex3 + opcode + modrm
+    _dInst.opcode = I_UNDEFINED;
+    _dInst.addr = instr_off;
+    _dInst.meta &= (~0x7);//FC_NONE
+    _dInst.flags = 0;
+    if(mod==0 && rm==5){//rip relative
+        _dInst.flags = FLAG_RIP_RELATIVE;
+        _dInst.ops[0].type = O_SMEM;
+        _dInst.dispSize = 32;
+        _dInst.disp = (UINT64)(INT64)(*(INT32*)&code[size]);
+        size += 4;
+    }else if(mod!=3){
+        if(rm==4){//sib
+            if(mod==0 && (code[size]&0x7)==5)
+                size += 4;
+            size += 1;
+        }
+        size += mod==1 ? 1 : (mod==2 ? 4 : 0);
+    }
+    _dInst.size = size + 1;//is4
+    return true;
+}
+
+Instruction *Disassembler::construct_instruction(const _DInst &dInst, const Module *module)
+{
+    switch(META_GET_FC(dInst.meta)){
+        case FC_NONE:
+            return new SequenceInstr(dInst, module);
+        case FC_CALL:
+            {
+                if(dInst.ops[0].type==O_PC)//direct call
+                    return new DirectCallInstr(dInst, module);
+                else
+                    return new IndirectCallInstr(dInst, module);
+            }
+        case FC_RET:
+            return new RetInstr(dInst, module);
+        case FC_SYS:
+            return new SysInstr(dInst, module);
+        case FC_UNC_BRANCH:
+            {
+                if(dInst.ops[0].type==O_PC)//direct jump
+                    return new DirectJumpInstr(dInst, module);
+                else
+                    return new IndirectJumpInstr(dInst, module);
+            }
+        case FC_CND_BRANCH:
+            return new ConditionBrInstr(dInst, module);
+        case FC_INT:
+            return new IntInstr(dInst, module);
+        case FC_CMOV:
+            return new CmovInstr(dInst, module);
+        default:
+            ASSERTM(0, "unkown type!\n");
+            return NULL;
+    }
+}
+
 void Disassembler::dump_pinst(const Instruction *instr, const P_ADDRX load_base)
 {
     ASSERTM(instr, "instruction * cannot be NULL!\n");
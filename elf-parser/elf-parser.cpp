@@ -6,16 +6,20 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <cpuid.h>
+#include <list>
 
 #include "elf-parser.h"
 
 std::map<std::string, ElfParser*> ElfParser::_all_parsed_elfs;
+SpinLock ElfParser::_all_parsed_elfs_lock;
 UINT32 ElfParser::_magic;
 UINT16 ElfParser::_machine;
 
 ElfParser::ElfParser(const char *elf_path): _sym_table(NULL), _symt_num(0), _dynsym_table(NULL), \
     _dynsymt_num(0), _rela_dyn(NULL), _rela_dyn_num(0), _rela_plt(NULL), _rela_plt_num(0), \
-    _str_table(NULL), _dynstr_table(NULL)
+    _str_table(NULL), _dynstr_table(NULL), _is_db_cached(false)
 {
     _elf_path = std::string(elf_path);
     ASSERT(!is_parsed(_elf_path));
@@ -112,50 +116,376 @@ void ElfParser::map_elf()
 
 void ElfParser::parse_dependence_lib()
 {
-    // get the path of all dependence libraries
-    // 1.generate command string
-    char command[128];
-    sprintf(command, "/usr/bin/ldd %s", _elf_path.c_str());
-    char type[3] = "r";
-    // 2.get stream of command's output
-    FILE *p_stream = popen(command, type);
-    ASSERTM(p_stream, "popen() error!\n");
-    // 4.parse the stream to get dependence libraries
-    SIZE len = 500;
-    char *line_buf = new char[len];
-    while(getline(&line_buf, &len, p_stream)!=-1) {  
-        char name[100];
-        char path[100];
-        char *pos = NULL;
-        P_ADDRX addr;
-        // get name and path of images
-        if((pos = strstr(line_buf, "ld-linux-x86-64"))!=NULL){
-            sscanf(line_buf, "%s (0x%lx)\n", path, &addr);
-            sscanf(pos, "%s (0x%lx)", name, &addr);
-        }else if((pos = strstr(line_buf, "linux-vdso"))!=NULL){
-            sscanf(line_buf, "%s => (0x%lx)\n", name, &addr);
-            path[0] = '\0';
-        }else if((pos = strstr(line_buf, "statically"))!=NULL){
-            path[0] = '\0';
-            name[0] = '\0';
-        }else{    
-            sscanf(line_buf, "%s => %s (0x%lx)\n", name, path, &addr);
-            ASSERTM(strstr(path, name), "Name(%s) is not in Path(%s)\n", name, path);
+    // 1.resolve the path of all dependence libraries from the dynamic section
+    DYNAMIC_INFO info;
+    read_dynamic_info((const UINT8*)_map_start, _dynstr_table, info);
+    std::vector<std::string> lib_paths;
+    resolve_dependence_libs(_elf_path, info, lib_paths);
+    // 2.record parsed elf
+    for(std::vector<std::string>::iterator iter = lib_paths.begin(); iter!=lib_paths.end(); iter++){
+        ElfParser *elf = NULL;
+        if(is_parsed(*iter))
+            elf = get_elf_parser(*iter);
+        else 
+            elf = new ElfParser(iter->c_str());
+
+        _dependence_elfs.push_back(elf);
+    }
+}
+
+static const UINT8 *map_readonly_file(const std::string file_path, SIZE &file_size)
+{
+    INT32 fd = open(file_path.c_str(), O_RDONLY);
+    if(fd==-1)
+        return NULL;
+    struct stat statbuf;
+    INT32 ret = fstat(fd, &statbuf);
+    PERROR(ret==0, "fstat failed!");
+    file_size = statbuf.st_size;
+    void *map_ret = file_size==0 ? MAP_FAILED : mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return map_ret==MAP_FAILED ? NULL : (const UINT8*)map_ret;
+}
+
+void ElfParser::read_dynamic_info(const UINT8 *map_start, const char *dynstr_table, DYNAMIC_INFO &info)
+{
+    Elf64_Ehdr *elf_header = (Elf64_Ehdr*)map_start;
+    Elf64_Phdr *Phdr = (Elf64_Phdr*)(map_start + elf_header->e_phoff);
+    for(UINT16 idx=0; idx<elf_header->e_phnum; idx++){
+        // 1.program interpreter
+        if(Phdr[idx].p_type==PT_INTERP)
+            info.interp = std::string((const char*)(map_start + Phdr[idx].p_offset));
+        // 2.DT_NEEDED/DT_RPATH/DT_RUNPATH in dynamic segment
+        if(Phdr[idx].p_type!=PT_DYNAMIC || !dynstr_table)
+            continue;
+        Elf64_Dyn *dyn = (Elf64_Dyn*)(map_start + Phdr[idx].p_offset);
+        for(; dyn->d_tag!=DT_NULL; dyn++){
+            if(dyn->d_tag==DT_NEEDED)
+                info.needed.push_back(std::string(dynstr_table + dyn->d_un.d_val));
+            else if(dyn->d_tag==DT_RPATH)
+                info.rpath = std::string(dynstr_table + dyn->d_un.d_val);
+            else if(dyn->d_tag==DT_RUNPATH)
+                info.runpath = std::string(dynstr_table + dyn->d_un.d_val);
+        }
+    }
+}
+
+void ElfParser::read_dynamic_info(const std::string elf_path, DYNAMIC_INFO &info)
+{
+    SIZE map_size = 0;
+    const UINT8 *map_start = map_readonly_file(elf_path, map_size);
+    FATAL(!map_start, "open %s failed!\n", elf_path.c_str());
+    // 1.find .dynstr which is linked by the dynamic section
+    Elf64_Ehdr *elf_header = (Elf64_Ehdr*)map_start;
+    Elf64_Shdr *SecHdr = (Elf64_Shdr *)(map_start + elf_header->e_shoff);
+    const char *dynstr_table = NULL;
+    for(INT32 idx=0; idx<elf_header->e_shnum; idx++){
+        if(SecHdr[idx].sh_type==SHT_DYNAMIC){
+            dynstr_table = (const char*)(map_start + SecHdr[SecHdr[idx].sh_link].sh_offset);
+            break;
+        }
+    }
+    // 2.read dynamic information
+    read_dynamic_info(map_start, dynstr_table, info);
+    munmap((void*)map_start, map_size);
+}
+
+BOOL ElfParser::is_loadable_elf(const std::string elf_path)
+{
+    INT32 fd = open(elf_path.c_str(), O_RDONLY);
+    if(fd==-1)
+        return false;
+    Elf64_Ehdr elf_header;
+    BOOL is_loadable = read(fd, &elf_header, sizeof(Elf64_Ehdr))==sizeof(Elf64_Ehdr) && \
+        memcmp(elf_header.e_ident, ELFMAG, SELFMAG)==0 && elf_header.e_ident[EI_CLASS]==ELFCLASS64 && \
+        elf_header.e_machine==EM_X86_64;
+    close(fd);
+    return is_loadable;
+}
+
+//expand every $name or ${name} in the dir like ld.so, $name must not be followed by an identifier character
+static void expand_dst(std::string &dir, const std::string &name, const std::string &value)
+{
+    SIZE pos = 0;
+    while((pos = dir.find('$', pos))!=std::string::npos){
+        SIZE name_end = pos + 1 + name.length();
+        SIZE token_len = 0;
+        if(dir.compare(pos + 1, name.length() + 2, "{" + name + "}")==0)
+            token_len = name.length() + 3;
+        else if(dir.compare(pos + 1, name.length(), name)==0 && \
+            (name_end==dir.length() || !(isalnum((UINT8)dir[name_end]) || dir[name_end]=='_')))
+            token_len = name.length() + 1;
+        if(token_len==0){
+            pos++;
+            continue;
+        }
+        dir.replace(pos, token_len, value);
+        pos += value.length();
+    }
+}
+
+std::string ElfParser::search_lib_in_dirs(const std::string lib_name, const std::string dirs, const std::string origin, \
+    BOOL empty_is_cwd)
+{
+    //an empty DT_RPATH/DT_RUNPATH means no dir to search
+    if(dirs.empty())
+        return std::string("");
+    SIZE start = 0;
+    while(start<=dirs.length()){
+        // 1.split the dirs by ':'
+        SIZE end = dirs.find(':', start);
+        if(end==std::string::npos)
+            end = dirs.length();
+        std::string dir = dirs.substr(start, end - start);
+        start = end + 1;
+        if(dir.empty()){
+            if(!empty_is_cwd)
+                continue;
+            dir = ".";
+        }
+        // 2.expand $ORIGIN and $PLATFORM (AT_PLATFORM of x86-64), $LIB depends on how the distribution builds ld.so,
+        //   so the dirs with unexpanded tokens are skipped instead of being searched literally
+        expand_dst(dir, "ORIGIN", origin);
+        expand_dst(dir, "PLATFORM", "x86_64");
+        if(dir.find('$')!=std::string::npos)
+            continue;
+        // 3.judge the library is exist or not
+        std::string lib_path = dir + "/" + lib_name;
+        if(is_loadable_elf(lib_path))
+            return lib_path;
+    }
+    return std::string("");
+}
+
+//return the x86-64 micro-architecture level (1~4) of the cpu, which selects the glibc-hwcaps subdirectory
+static UINT32 get_cpu_isa_level()
+{
+    UINT32 eax, ebx, ecx, edx, ext_ecx = 0, leaf7_ebx = 0, xcr0 = 0;
+    UINT32 max_leaf = __get_cpuid_max(0, NULL);
+    if(max_leaf<1)
+        return 1;
+    __cpuid(1, eax, ebx, ecx, edx);
+    if(__get_cpuid_max(0x80000000, NULL)>=0x80000001)
+        __cpuid(0x80000001, eax, ebx, ext_ecx, edx);
+    if(max_leaf>=7)
+        __cpuid_count(7, 0, eax, leaf7_ebx, edx, edx);
+    //the avx (and avx512) states must be enabled by the kernel
+    if(ecx&(1u<<27))
+        __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+    //v2: sse3, ssse3, cx16, sse4.1, sse4.2, popcnt, lahf_lm
+    const UINT32 v2_ecx = (1u<<0)|(1u<<9)|(1u<<13)|(1u<<19)|(1u<<20)|(1u<<23);
+    if((ecx&v2_ecx)!=v2_ecx || !(ext_ecx&(1u<<0)))
+        return 1;
+    //v3: fma, movbe, osxsave, avx, f16c, lzcnt, bmi1, avx2, bmi2
+    const UINT32 v3_ecx = (1u<<12)|(1u<<22)|(1u<<27)|(1u<<28)|(1u<<29);
+    const UINT32 v3_ebx = (1u<<3)|(1u<<5)|(1u<<8);
+    if((ecx&v3_ecx)!=v3_ecx || !(ext_ecx&(1u<<5)) || (leaf7_ebx&v3_ebx)!=v3_ebx || (xcr0&0x6)!=0x6)
+        return 2;
+    //v4: avx512f, avx512dq, avx512cd, avx512bw, avx512vl
+    const UINT32 v4_ebx = (1u<<16)|(1u<<17)|(1u<<28)|(1u<<30)|(1u<<31);
+    if((leaf7_ebx&v4_ebx)!=v4_ebx || (xcr0&0xe6)!=0xe6)
+        return 3;
+    return 4;
+}
+
+//return the x86-64 level of the glibc-hwcaps library path, 0 if it is not a known x86-64 subdirectory
+static UINT32 get_hwcaps_isa_level(const std::string &lib_path)
+{
+    const std::string hwcaps_dir = "/glibc-hwcaps/x86-64-v";
+    SIZE pos = lib_path.find(hwcaps_dir);
+    if(pos==std::string::npos || pos + hwcaps_dir.length() + 1>=lib_path.length())
+        return 0;
+    char level = lib_path[pos + hwcaps_dir.length()];
+    BOOL is_dir_end = lib_path[pos + hwcaps_dir.length() + 1]=='/';
+    return (is_dir_end && level>='2' && level<='4') ? (UINT32)(level - '0') : 0;
+}
+
+std::string ElfParser::search_lib_in_ld_so_cache(const std::string lib_name)
+{
+    //each library keeps the path and its x86-64 level (1 represents the entry without hwcap)
+    static std::map<std::string, std::pair<UINT32, std::string> > ld_so_cache;
+    static BOOL ld_so_cache_is_read = false;
+    // 1.read /etc/ld.so.cache only once
+    if(!ld_so_cache_is_read){
+        ld_so_cache_is_read = true;
+        SIZE cache_size = 0;
+        const UINT8 *cache = map_readonly_file("/etc/ld.so.cache", cache_size);
+        if(cache){
+            // 1.1 skip the old format (ld.so-1.7.0) which may precede the new format
+            SIZE new_offset = 0;
+            if(cache_size>=16 && memcmp(cache, "ld.so-1.7.0", 11)==0)
+                new_offset = (16 + (*(UINT32*)(cache + 12))*12 + 7)&(~7);
+            // 1.2 read the new format (glibc-ld.so.cache1.1), strings are relative to the new header
+            if(new_offset+48<=cache_size && memcmp(cache + new_offset, "glibc-ld.so.cache1.1", 20)==0){
+                const UINT8 *base = cache + new_offset;
+                SIZE limit = cache_size - new_offset;
+                UINT32 lib_num = *(UINT32*)(base + 20);
+                UINT32 cpu_level = get_cpu_isa_level();
+                for(UINT32 idx = 0; idx<lib_num && 48+(idx+1)*24<=limit; idx++){
+                    const UINT8 *entry = base + 48 + idx*24;
+                    INT32 flags = *(INT32*)entry;
+                    UINT32 key = *(UINT32*)(entry + 4);
+                    UINT32 value = *(UINT32*)(entry + 8);
+                    UINT64 hwcap = *(UINT64*)(entry + 16);
+                    // only x86-64 libc6 libraries
+                    if(flags!=0x0303 || key>=limit || value>=limit)
+                        continue;
+                    // glibc-hwcaps entries (bit 62 of hwcap) are used only if the cpu supports their level, the legacy
+                    //   hwcap subdirectories are not searched, so the entry without hwcap is preferred
+                    std::string lib_path = std::string((const char*)(base + value));
+                    UINT32 level = 1;
+                    if(hwcap!=0){
+                        level = (hwcap&(1ull<<62)) ? get_hwcaps_isa_level(lib_path) : 0;
+                        if(level==0 || level>cpu_level)
+                            continue;
+                    }
+                    // the highest level is loaded by ld.so, the former entry has higher priority in the same level
+                    std::string name = std::string((const char*)(base + key));
+                    std::map<std::string, std::pair<UINT32, std::string> >::iterator iter = ld_so_cache.find(name);
+                    if(iter==ld_so_cache.end())
+                        ld_so_cache.insert(std::make_pair(name, std::make_pair(level, lib_path)));
+                    else if(iter->second.first<level)
+                        iter->second = std::make_pair(level, lib_path);
+                }
+            }
+            munmap((void*)cache, cache_size);
         }
-        //record parsed elf
-        if((path[0]!='\0')){
-            ElfParser *elf = NULL;
-            if(is_parsed(path))
-                elf = get_elf_parser(path);
-            else 
-                elf = new ElfParser(path);
-
-            _dependence_elfs.push_back(elf);
+    }
+    // 2.search the library
+    std::map<std::string, std::pair<UINT32, std::string> >::iterator iter = ld_so_cache.find(lib_name);
+    if(iter!=ld_so_cache.end() && is_loadable_elf(iter->second.second))
+        return iter->second.second;
+    else
+        return std::string("");
+}
+
+static std::string get_origin(const std::string elf_path)
+{
+    SIZE found = elf_path.find_last_of('/');
+    return found==std::string::npos ? std::string(".") : elf_path.substr(0, found);
+}
+
+std::string ElfParser::search_lib(const std::string lib_name, const DYNAMIC_INFO &requester, const std::string requester_path, \
+    const DYNAMIC_INFO &main_elf, const std::string main_path)
+{
+    std::string lib_path;
+    // 1.library name with '/' is a path
+    if(lib_name.find('/')!=std::string::npos)
+        return is_loadable_elf(lib_name) ? lib_name : std::string("");
+    // 2.DT_RPATH of requester and main elf, DT_RPATH is ignored if DT_RUNPATH exists
+    if(requester.runpath.empty()){
+        if(!(lib_path = search_lib_in_dirs(lib_name, requester.rpath, get_origin(requester_path))).empty())
+            return lib_path;
+        if(main_elf.runpath.empty() && \
+            !(lib_path = search_lib_in_dirs(lib_name, main_elf.rpath, get_origin(main_path))).empty())
+            return lib_path;
+    }
+    // 3.LD_LIBRARY_PATH
+    const char *ld_library_path = getenv("LD_LIBRARY_PATH");
+    if(ld_library_path && \
+        !(lib_path = search_lib_in_dirs(lib_name, std::string(ld_library_path), get_origin(requester_path), true)).empty())
+        return lib_path;
+    // 4.DT_RUNPATH of requester
+    if(!(lib_path = search_lib_in_dirs(lib_name, requester.runpath, get_origin(requester_path))).empty())
+        return lib_path;
+    // 5./etc/ld.so.cache
+    if(!(lib_path = search_lib_in_ld_so_cache(lib_name)).empty())
+        return lib_path;
+    // 6.default dirs
+    return search_lib_in_dirs(lib_name, "/lib/x86_64-linux-gnu:/usr/lib/x86_64-linux-gnu:/lib64:/usr/lib64:/lib:/usr/lib", "");
+}
+
+void ElfParser::resolve_dependence_libs(const std::string elf_path, const DYNAMIC_INFO &main_info, std::vector<std::string> &lib_paths)
+{
+    std::set<std::string> found_names;
+    found_names.insert(get_name(elf_path));
+    // 1.resolve the needed libraries in breadth-first order (like ldd)
+    std::list<std::pair<std::string, DYNAMIC_INFO> > requesters;
+    requesters.push_back(std::make_pair(elf_path, main_info));
+    while(!requesters.empty()){
+        std::string requester_path = requesters.front().first;
+        DYNAMIC_INFO requester = requesters.front().second;
+        requesters.pop_front();
+        for(std::vector<std::string>::iterator iter = requester.needed.begin(); iter!=requester.needed.end(); iter++){
+            std::string lib_name = *iter;
+            if(found_names.find(lib_name)!=found_names.end())
+                continue;
+            found_names.insert(lib_name);
+            std::string lib_path = search_lib(lib_name, requester, requester_path, main_info, elf_path);
+            if(lib_path.empty()){
+                ERR("%s => not found (needed by %s)\n", lib_name.c_str(), requester_path.c_str());
+                continue;
+            }
+            if(found_names.find(get_name(lib_path))!=found_names.end() && get_name(lib_path)!=lib_name)
+                continue;
+            found_names.insert(get_name(lib_path));
+            lib_paths.push_back(lib_path);
+            // 1.1 the needed libraries of this library should be resolved too
+            DYNAMIC_INFO lib_info;
+            read_dynamic_info(lib_path, lib_info);
+            requesters.push_back(std::make_pair(lib_path, lib_info));
         }
     }
-    free(line_buf);
-    // 5.close stream
-    pclose(p_stream);
+    // 2.program interpreter
+    if(!main_info.interp.empty() && found_names.find(get_name(main_info.interp))==found_names.end())
+        lib_paths.push_back(main_info.interp);
+}
+
+void ElfParser::resolve_dependence_libs(const std::string elf_path, std::vector<std::string> &lib_paths)
+{
+    DYNAMIC_INFO info;
+    read_dynamic_info(elf_path, info);
+    resolve_dependence_libs(elf_path, info, lib_paths);
+}
+
+std::string ElfParser::calculate_elf_id(const UINT8 *map_start, const SIZE map_size)
+{
+    char id_buf[20];
+    std::string elf_id;
+    // 1.search GNU build-id in PT_NOTE segments
+    Elf64_Ehdr *elf_header = (Elf64_Ehdr*)map_start;
+    Elf64_Phdr *Phdr = (Elf64_Phdr*)(map_start + elf_header->e_phoff);
+    for(UINT16 idx=0; idx<elf_header->e_phnum; idx++){
+        if(Phdr[idx].p_type!=PT_NOTE)
+            continue;
+        F_SIZE note_off = Phdr[idx].p_offset;
+        F_SIZE note_end = note_off + Phdr[idx].p_filesz;
+        ASSERT(note_end<=map_size);
+        while(note_off+sizeof(Elf64_Nhdr)<=note_end){
+            Elf64_Nhdr *note = (Elf64_Nhdr*)(map_start + note_off);
+            F_SIZE name_off = note_off + sizeof(Elf64_Nhdr);
+            F_SIZE desc_off = name_off + ((note->n_namesz+3)&(~3));
+            if(desc_off+note->n_descsz>note_end)
+                break;
+            if(note->n_type==NT_GNU_BUILD_ID && note->n_namesz==4 && memcmp(map_start+name_off, "GNU", 4)==0){
+                for(UINT32 byte_idx = 0; byte_idx<note->n_descsz; byte_idx++){
+                    sprintf(id_buf, "%02x", map_start[desc_off+byte_idx]);
+                    elf_id += id_buf;
+                }
+                return elf_id;
+            }
+            note_off = desc_off + ((note->n_descsz+3)&(~3));
+        }
+    }
+    // 2.no build-id, use the content hash (64bit FNV-1a)
+    UINT64 hash = 0xcbf29ce484222325ull;
+    for(SIZE idx = 0; idx<map_size; idx++){
+        hash ^= map_start[idx];
+        hash *= 0x100000001b3ull;
+    }
+    sprintf(id_buf, "h%016llx", hash);
+    elf_id = std::string(id_buf);
+    return elf_id;
+}
+
+std::string ElfParser::calculate_elf_id(const std::string elf_path)
+{
+    SIZE map_size = 0;
+    const UINT8 *map_start = map_readonly_file(elf_path, map_size);
+    FATAL(!map_start, "open %s failed!\n", elf_path.c_str());
+    std::string elf_id = calculate_elf_id(map_start, map_size);
+    munmap((void*)map_start, map_size);
+    return elf_id;
 }
 
 ElfParser::~ElfParser()
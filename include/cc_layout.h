@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "type.h"
+#include "utility.h"
+
+//code cache layout is a sorted array of placed ranges [low, high], ptr is the rbbl or the kind of the range
+//trampolines are placed once for each code cache, rbbls of each code variant are appended in address order,
+//so generating a code variant does not allocate memory for each basic block
+class CodeCacheLayout
+{
+public:
+	typedef struct{
+		S_ADDRX low;
+		S_ADDRX high;
+		S_ADDRX ptr;
+	}ENTRY;
+protected:
+	std::vector<ENTRY> _entries;
+	static bool is_lower(const ENTRY &entry, S_ADDRX addr) {return entry.low<addr;}
+	static bool is_higher(S_ADDRX addr, const ENTRY &entry) {return addr<entry.low;}
+public:
+	void reserve(SIZE entry_num) {_entries.reserve(entry_num);}
+	//the capacity is kept to generate the next code variant
+	void clear() {_entries.clear();}
+	SIZE size() const {return _entries.size();}
+	const ENTRY &operator[](SIZE idx) const {return _entries[idx];}
+	/*  @Arguments:
+			1. [low, high] is the range to place, ptr is the rbbl or the kind of the range
+			2. idx returns the index of the range with the same low
+		@Return: false if the low has already been placed (same as std::map::insert)
+		@Introduction: ranges placed at the highest address are appended directly,
+			others are inserted in order (only used when placing the trampolines)
+	*/
+	BOOL insert(S_ADDRX low, S_ADDRX high, S_ADDRX ptr, SIZE &idx)
+	{
+		ASSERT(high>=low);
+		ENTRY entry = {low, high, ptr};
+		if(_entries.empty() || _entries.back().low<low){
+			idx = _entries.size();
+			_entries.push_back(entry);
+			return true;
+		}
+		std::vector<ENTRY>::iterator iter = std::lower_bound(_entries.begin(), _entries.end(), low, is_lower);
+		idx = iter - _entries.begin();
+		if(iter->low==low)
+			return false;
+		_entries.insert(iter, entry);
+		return true;
+	}
+	BOOL insert(S_ADDRX low, S_ADDRX high, S_ADDRX ptr)
+	{
+		SIZE idx;
+		return insert(low, high, ptr, idx);
+	}
+	void erase(SIZE idx) {_entries.erase(_entries.begin() + idx);}
+	//index of the first range whose low is not lower than addr
+	SIZE lower_bound(S_ADDRX addr) const
+	{
+		return std::lower_bound(_entries.begin(), _entries.end(), addr, is_lower) - _entries.begin();
+	}
+	//index of the first range whose low is higher than addr
+	SIZE upper_bound(S_ADDRX addr) const
+	{
+		return std::upper_bound(_entries.begin(), _entries.end(), addr, is_higher) - _entries.begin();
+	}
+	//return the range covers the addr, NULL if the addr is not placed
+	const ENTRY *find_cover(S_ADDRX addr) const
+	{
+		SIZE idx = upper_bound(addr);
+		if(idx==0)
+			return NULL;
+		const ENTRY &entry = _entries[idx-1];
+		return addr<=entry.high ? &entry : NULL;
+	}
+	//free space between two adjacent ranges
+	static S_SIZE get_space(const ENTRY &prev, const ENTRY &curr) {return curr.low - prev.high - 1;}
+};
+
@@ -2,11 +2,15 @@
 
 #include <map>
 #include <set>
+#include <vector>
+#include <algorithm>
 
 #include "type.h"
 #include "utility.h"
 #include "relocation.h"
 #include "range.h"
+#include "cc_layout.h"
+#include "netlink.h"
 
 //if range is randomBBL, void* is not 0 and 1, if range is jmp8 trampoline, void* is 0, 
 //if range is jmp32 tramp, void* is 1; 
@@ -18,17 +22,21 @@
 #define MAIN_JMP_TABLE 5
 #define RBBL_PTR_MIN 6
 
-typedef std::map<Range<S_ADDRX>, S_ADDRX> CC_LAYOUT;
+typedef CodeCacheLayout CC_LAYOUT;
 typedef std::map<S_ADDRX, UINT64> COMMON_DATA;//first is CC_LAYOUT.low, second is max size of upper define size
 
-typedef CC_LAYOUT::iterator CC_LAYOUT_ITER;
-typedef std::pair<CC_LAYOUT_ITER, BOOL> CC_LAYOUT_PAIR;
-
 class CodeVariantManager
 {
 public:
-	typedef std::map<F_SIZE, RandomBBL*> RAND_BBL_MAPS;
-	typedef std::map<F_SIZE, RAND_BBL_MAPS> RAND_BBU_MAPS;
+	//rbbls sorted by offset, they are appended in offset order when loading the db, so no node is allocated for each rbbl
+	typedef std::pair<F_SIZE, RandomBBL*> RBBL_ENTRY;
+	typedef std::vector<RBBL_ENTRY> RAND_BBL_VEC;
+	//basic block unit is the run [start, start+num) of the rbbls in offset order
+	typedef struct{
+		UINT32 start;
+		UINT32 num;
+	}RBBU;
+	typedef std::vector<RBBU> RAND_BBU_VEC;
 	typedef std::set<RandomBBL*> RAND_BBL_SET;
 	typedef std::set<F_SIZE> TARGET_SET;
 	typedef TARGET_SET::iterator TARGET_ITERATOR;
@@ -37,61 +45,96 @@ public:
 	typedef std::vector<F_SIZE> JMP_TABLE_CONTENT;
 	typedef std::map<F_SIZE, JMP_TABLE_CONTENT> JMP_TABLE_MAPS;
 	typedef std::map<std::string, CodeVariantManager*> CVM_MAPS;
+	typedef std::map<F_SIZE, UINT64> EXEC_COUNTS;//first is the sampled offset of the module, second is the count
+	typedef std::map<std::string, EXEC_COUNTS> EXEC_PROFILE;//first is the real name of the module
 	typedef struct{
 		P_ADDRX sighandler;
 		P_ADDRX sigreturn;
-		BOOL cv1_handled;
-		BOOL cv2_handled;
+		BOOL cv_handled[MAX_CV_NUM];
 	}SIG_INFO;
 	typedef std::map<P_ADDRX, SIG_INFO> SIG_HANDLERS;
 	typedef struct{
 		S_ADDRX ss_base;
 		S_SIZE ss_size;
+		P_ADDRX ss_load_end;//end of the shadow stack in the protected process
 		INT32 ss_fd;
 		std::string shm_file;
 	}SS_INFO;
 	typedef std::map<std::string, SS_INFO> SS_MAPS;
+	typedef struct{
+		S_ADDRX start;
+		S_ADDRX end;
+		CodeVariantManager *cvm;
+	}CVM_RANGE;
+	typedef std::vector<CVM_RANGE> CVM_RANGE_INDEX;//sorted by start, ranges of different cvms are not overlapped
+	//rbbls placed at [old_offset, old_offset+len) of the old code cache are placed at new_offset of the new one,
+	//adjacent rbbls which are also adjacent in the new code variant are merged into one run
+	typedef struct{
+		UINT32 old_offset;
+		UINT32 len;
+		UINT32 new_offset;
+	}PC_RUN;
+	typedef struct{
+		BOOL is_valid;
+		UINT32 old_cv_id;
+		std::vector<PC_RUN> runs;//sorted by old_offset
+	}PC_TRANSLATION;
+	//one code variant of the ring, it is generated into [cc_base, cc_base+_cc_load_size) of the shm file
+	typedef struct{
+		S_ADDRX cc_base;
+		S_ADDRX cc_used_base;
+		S_ADDRX cc_dirty_end;//[cc_base, cc_dirty_end) may hold the code of consumed code variants
+		CC_LAYOUT cc_layout;
+		RBBL_CC_ADDRS rbbl_addrs;//store the cc address of each rbbl slot
+		JMPIN_CC_OFFSET jmpin_rbbl_offsets;//store the switch-case/memset jmpin offset
+		PC_TRANSLATION translation;//translate the pcs of the previous code variant in the ring into this one
+		SIZE reduced_jmp_num;//number of the last jmp rel32 eliminated because the fall-through rbbl follows
+		SIZE relaxed_br_num;//number of the trailing branches relaxed into rel8
+		SIZE tail_br_num;//number of the trailing branches which could be relaxed
+		SIZE relaxed_bytes;//bytes compacted by relaxing the trailing branches
+#ifdef USE_TRAMP_RECORD_OPT
+		BOOL has_common_record;
+		CC_LAYOUT common_cc_layout;
+		JMPIN_CC_OFFSET common_jmpin_offset;
+		S_ADDRX common_used_cc_base;
+		COMMON_DATA common_data;
+#endif
+	}CODE_VARIANT;
 protected:
-	RAND_BBL_MAPS _postion_fixed_rbbl_maps;
-	RAND_BBL_MAPS _movable_rbbl_maps;
+	RAND_BBL_VEC _postion_fixed_rbbls;
+	RAND_BBL_VEC _movable_rbbls;
 	JMPIN_TARGETS_MAPS _switch_case_jmpin_rbbl_maps;
 	JMP_TABLE_MAPS _main_switch_case_jump_table;
 	std::string _elf_real_name;
+	std::string _elf_real_path;
 	LKM_SS_TYPE _ss_type;
+	BOOL _is_from_db_cache;
+	UINT64 _db_load_time;//us
+	UINT64 _arrange_num;//number of arranged layouts, mixed into the fixed seed
+	volatile UINT64 _gen_time;//ns, sum of the arranging and relocation tasks of the generating code variant
+	//zero-copy db, rbbl views point into the mapped db file
+	S_ADDRX _db_map_start;
+	SIZE _db_map_size;
+	std::vector<std::pair<RandomBBL*, SIZE> > _db_rbbl_views;
 	/********generate code information********/
-	RAND_BBU_MAPS _rbbu_maps;//basic block unit due to fallthrough optimization
-#ifdef USE_TRAMP_RECORD_OPT
-	//cc1
-	BOOL _has_common_record1;
-	CC_LAYOUT _common_cc_layout1;
-	JMPIN_CC_OFFSET _common_jmpin_offset1;
-	S_ADDRX _common_used_cc_base1;
-	COMMON_DATA _common_data1;	
-	//cc2
-	BOOL _has_common_record2;
-	CC_LAYOUT _common_cc_layout2;
-	JMPIN_CC_OFFSET _common_jmpin_offset2;
-	S_ADDRX _common_used_cc_base2;
-	COMMON_DATA _common_data2;	
-#endif
-    CC_LAYOUT _cc_layout1;
-	CC_LAYOUT _cc_layout2;
-	S_ADDRX _cc1_used_base;
-	S_ADDRX _cc2_used_base;
-    //store the mapping which maps from binary offset to cc address
-    RBBL_CC_MAPS _rbbl_maps1;
-	RBBL_CC_MAPS _rbbl_maps2;
-    //store the switch-case/memset jmpin offset
-    JMPIN_CC_OFFSET _jmpin_rbbl_offsets1;
-	JMPIN_CC_OFFSET _jmpin_rbbl_offsets2;
+	std::vector<RandomBBL*> _rbbls;//all rbbls in offset order, which is also the order of slots
+	RAND_BBU_VEC _rbbus;//basic block unit due to fallthrough optimization
+	//profile-guided layout, hot rbbus are placed in a dense region before the cold rbbus, both are in offset order
+	RAND_BBU_VEC _hot_rbbus;
+	RAND_BBU_VEC _cold_rbbus;
+	SIZE _hot_rbbl_num;
+	std::vector<F_SIZE> _slot_offsets;//sorted offsets of all rbbl slots
+	std::vector<RBBL_SLOT> _reloc_slots;//resolved target slots of all relocations, each rbbl points to its own part
+	//ring of code variants, only the first Options::_cv_num ones are used
+	CODE_VARIANT _cvs[MAX_CV_NUM];
 	//static vars
-	static BOOL _is_cv1_ready;
-	static BOOL _is_cv2_ready;
+	//modified under the lock shared by the generator and the switcher
+	static volatile BOOL _is_cv_ready[MAX_CV_NUM];
 	/*****************************************/
 	//shuffle process information
 	//code cache
-	S_ADDRX _cc1_base;
-	S_ADDRX _cc2_base;
+	S_ADDRX _cc_map_base;
+	S_SIZE _cc_map_size;
 	std::string _cc_shm_path;
 	INT32 _cc_fd;
 	//protected process information
@@ -106,6 +149,10 @@ protected:
 	static SS_MAPS _ss_maps;
 	//static vars
 	static CVM_MAPS _all_cvm_maps;
+	//address indexes of all cvms, they are rebuilt when the modules are loaded or unloaded
+	static CVM_RANGE_INDEX _x_range_index;//[_org_x_load_base, +_org_x_load_size)
+	static CVM_RANGE_INDEX _cc_range_index;//[_cc_load_base, +_cc_load_size)
+	static CVM_RANGE_INDEX _cc_map_range_index;//[_cc_map_base, +_cc_map_size)
 	static std::string _code_variant_img_path;
 	static SIZE _cc_offset;
 	static SIZE _ss_offset;
@@ -113,6 +160,8 @@ protected:
 	static BOOL _has_init;
 	//signal related
 	static SIG_HANDLERS _sig_handlers;
+	//execution profile
+	static EXEC_PROFILE _exec_profile;
 public:
 	//get functions
 	CodeVariantManager(std::string module_path);
@@ -120,16 +169,46 @@ public:
 	static BOOL is_added(const std::string elf_path);
 	static void recycle();
 	static void init_from_db(std::string elf_path, std::string db_path, LKM_SS_TYPE ss_type);
-	static RandomBBL *find_rbbl_from_all_paddrx(P_ADDRX p_addr, BOOL is_first_cc);
-	static RandomBBL *find_rbbl_from_all_saddrx(S_ADDRX s_addr, BOOL is_first_cc);
-	static P_ADDRX find_cc_paddrx_from_all_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc);
-	static S_ADDRX find_cc_saddrx_from_all_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc);
-	static P_ADDRX find_cc_paddrx_from_all_rbbls(RandomBBL *rbbl, BOOL is_first_cc);
+	/*  @Arguments: shadow stack type
+		@Return: None
+		@Introduction: construct the cvms of parsed elfs which have static analysis results in the db cache (-c),
+			and mark the elfs as cached, so the disassembler and analysis skip them.
+	*/
+	static void init_from_db_cache(LKM_SS_TYPE ss_type);
+	/*  @Arguments: profile_path is the execution profile, each line is "module_name offset count", module_name is
+			the real file name of the module, offset is the sampled pc relative to the module base (pin or perf samples)
+		@Return: None
+		@Introduction: read the execution counts of all modules, they are applied when the cvms are initialized
+	*/
+	static void read_exec_profile(std::string profile_path);
+	static RandomBBL *find_rbbl_from_all_paddrx(P_ADDRX p_addr, UINT32 cv_id);
+	static RandomBBL *find_rbbl_from_all_saddrx(S_ADDRX s_addr, UINT32 cv_id);
+	static P_ADDRX find_cc_paddrx_from_all_orig(P_ADDRX orig_p_addrx, UINT32 cv_id);
+	static S_ADDRX find_cc_saddrx_from_all_orig(P_ADDRX orig_p_addrx, UINT32 cv_id);
+	static P_ADDRX find_cc_paddrx_from_all_rbbls(RandomBBL *rbbl, UINT32 cv_id);
 	static void start_gen_code_variants();
 	static void stop_gen_code_variants();
-	static P_ADDRX get_new_pc_from_old_all(P_ADDRX old_pc, BOOL first_cc_is_new);
-	static void patch_new_pc(long new_ips[MAX_STOP_NUM], long old_ips[MAX_STOP_NUM], BOOL first_cc_is_new);
-	static void patch_new_ra_in_all_ss(BOOL first_cc_is_new);
+	/*  @Arguments: old_pc is in the code variant old_cv_id, new_cv_id is the code variant to switch to
+		@Return: the pc in the new code variant, 0 if old_pc is not in any code cache
+		@Introduction: both code variants must be ready
+	*/
+	static P_ADDRX get_new_pc_from_old_all(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id);
+	static void patch_new_pc(long new_ips[MAX_STOP_NUM], long old_ips[MAX_STOP_NUM], UINT32 old_cv_id, UINT32 new_cv_id);
+	/*  @Arguments: curr_cv_id is the code variant which is switched to
+		@Return: None
+		@Introduction: build the pc translation from the current code variant to the next one in the ring
+			if the next one is ready, so the next switch translates each pc by one binary search
+	*/
+	static void prepare_pc_translation(UINT32 curr_cv_id);
+	/*  @Arguments: 
+			1. old_cv_id is switched to new_cv_id
+			2. curr_sp and additional_sps are the stack pointers of the current and stopped processes/threads
+		@Return: None
+		@Introduction: patch the return addresses of the live frames in all shadow stacks, the shadow stack
+			slot of a stack address is (addr - _ss_offset), so the live part of each shadow stack is above the 
+			deepest stack pointer which falls in it
+	*/
+	static void patch_new_ra_in_all_ss(UINT32 old_cv_id, UINT32 new_cv_id, long curr_sp, long additional_sps[MAX_STOP_NUM]);
 	static void init_protected_proc_info(PID protected_pid, SIZE cc_offset, SIZE ss_offset, P_ADDRX gs_base, LKM_SS_TYPE ss_type)
 	{
 		FATAL(ss_type==LKM_SEG_SS_PP_TYPE, "Current version do not support shadow stack++!\n");
@@ -141,33 +220,89 @@ public:
 		_gs_base = gs_base;
 		parse_proc_maps(protected_pid);//has already create shadow stack
 		init_all_cc();
+		update_range_index();
+		init_all_hot_rbbus();
 		_has_init = true;
 	}
-	static BOOL is_code_variant_ready(BOOL is_first_cc)
+	static BOOL is_code_variant_ready(UINT32 cv_id)
 	{
-		return is_first_cc ? _is_cv1_ready : _is_cv2_ready;
+		return _is_cv_ready[cv_id];
 	}
-	static void wait_for_code_variant_ready(BOOL is_first_cc);
+	static void wait_for_code_variant_ready(UINT32 cv_id);
+	//wait until the generator is idle, so the code caches of all code variants can be patched safely
+	static void wait_for_all_code_variants_ready();
 	static void check_double_cv();
-	static void consume_cv(BOOL is_first_cc);
-	static void clear_all_cv(BOOL is_first_cc);
+	/*  @Arguments: cv_id is the code variant switched out
+		@Return: None
+		@Introduction: clear the code variant and wake up the generator to regenerate it, the other
+			code variants of the ring are kept ready, so the following switches do not wait
+	*/
+	static void consume_cv(UINT32 cv_id);
+	static void clear_all_cv(UINT32 cv_id);
 	static void store_into_db(std::string db_path);	
+	void store_into_db_path(std::string db_path);
+	SIZE get_rbbl_num() const {return _postion_fixed_rbbls.size() + _movable_rbbls.size();}
+	std::string get_elf_path() const {return _elf_real_path;}
+	UINT64 get_db_load_time() const {return _db_load_time;}
+	void add_gen_time(UINT64 time_ns) {__sync_fetch_and_add(&_gen_time, time_ns);}
+	SIZE get_cc_layout_size(UINT32 cv_id) const {return _cvs[cv_id].cc_layout.size();}
+	SIZE get_reduced_jmp_num(UINT32 cv_id) const {return _cvs[cv_id].reduced_jmp_num;}
+	SIZE get_relaxed_br_num(UINT32 cv_id) const {return _cvs[cv_id].relaxed_br_num;}
+	SIZE get_tail_br_num(UINT32 cv_id) const {return _cvs[cv_id].tail_br_num;}
+	SIZE get_relaxed_bytes(UINT32 cv_id) const {return _cvs[cv_id].relaxed_bytes;}
+	//clean the code cache and arrange the layout of the code variant, rbbls and trampolines are not relocated
+	void arrange_code_variant(UINT32 cv_id);
+	/*  @Arguments: [start_idx, end_idx) is the ranges of the arranged cc layout
+		@Return: None
+		@Introduction: relocate the ranges, ranges are independent after arranging, so the chunks of one layout
+			can be relocated concurrently
+	*/
+	void relocate_code_variant(UINT32 cv_id, SIZE start_idx, SIZE end_idx);
 	static void handle_dlopen(P_ADDRX orig_x_base, P_ADDRX orig_x_end, P_SIZE cc_size, std::string db_path, LKM_SS_TYPE ss_type, \
 		std::string lib_name, std::string shm_path);
 	static void handle_dlclose(std::string lib_name, std::string shm_path);
 	static void free_a_cvm(std::string name, std::string shm_path);
 	static P_ADDRX handle_sigaction(P_ADDRX orig_sighandler_addr, P_ADDRX orig_sigreturn_addr, P_ADDRX old_pc);	
+	//merge the fixed and movable rbbls into _rbbls in offset order
+	void init_sorted_rbbls();
 	void init_rbbl_unit();
+	/*  @Arguments: rbbu_sizes[rbbu_num] are the rbbl numbers of all rbbus in the order of rbbl offset
+		@Return: None
+		@Introduction: rebuild _rbbus from the rbbu partition computed at analysis time
+	*/
+	void init_rbbl_unit(const UINT32 *rbbu_sizes, SIZE rbbu_num);
+	/*  @Arguments: None
+		@Return: None
+		@Introduction: assign dense slots to all rbbls and resolve the relocation targets into slots,
+			so generating a code variant only records and reads the cc address of slots
+	*/
+	void init_rbbl_slots();
+	RBBL_SLOT get_invalid_slot() const {return (RBBL_SLOT)_slot_offsets.size();}
+	RBBL_SLOT get_slot_from_offset(F_SIZE offset) const
+	{
+		std::vector<F_SIZE>::const_iterator iter = std::lower_bound(_slot_offsets.begin(), _slot_offsets.end(), offset);
+		return (iter!=_slot_offsets.end() && *iter==offset) ? (RBBL_SLOT)(iter - _slot_offsets.begin()) : get_invalid_slot();
+	}
 	//insert functions
+	//rbbls can be inserted in any order, they are sorted by init_rbbl_unit
 	void insert_fixed_random_bbl(F_SIZE bbl_offset, RandomBBL *rand_bbl)
 	{
-		_postion_fixed_rbbl_maps.insert(std::make_pair(bbl_offset, rand_bbl));
-		
+		_postion_fixed_rbbls.push_back(std::make_pair(bbl_offset, rand_bbl));
 	}
 	void insert_movable_random_bbl(F_SIZE bbl_offset, RandomBBL *rand_bbl)
 	{
-		_movable_rbbl_maps.insert(std::make_pair(bbl_offset, rand_bbl));
-		
+		_movable_rbbls.push_back(std::make_pair(bbl_offset, rand_bbl));
+	}
+	void reserve_random_bbls(SIZE rbbl_num, BOOL is_movable)
+	{
+		if(is_movable)
+			_movable_rbbls.reserve(_movable_rbbls.size() + rbbl_num);
+		else
+			_postion_fixed_rbbls.reserve(_postion_fixed_rbbls.size() + rbbl_num);
+	}
+	void insert_rbbl_views(RandomBBL *views, SIZE view_num)
+	{
+		_db_rbbl_views.push_back(std::make_pair(views, view_num));
 	}
 	void insert_switch_case_jmpin_rbbl(F_SIZE src_bbl_offset, F_SIZE target_bbl_offset)
 	{
@@ -192,21 +327,45 @@ public:
 	{
 		_ss_type = ss_type;
 	}
-	static void create_ss(P_SIZE ss_size, std::string ss_shm_path);
+	static void create_ss(P_SIZE ss_size, std::string ss_shm_path, P_ADDRX ss_load_end);
 	static void free_ss(P_SIZE ss_size, std::string ss_shm_path);
-protected:	
 	void read_db_files(std::string db_path, LKM_SS_TYPE ss_type);
-	void patch_sigaction_entry(BOOL is_first_cc, P_ADDRX handler_paddrx, P_ADDRX sigreturn_paddrx);
-	static void patch_all_sigaction_entry(BOOL is_first_cc);
+protected:	
+	void load_db_file(std::string cvm_db_path, LKM_SS_TYPE ss_type, std::string elf_id);
+	static void store_db_file(CodeVariantManager *cvm, std::string cvm_db_path, std::string elf_id);
+	void patch_sigaction_entry(UINT32 cv_id, P_ADDRX handler_paddrx, P_ADDRX sigreturn_paddrx);
+	static void patch_all_sigaction_entry(UINT32 cv_id);
 	static void add_cvm(CodeVariantManager *cvm)
 	{
 		_all_cvm_maps.insert(std::make_pair(cvm->get_name(), cvm));
 	}
 	static void pause_gen_code_variants();
 	static void continue_gen_code_variants();
+	/*  @Arguments: None
+		@Return: None
+		@Introduction: rebuild the address indexes after the load information of cvms is changed, so each
+			find_*_from_all lookup finds the cvm by one binary search instead of probing all cvms
+	*/
+	static void update_range_index();
+	static void init_all_hot_rbbus();
+	/*  @Arguments: None
+		@Return: None
+		@Introduction: rbbus are ranked by the samples in them, the top rbbus covering Options::_hot_coverage percent
+			of the samples are hot, and the expected entropy of the layout is reported
+	*/
+	void init_hot_rbbus();
+	S_ADDRX *random_hot_and_cold_rbbus(SIZE array_num);
+	//return the cvm whose range covers the addr, NULL if no cvm covers it
+	static CodeVariantManager *find_cvm_from_index(const CVM_RANGE_INDEX &index, S_ADDRX addr);
 	//set functions
 	static void parse_proc_maps(PID protected_pid);
-	static void generate_all_code_variant(BOOL is_first_cc);
+	static void generate_all_code_variant(UINT32 cv_id);
+	/*  @Arguments: cvms are the modules to generate the code variant
+		@Return: None
+		@Introduction: arrange the layout of each module by one worker, and then relocate the chunks of all layouts
+			by the worker pool, large modules are relocated by multiple workers
+	*/
+	static void generate_code_variants(std::vector<CodeVariantManager*> cvms, UINT32 cv_id);
 	static void *generate_code_variant_concurrently(void *arg);
 	static BOOL sighandler_is_registered(P_ADDRX orig_sighandler_addr, P_ADDRX orig_sigreturn_addr)
 	{
@@ -217,19 +376,45 @@ protected:
 		}else
 			return false;
 	}
-	void clear_cv(BOOL is_first_cc);
-	void clear_sighandler(BOOL is_first_cc);
-	P_ADDRX get_new_pc_from_old(P_ADDRX old_pc, BOOL first_cc_is_new);
-	P_ADDRX find_cc_paddrx_from_rbbl(RandomBBL *rbbl, BOOL is_first_cc);
-	P_ADDRX find_cc_paddrx_from_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc);
-	S_ADDRX find_cc_saddrx_from_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc);
-	RandomBBL *find_rbbl_from_paddrx(P_ADDRX p_addr, BOOL is_first_cc);
-	RandomBBL *find_rbbl_from_saddrx(S_ADDRX s_addr, BOOL is_first_cc);
-	S_ADDRX arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_layout, RBBL_CC_MAPS &rbbl_maps, JMPIN_CC_OFFSET &jmpin_rbbl_offsets);
-	void generate_code_variant(BOOL is_first_cc);	
-	static void *thread_gen_code_variant(void *arg);
-	void clean_cc(BOOL is_first_cc);
-	void relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, S_ADDRX cc_base, RBBL_CC_MAPS &rbbl_maps, JMPIN_CC_OFFSET &jmpin_rbbl_offsets);
+	//return the first code variant which is not ready, Options::_cv_num means all are ready
+	static UINT32 get_unready_cv();
+	static UINT32 get_prev_cv(UINT32 cv_id);
+	static UINT32 get_next_cv(UINT32 cv_id);
+	//build the pc translation of all cvms, both code variants must be ready and not consumed during building
+	static void build_all_pc_translation(UINT32 old_cv_id, UINT32 new_cv_id);
+	void build_pc_translation(UINT32 old_cv_id, UINT32 new_cv_id);
+	//return 0 if there is no translation or the pc is not in any rbbl of the old code variant
+	P_ADDRX translate_pc(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id);
+	void clear_cv(UINT32 cv_id);
+	void clear_sighandler(UINT32 cv_id);
+	P_ADDRX get_new_pc_from_old(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id);
+	P_ADDRX find_cc_paddrx_from_rbbl(RandomBBL *rbbl, UINT32 cv_id);
+	P_ADDRX find_cc_paddrx_from_orig(P_ADDRX orig_p_addrx, UINT32 cv_id);
+	S_ADDRX find_cc_saddrx_from_orig(P_ADDRX orig_p_addrx, UINT32 cv_id);
+	RandomBBL *find_rbbl_from_paddrx(P_ADDRX p_addr, UINT32 cv_id);
+	RandomBBL *find_rbbl_from_saddrx(S_ADDRX s_addr, UINT32 cv_id);
+	S_ADDRX arrange_cc_layout(CODE_VARIANT &cv);
+	//placement of one rbbl of the arranged array, its trailing jmp/jcc rel32 is relaxed into rel8 if the target is near
+	typedef struct{
+		S_SIZE place_size;
+		SIZE padding_num;
+		INT32 tail_idx;//relocation index of the relaxable trailing branch, -1 if not exist
+		SIZE relaxed_size;
+		BOOL is_relaxed;
+	}RBBL_PLACEMENT;
+	void set_rbbl_addr(RBBL_CC_ADDRS &rbbl_addrs, RandomBBL *rbbl, S_ADDRX rbbl_addr);
+	/*  @Arguments: placements[rbbl_array_size] are the placements of rbbl_array, which are placed from used_cc_base
+		@Return: the number of relaxed branches
+		@Introduction: relaxing only shortens the distances in the layout, so the relaxed branches are always in the rel8
+			range, the passes are repeated until no more branch can be relaxed
+	*/
+	SIZE relax_tail_branches(S_ADDRX *rbbl_array, SIZE rbbl_array_size, std::vector<RBBL_PLACEMENT> &placements, \
+		S_ADDRX used_cc_base, RBBL_CC_ADDRS &rbbl_addrs);
+	//fill the range used by the consumed code variants with invalid instructions
+	void clean_cc(UINT32 cv_id);
+	//relocate the ranges [start_idx, end_idx) of the cc layout
+	void relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, SIZE start_idx, SIZE end_idx, S_ADDRX cc_base, RBBL_CC_ADDRS &rbbl_addrs, \
+		JMPIN_CC_OFFSET &jmpin_rbbl_offsets);
 	//init cc and ss
 	void init_cc();
 	static void init_all_cc();
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "type.h"
+#include "utility.h"
+
+/****************************DB V2*****************************/
+/* HEADER + SECTION DIRECTORY + 8-byte aligned SECTIONS        */
+/* all offsets and sizes in the header and directory are 64bit */
+/**************************************************************/
+#define DB_MAGIC 0x44325243 //"CR2D"
+#define DB_VERSION 2
+#define DB_ELF_ID_LEN 128
+#define DB_SECTION_ALIGN 8
+//dbs in the shared db cache are read by the applications of all users
+#define DB_FILE_MODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)
+
+//section types keep the segment types of v1 db
+enum DB_SECTION_TYPE{
+	DB_SEC_MOVABLE_RBBL = 0,
+	DB_SEC_FIXED_RBBL,
+	DB_SEC_SWITCH_CASE_JMPIN,
+	DB_SEC_MAIN_JUMP_TABLE,
+	DB_SEC_RBBU,
+	DB_SEC_TYPE_NUM,
+};
+
+class DBFormat
+{
+public:
+	typedef struct{
+		UINT32 magic;
+		UINT32 version;
+		UINT32 ss_type;
+		UINT32 section_num;
+		UINT64 file_size;
+		UINT32 header_crc;//crc of the header (header_crc is 0) and the section directory
+		UINT32 reserved;
+		char elf_id[DB_ELF_ID_LEN];//empty if the db is converted from v1
+	}HEADER;
+	typedef struct{
+		UINT32 type;
+		UINT32 crc;
+		UINT64 offset;
+		UINT64 size;
+		UINT64 entry_num;
+	}SECTION;
+protected:
+	static SIZE get_header_size(UINT32 section_num) {return sizeof(HEADER) + section_num*sizeof(SECTION);}
+	static SIZE convert_v1_section(S_ADDRX v1_start, SIZE v1_size, S_ADDRX &v1_ptr, UINT32 type, std::vector<UINT8> &v2_buf, \
+		UINT64 &entry_num);
+public:
+	static UINT32 crc32(const void *data, SIZE len, UINT32 crc = 0);
+	/*  @Arguments:
+			1. db_start is the start of the db buffer, which should be large enough
+			2. ss_type and elf_id identify the module and its shadow stack type
+			3. section_num is the number of the sections in the directory
+		@Return: the start of the first section
+		@Introduction: initialize the header and the empty section directory
+	*/
+	static S_ADDRX init_db(S_ADDRX db_start, UINT32 ss_type, const std::string &elf_id, UINT32 section_num);
+	/*  @Arguments:
+			1. db_start is the db initialized by init_db
+			2. sec_idx is the index in the directory
+			3. sec_start and sec_size describe the stored section, entry_num is the number of its entries
+		@Return: the (aligned) start of the next section
+		@Introduction: record the section in the directory and calculate its crc
+	*/
+	static S_ADDRX add_section(S_ADDRX db_start, UINT32 sec_idx, UINT32 type, S_ADDRX sec_start, SIZE sec_size, UINT64 entry_num);
+	/*  @Arguments: db_start is the db initialized by init_db, db_end is the end of the last section
+		@Return: the size of the db
+		@Introduction: seal the header with the file size and the header crc
+	*/
+	static SIZE finish_db(S_ADDRX db_start, S_ADDRX db_end);
+	/*  @Arguments:
+			1. db_start and db_size describe the mapped db file
+			2. ss_type and elf_id are used to reject the stale db, empty elf_id skips the checking
+			3. need_section_crc represents checking the crcs of sections, which touches every page of the db
+		@Return: NULL if the db is legal, otherwise the reason
+		@Introduction: check the header, directory and the crcs of all sections
+	*/
+	static const char *check_db(S_ADDRX db_start, SIZE db_size, UINT32 ss_type, const std::string &elf_id, \
+		BOOL need_section_crc = true);
+	/*  @Arguments: 
+			1. db_path is the db file
+			2. need_trusted represents rejecting the db which is not trusted (see is_trusted_db), used for db cache entries
+		@Return: true if the header matches the ss_type and elf_id
+		@Introduction: only read the header, so that stale dbs can be rejected cheaply
+	*/
+	static BOOL check_db_header(const std::string &db_path, UINT32 ss_type, const std::string &elf_id, \
+		BOOL need_trusted = false);
+	/*  @Arguments: statbuf is the fstat result of the opened db
+		@Return: true if the db is a regular file owned by root or the euid, and is not writable by group or others
+		@Introduction: templates of the db are copied into the code caches of the protected process, so the db cache
+			entries written by other users are rejected
+	*/
+	static BOOL is_trusted_db(const struct stat &statbuf);
+	static const SECTION *get_section(S_ADDRX db_start, UINT32 type);
+	static BOOL is_v1_db(S_ADDRX db_start, SIZE db_size);
+	/*  @Arguments: db_path is the db file written in v1 layout (headerless db_seg_* segments)
+		@Return: true if the db is converted
+		@Introduction: convert the v1 db into v2 db, the new db is renamed atomically into place
+	*/
+	static BOOL convert_v1_db(const std::string &db_path, UINT32 ss_type);
+	/*  @Arguments: db_path is the db file will be replaced, tmp_path is set to the path of the temp file
+		@Return: the fd of the temp file
+		@Introduction: the temp file is created exclusively with a random name in the directory of db_path, so a file
+			or symlink planted in the shared db cache is never truncated, and the temp file can be renamed atomically
+	*/
+	static INT32 create_tmp_db(const std::string &db_path, std::string &tmp_path);
+	static void upgrade_db_files(std::string db_path);
+};
+
+//streaming db writer, sections are buffered and written in large batches, 
+//the header and the section directory are written at the end
+class DBWriter
+{
+public:
+	#define DB_WRITER_BUF_SIZE (4ull<<20)
+protected:
+	INT32 _fd;
+	std::string _path;
+	std::string _tmp_path;//sections are written into the temp file, which is renamed into _path by finish
+	UINT8 *_buf;//page aligned
+	SIZE _buf_used;
+	UINT64 _flushed_size;
+	std::vector<UINT8> _header;//header and section directory
+	UINT32 _sec_idx;
+	UINT64 _sec_start;
+	UINT32 _sec_crc;
+	void flush();
+	UINT64 get_curr_offset() const {return _flushed_size + _buf_used;}
+public:
+	DBWriter(std::string db_path, UINT32 ss_type, const std::string &elf_id, UINT32 section_num);
+	~DBWriter();
+	/*  @Arguments: size is the max size will be stored
+		@Return: the buffer to store the data
+		@Introduction: the buffer is valid until commit is called
+	*/
+	S_ADDRX reserve(SIZE size);
+	void commit(SIZE used_size);
+	void write(const void *data, SIZE size) {memcpy((void*)reserve(size), data, size); commit(size);}
+	void begin_section();
+	void end_section(UINT32 type, UINT64 entry_num);
+	//flush all sections, write the header and rename the temp file into place, return the db size
+	SIZE finish();
+};
+
@@ -7,23 +7,43 @@
 
 class Instruction;
 class Module;
+class ElfParser;
 
 class Disassembler
 {
 private:
-	//disassemble arguments
-	static _CodeInfo _ci;
-	static _DInst _dInst;
-	static _DecodedInst _decodedInst;
+	//disassemble arguments (per thread, modules are disassembled concurrently with -j)
+	static __thread _CodeInfo _ci;
+	static __thread _DInst _dInst;
+	static __thread _DecodedInst _decodedInst;
 protected:
 	/*  @Arguments: Module*
 		@Return: None
 		@Introduction: This function does following three things:
-			1. disassemble x sections in module (should split data and code, now we use objdump)
+			1. disassemble x sections in module (use objdump to split data and code, selected by -d)
 			2. disassemble x sections and record all Instructions
 			3. mapping Addr with Instruction
 	*/
 	static void disassemble_module(Module *module);
+	static void disassemble_elf(ElfParser *elf, void *arg);
+	/*  @Arguments: Module*
+		@Return: None
+		@Introduction: This function does the same things as disassemble_module without objdump:
+			1. linear sweep each x section with distorm_decompose in batch (each instruction is decoded only once)
+			2. skip the 0h aligned padding after ret/jmp/ud2/hlt and the known data regions
+			3. re-disassemble the br targets which are not instruction aligned
+	*/
+	static void linear_sweep_module(Module *module);
+	static void linear_sweep_region(Module *module, F_SIZE region_start, F_SIZE region_end);
+	static void fix_unaligned_br_targets(Module *module);
+	/*  @Arguments: 
+			1. dInst is the decomposed instruction
+			2. module is the instruction's owner
+		@Return: the classified Instruction*
+		@Introduction: This function classifies the decomposed instruction by its flow control type.
+	*/
+	static Instruction *construct_instruction(const _DInst &dInst, const Module *module);
+	static void record_instruction(Module *module, Instruction *instr, BOOL &has_nop_instrs);
 	/*  @Arguments: 
 			1. instr_off represents the offset in the module (instruction's offset in module)
 			2. code represents the instruction encode in Module
@@ -32,6 +52,7 @@ protected:
 	*/
 	static Instruction *disassemble_instruction(const F_SIZE instr_off, const Module *module, \
 		const char *objdump_line_buf = NULL);
+	static BOOL decode_fma4_instruction(const F_SIZE instr_off, const Module *module);
 public:
 	static void init();
 	/*  @Arguments:None
@@ -8,6 +8,7 @@
 
 #include "type.h"
 #include "utility.h"
+#include "atomic.h"
  
 //typdef function
 typedef struct func_info{
@@ -42,8 +43,17 @@ public:
 	typedef std::vector<SECTION_REGION>::const_iterator SECTION_ITERATOR;
 	typedef std::vector<ElfParser*>::const_iterator DEPENDENCE_ELF_ITERATOR;
 	typedef std::map<std::string, ElfParser*>::const_iterator PARSED_ELF_ITERATOR;
+	//dynamic section information used to resolve dependence libraries
+	typedef struct{
+		std::vector<std::string> needed;
+		std::string rpath;
+		std::string runpath;
+		std::string interp;
+	}DYNAMIC_INFO;
 	// static values, mapping table (elf_name ==> ElfParser*)
 	static std::map<std::string, ElfParser*> _all_parsed_elfs;
+	// _all_parsed_elfs may be accessed by the analysis threads (-j)
+	static SpinLock _all_parsed_elfs_lock;
 private:
 	INT32 _elf_fd;
 	std::string _elf_path;
@@ -79,6 +89,8 @@ private:
 	SIZE _pt_d_filesz;
 	// 7.dependence elf
 	std::vector<ElfParser*> _dependence_elfs;
+	// 8.static analysis result is reused from the db cache
+	BOOL _is_db_cached;
 	//legal args
 	static UINT32 _magic;
 	static UINT16 _machine;
@@ -89,10 +101,22 @@ protected:
 	}
 	void map_elf();
 	void parse_dependence_lib();
+	static std::string calculate_elf_id(const UINT8 *map_start, const SIZE map_size);
+	static void read_dynamic_info(const UINT8 *map_start, const char *dynstr_table, DYNAMIC_INFO &info);
+	static void read_dynamic_info(const std::string elf_path, DYNAMIC_INFO &info);
+	static BOOL is_loadable_elf(const std::string elf_path);
+	//empty components of dirs are the current directory only if empty_is_cwd is set (LD_LIBRARY_PATH), otherwise they are skipped
+	static std::string search_lib_in_dirs(const std::string lib_name, const std::string dirs, const std::string origin, \
+		BOOL empty_is_cwd = false);
+	static std::string search_lib_in_ld_so_cache(const std::string lib_name);
+	static std::string search_lib(const std::string lib_name, const DYNAMIC_INFO &requester, const std::string requester_path, \
+		const DYNAMIC_INFO &main_elf, const std::string main_path);
+	static void resolve_dependence_libs(const std::string elf_path, const DYNAMIC_INFO &main_info, std::vector<std::string> &lib_paths);
 	static void add_elf_parser(ElfParser *elf)
 	{
-		if(!is_parsed(elf->get_elf_name()))
-			_all_parsed_elfs.insert(make_pair(elf->get_elf_name(), elf));
+		_all_parsed_elfs_lock.lock();
+		_all_parsed_elfs.insert(make_pair(elf->get_elf_name(), elf));
+		_all_parsed_elfs_lock.unlock();
 	}
 	void find_function_from_sym_table(const Elf64_Sym *sym_table, const INT32 sym_num,\
 		const char *str, SYM_FUNC_INFO_MAP &func_info_map);
@@ -106,11 +130,38 @@ public:
 	}
 	//parse elf
 	static ElfParser *parse_elf(const char *elf_path);
+	/*  @Arguments: elf path
+		@Return: the hex string of GNU build-id, or 'h' + the hex string of content hash if there is no build-id
+		@Introduction: elf id is used as the key of the static analysis db cache
+	*/
+	static std::string calculate_elf_id(const std::string elf_path);
+	/*  @Arguments: elf path and the vector to store the dependence libraries
+		@Return: None
+		@Introduction: resolve all dependence libraries like ldd (without running the dynamic loader):
+			1. read DT_NEEDED/DT_RPATH/DT_RUNPATH from the dynamic section and PT_INTERP
+			2. search each needed library in DT_RPATH, LD_LIBRARY_PATH, DT_RUNPATH, /etc/ld.so.cache and default dirs
+			3. recursively resolve the needed libraries of the found libraries
+	*/
+	static void resolve_dependence_libs(const std::string elf_path, std::vector<std::string> &lib_paths);
+	std::string get_elf_id() const
+	{
+		return calculate_elf_id((const UINT8*)_map_start, _elf_size);
+	}
+	void set_db_cached()
+	{
+		_is_db_cached = true;
+	}
+	BOOL is_db_cached() const
+	{
+		return _is_db_cached;
+	}
 	//judge functions
 	static BOOL is_parsed(const std::string elf_path)
 	{
-		PARSED_ELF_ITERATOR it = _all_parsed_elfs.find(get_name(elf_path));
-		return it!=_all_parsed_elfs.end();
+		_all_parsed_elfs_lock.lock();
+		BOOL parsed = _all_parsed_elfs.find(get_name(elf_path))!=_all_parsed_elfs.end();
+		_all_parsed_elfs_lock.unlock();
+		return parsed;
 	}
 	BOOL is_shared_object() const
 	{
@@ -160,15 +211,25 @@ public:
 		region_start = _x_sections[idx].start + _map_start;
 		region_end   = _x_sections[idx].end + _map_start;
 	}
+	void get_x_region_off(const UINT32 idx, F_SIZE &region_start, F_SIZE &region_end) const
+	{
+		ASSERTM(idx<(UINT32)_x_sections.size(), \
+			"Executable section num (%d) is overflow (%d)!\n", idx, (INT32)_x_sections.size());
+		region_start = _x_sections[idx].start;
+		region_end   = _x_sections[idx].end;
+	}
 	static std::string get_name(const std::string &path)
 	{
 		return path.substr(path.find_last_of('/') + 1);
 	}
 	static ElfParser* get_elf_parser(const std::string elf_path)
 	{
-		ASSERTM(is_parsed(elf_path), "%s is not parsed!\n", elf_path.c_str());
+		_all_parsed_elfs_lock.lock();
 		PARSED_ELF_ITERATOR it = _all_parsed_elfs.find(get_name(elf_path));
-		return it->second;
+		ASSERTM(it!=_all_parsed_elfs.end(), "%s is not parsed!\n", elf_path.c_str());
+		ElfParser *elf = it->second;
+		_all_parsed_elfs_lock.unlock();
+		return elf;
 	}
 	P_ADDRX get_pt_load_base() const
 	{//x load base is elf load base
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "type.h"
+#include "utility.h"
+
+//log-linear buckets like HdrHistogram: values lower than 128 are counted exactly, the others are counted
+//with 64 sub-buckets for each power of two, so the relative error of the reported values is lower than 1/64
+#define HIST_SUB_BUCKET_BITS 7
+#define HIST_SUB_BUCKET_NUM (1<<HIST_SUB_BUCKET_BITS)
+#define HIST_HALF_SUB_BUCKET_NUM (HIST_SUB_BUCKET_NUM>>1)
+#define HIST_MAX_EXP 40
+#define HIST_BUCKET_NUM (HIST_SUB_BUCKET_NUM + HIST_MAX_EXP*HIST_HALF_SUB_BUCKET_NUM)
+
+class LatencyHistogram
+{
+protected:
+	UINT64 _counts[HIST_BUCKET_NUM];
+	UINT64 _total_count;
+	UINT64 _min;
+	UINT64 _max;
+	UINT64 _sum;
+	static UINT32 get_bucket_idx(UINT64 value);
+	static UINT64 get_bucket_high(UINT32 idx);
+public:
+	LatencyHistogram();
+	void record(UINT64 value);
+	UINT64 get_count() const {return _total_count;}
+	//return the highest value equivalent to the value at the percentile (HdrHistogram semantics)
+	UINT64 get_percentile(double percentile) const;
+	//dump one json object, buckets are [highest equivalent value, count] pairs of the non-empty buckets
+	void dump(FILE *fp, const char *name, const char *unit = "ns") const;
+};
+
+//timing of the rerandomization path and the code variant generation of the shuffle process,
+//the histograms are dumped into the latency log on SIGUSR1 and at exit
+class LatencyStats
+{
+public:
+	typedef enum{
+		STOP_TOTAL = 0,//from receiving the switch request to sending the code variant ready message
+		WAIT_CV,
+		TRANSLATE_PC,
+		PATCH_SS,
+		PATCH_PC,
+		GEN_CV,//generate one code variant of all modules
+		PHASE_NUM,
+	}PHASE;
+	typedef std::map<std::string, LatencyHistogram*> MODULE_HISTOGRAMS;
+	//layout counters of one code variant of all modules, each one is recorded into a histogram per code variant
+	typedef enum{
+		LAYOUT_RBBL_NUM = 0,
+		LAYOUT_REDUCED_JMP_NUM,//jmps eliminated by fall-through rbbls
+		LAYOUT_RELAXED_BR_NUM,//trailing branches relaxed into rel8
+		LAYOUT_TAIL_BR_NUM,//trailing branches which could be relaxed
+		LAYOUT_RELAXED_BYTES,//bytes compacted by the relaxed branches
+		LAYOUT_COUNTER_NUM,
+	}LAYOUT_COUNTER;
+protected:
+	static BOOL _is_enabled;
+	static std::string _log_path;
+	static LatencyHistogram _phases[PHASE_NUM];
+	static MODULE_HISTOGRAMS _modules;
+	static LatencyHistogram _layouts[LAYOUT_COUNTER_NUM];
+	static pthread_mutex_t _mutex;
+	static pthread_t _dump_thread;
+	static const char *_phase_names[PHASE_NUM];
+	static const char *_layout_names[LAYOUT_COUNTER_NUM];
+	static void *wait_for_dump_signal(void *arg);
+public:
+	/*  @Arguments: log_path is the latency log
+		@Return: None
+		@Introduction: SIGUSR1 is blocked in the calling thread and the threads created later, so it must be called
+			before creating the worker pool and the generator, a dump thread waits for SIGUSR1 to dump the histograms
+	*/
+	static void init(std::string log_path);
+	static BOOL is_enabled() {return _is_enabled;}
+	static UINT64 get_time_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (UINT64)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+	}
+	//nothing is recorded if the latency log is disabled
+	static void record(PHASE phase, UINT64 start_ns, UINT64 end_ns);
+	//record the generation time of one module, which is the sum of its arranging and relocation tasks
+	static void record_module(const std::string &module_name, UINT64 time_ns);
+	//record the layout counters of one code variant of all modules
+	static void record_layout(const UINT64 counters[LAYOUT_COUNTER_NUM]);
+	//overwrite the latency log with all histograms
+	static void dump();
+	static void destroy();
+};
+
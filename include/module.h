@@ -6,6 +6,7 @@
 #include <list>
 
 #include "type.h"
+#include "atomic.h"
 #include "elf-parser.h"
 #include "relocation.h"
 
@@ -81,6 +82,7 @@ protected:
 	BBL_MAP _bbl_maps;//all basic blocks
 	BR_TARGETS _br_targets;// direct jump/call, conditional branch and recoginized jump table 
 	static MODULE_MAP _all_module_maps;
+	static SpinLock _all_module_maps_lock;
 	//call target
 	CALL_TARGETS _call_targets;
 	//aligned entry
@@ -126,6 +128,12 @@ protected:
 	void separate_movable_bbls();
 	void recursive_to_find_movable_bbls(BasicBlock *bbl);
 	BasicBlock *construct_bbl(const INSTR_MAP &instr_maps, BOOL is_call_proceeded, BOOL is_call_setjmp_proceeded);
+	//analysis modules concurrently (-j), the largest module is handled first
+	static void get_all_modules_sorted_by_size(std::vector<Module*> &modules);
+	static void split_module_into_bbls(Module *module, void *arg);
+	static void analysis_module_indirect_jump_targets(Module *module, void *arg);
+	static void separate_movable_bbls_from_module(Module *module, void *arg);
+	static void generate_module_relocation_block(Module *module, void *arg);
 public:
 	Module(ElfParser *elf);
 	~Module();
@@ -154,6 +162,7 @@ public:
 	std::string  get_sym_func_name(F_SIZE offset) const;
 	P_ADDRX      get_pt_load_base() const {return _elf->get_pt_load_base();}
 	P_ADDRX      get_pt_x_load_base() const {return _elf->get_pt_x_load_base();}
+	SIZE         get_x_size() const {return _elf->get_pt_x_size();}
 	F_SIZE       convert_pt_addr_to_offset(const P_ADDRX addr) const {return _elf->convert_pt_addr_to_offset(addr);}
  	UINT8       *get_code_offset_ptr(const F_SIZE off) const {return _elf->get_code_offset_ptr(off);}
 	Instruction *get_instr_by_off(const F_SIZE off) const;
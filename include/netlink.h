@@ -7,6 +7,11 @@
 #include "type.h"
 
 #define MAX_STOP_NUM 20
+//code caches of each module are mapped from a ring of MAX_CV_NUM code variants (same as lkm-config.h)
+#define MAX_CV_NUM 8
+//code variant cv_id is placed at the shm file offset congruent with cc_start modulo the huge page size (same as lkm-config.h)
+#define CC_SHM_OFFSET(cc_start, cc_size, cv_id) ( X86_HUGE_PAGE_OFFSET(cc_start) + (cv_id)*X86_HUGE_PAGE_ALIGN_CEIL(cc_size) )
+#define CC_SHM_SIZE(cc_size) ( X86_HUGE_PAGE_SIZE + MAX_CV_NUM*X86_HUGE_PAGE_ALIGN_CEIL(cc_size) )
 
 enum LKM_SS_TYPE{
 	LKM_OFFSET_SS_TYPE = 0,
@@ -34,17 +39,18 @@ typedef struct{
 	LKM_SS_TYPE lkm_ss_type;
 	char app_name[256];
 	char mesg[256];
+	//stack pointers of the current and stopped processes/threads, only used by rerandomization
+	long curr_sp;
+	long additional_sps[MAX_STOP_NUM];
 }MESG_BAG;
 
 #define DISCONNECT            0 //send by shuffle process
-#define CONNECT               1 //send by shuffle process
-#define CV1_IS_READY          2 //send by shuffle process
-#define CV2_IS_READY          3 //send by shuffle process
+#define CONNECT               1 //send by shuffle process, cc_offset is the number of code variants, ss_offset is the -H flag
+#define CV_IS_READY           2 //send by shuffle process, cc_offset is the id of the ready code variant
 #define SIGACTION_HANDLED     4 //send by shuffle process
 #define SS_HANDLED            5 //send by shuffle process
 #define DLOPERATION_HANDLED   6 //send by shuffle process
-#define CURR_IS_CV2_NEED_CV1  7 //send by kernel module
-#define CURR_IS_CV1_NEED_CV2  8 //send by kernel module
+#define CURR_CV_NEED_NEXT_CV  7 //send by kernel module, cc_offset/ss_offset are the ids of the current/next code variants
 #define P_PROCESS_IS_IN       9 //send by kernel module
 #define P_PROCESS_IS_OUT      10//send by kernel module
 #define SIGACTION_DETECTED    11//send by kernel module
@@ -64,9 +70,9 @@ protected:
 	static int sock_fd;
 	static struct msghdr msg;
 public:
-	static void connect_with_lkm(std::string elf_path);
+	static void connect_with_lkm(std::string elf_path, UINT32 cv_num, BOOL use_huge_page);
 	static void send_mesg(MESG_BAG mesg);
-	static void send_cv_ready_mesg(int protected_pid, BOOL is_cv1, long new_pc, long additional_ips[MAX_STOP_NUM], std::string elf_path);
+	static void send_cv_ready_mesg(int protected_pid, UINT32 cv_id, long new_pc, long additional_ips[MAX_STOP_NUM], std::string elf_path);
 	static MESG_BAG recv_mesg();
 	static void send_sigaction_handled_mesg(int protected_pid, long new_pc, std::string elf_path);
 	static void send_ss_handled_mesg(int protected_pid, long new_pc, std::string elf_path);
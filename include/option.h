@@ -11,14 +11,31 @@ public:
 	static BOOL _has_elf_path;
 	static BOOL _has_input_db_file;
 	static BOOL _has_output_db_file;
+	static BOOL _has_db_cache;
 	static BOOL _need_randomize_rbbl;
 	static BOOL _need_randomize_rbbu;
+	static BOOL _use_objdump;
+	static BOOL _use_mapped_db;
+	static BOOL _need_upgrade_db;
+	static BOOL _has_latency_log;
+	static BOOL _has_fixed_seed;
+	static BOOL _has_exec_profile;
+	static BOOL _use_huge_page;
 	static INT64 _rbbu_range;
 	static INT64 _rbbu_padding;
+	static INT64 _analysis_thread_num;
+	static INT64 _worker_num;
+	static INT64 _cv_num;
+	static INT64 _fixed_seed;
+	static INT64 _hot_coverage;
 	static std::string _check_file;
 	static std::string _elf_path;
 	static std::string _input_db_file_path;
 	static std::string _output_db_file_path;
+	static std::string _db_cache_path;
+	static std::string _upgrade_db_path;
+	static std::string _latency_log_path;
+	static std::string _exec_profile_path;
 	static void check(char *cr2);
 	static void parse(int argc, char** argv);
 	static void show_system();
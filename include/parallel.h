@@ -0,0 +1,54 @@
+#pragma once
+
+#include <pthread.h>
+#include <vector>
+
+#include "type.h"
+#include "utility.h"
+
+template <typename T>
+class ParallelHandler
+{
+public:
+	typedef void (*HANDLER)(T item, void *arg);
+protected:
+	const std::vector<T> &_items;
+	HANDLER _handler;
+	void *_arg;
+	volatile UINT32 _next_idx;
+	static void *thread_handle_items(void *arg)
+	{
+		ParallelHandler<T> *ph = (ParallelHandler<T> *)arg;
+		UINT32 idx;
+		while((idx = __sync_fetch_and_add(&ph->_next_idx, 1))<(UINT32)ph->_items.size())
+			ph->_handler(ph->_items[idx], ph->_arg);
+		return NULL;
+	}
+public:
+	ParallelHandler(const std::vector<T> &items, HANDLER handler, void *arg = NULL)
+		: _items(items), _handler(handler), _arg(arg), _next_idx(0){;}
+	/*  @Arguments: thread_num is the max number of threads used to handle the items
+		@Return: None
+		@Introduction: Each thread fetches the next unhandled item by an atomic index, so the items
+			should be sorted from the most expensive one. If thread_num<=1, handle the items in order
+			in the calling thread.
+	*/
+	void run(INT32 thread_num)
+	{
+		if(thread_num>(INT32)_items.size())
+			thread_num = _items.size();
+		if(thread_num<=1){
+			thread_handle_items((void*)this);
+			return ;
+		}
+		pthread_t *threads = new pthread_t[thread_num];
+		for(INT32 idx = 0; idx<thread_num; idx++){
+			INT32 ret = pthread_create(&threads[idx], NULL, thread_handle_items, (void*)this);
+			FATAL(ret!=0, "pthread_create failed!\n");
+		}
+		for(INT32 idx = 0; idx<thread_num; idx++)
+			pthread_join(threads[idx], NULL);
+		delete []threads;
+	}
+};
+
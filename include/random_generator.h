@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+#include "type.h"
+#include "utility.h"
+
+//xoshiro256** generator of each thread, it is seeded from getrandom at the first draw of the thread,
+//so the concurrent generators never share a state or a lock
+class RandomGenerator
+{
+protected:
+	static __thread UINT64 _state[4];
+	static __thread BOOL _has_seeded;
+	static UINT64 splitmix64(UINT64 &x);
+	static UINT64 rotl(UINT64 x, INT32 k) {return (x<<k) | (x>>(64 - k));}
+	static void seed_from_os();
+public:
+	/*  @Arguments: seed and stream are mixed into the state of the calling thread
+		@Return: None
+		@Introduction: reseed the generator of the calling thread, used for the fixed seed of reproducible benchmarking
+	*/
+	static void seed(UINT64 seed, UINT64 stream);
+	static UINT64 next();
+	//unbiased draw in [0, bound) by Lemire's multiply-and-reject method, bound must not be 0
+	static UINT64 next_bounded(UINT64 bound);
+	//Fisher-Yates shuffle, each permutation of the array has the same probability
+	template <typename T>
+	static void shuffle(T *array, SIZE array_num)
+	{
+		for(SIZE idx = array_num; idx>1; idx--){
+			SIZE swap_idx = (SIZE)next_bounded(idx);
+			T temp = array[swap_idx];
+			array[swap_idx] = array[idx-1];
+			array[idx-1] = temp;
+		}
+	}
+	//FNV-1a hash, used to derive the stream of each module from its name
+	static UINT64 hash_string(const std::string &str);
+};
@@ -74,7 +74,10 @@ typedef std::vector<INSTR_RELA> INSTR_RELA_VEC;
 typedef std::vector<INSTR_RELA>::iterator INSTR_RELA_VEC_ITER;
 typedef std::vector<BBL_RELA> BBL_RELA_VEC;
 typedef std::vector<BBL_RELA>::iterator BBL_RELA_VEC_ITER;
-typedef std::map<F_SIZE, S_ADDRX> RBBL_CC_MAPS;
+//rbbl slots are the dense indexes of all rbbl starts (and start+1 of the rbbl has lock and repeat prefix) in the order
+//of offset, relocation targets are resolved into slots when loading the db, the last slot is used by unresolved targets
+typedef UINT32 RBBL_SLOT;
+typedef std::vector<S_ADDRX> RBBL_CC_ADDRS;//cc address of each slot in one code variant
 typedef std::map<F_SIZE, P_SIZE> JMPIN_CC_OFFSET;
 
 class RandomBBL
@@ -84,16 +87,44 @@ protected:
 	F_SIZE _origin_bbl_end;
 	BOOL _has_lock_and_repeat_prefix;
 	BOOL _has_fallthrough_bbl;
+	//owned relocations and template, they are empty if the rbbl is a view of the mapped db file
 	BBL_RELA_VEC _reloc_table;
 	std::string _random_template;
+	//all functions use these pointers, which point to the owned storage or the mapped db file
+	const BBL_RELA *_reloc_ptr;
+	SIZE _reloc_num;
+	const UINT8 *_template_ptr;
+	SIZE _template_len;
+	//dense addressing, _reloc_slots[idx] is the target slot of _reloc_ptr[idx] (only used by rbbl targets)
+	RBBL_SLOT _slot;
+	const RBBL_SLOT *_reloc_slots;
+private:
+	//pointers may point to the owned storage, so rbbl can not be copied
+	RandomBBL(const RandomBBL &rbbl);
+	RandomBBL &operator=(const RandomBBL &rbbl);
 public:
 	RandomBBL(F_SIZE origin_start, F_SIZE origin_end, BOOL has_lock_and_repeat_prefix, BOOL has_fallthrough_bbl, \
 		std::vector<BBL_RELA> reloc_info, std::string random_template);
+	//non-owning view, the relocations and template must be alive until the rbbl is destroyed 
+	RandomBBL(F_SIZE origin_start, F_SIZE origin_end, BOOL has_lock_and_repeat_prefix, BOOL has_fallthrough_bbl, \
+		const BBL_RELA *reloc_ptr, SIZE reloc_num, const UINT8 *template_ptr, SIZE template_len);
 	~RandomBBL();
 	BOOL has_lock_and_repeat_prefix() const {return _has_lock_and_repeat_prefix;}
 	BOOL has_fallthrough_bbl() const {return _has_fallthrough_bbl;}
 	F_SIZE get_rbbl_offset() const {return _origin_bbl_start;}
-	SIZE get_template_size()const {return _random_template.length();}
+	SIZE get_template_size()const {return _template_len;}
+	SIZE get_reloc_num() const {return _reloc_num;}
+	RBBL_SLOT get_slot() const {return _slot;}
+	RBBL_SLOT get_prefix_slot() const {return _slot + 1;}
+	/*  @Arguments:
+			1. slot is the slot of this rbbl
+			2. reloc_slots[_reloc_num] is the storage to record the resolved target slots
+			3. slot_offsets[slot_num] are the sorted offsets of all slots
+		@Return: the number of unresolved targets, they are resolved into slot_num (the invalid boundary of code cache)
+		@Introduction: resolve the targets of branch and high32/low32 cc relocations once, so that gen_code
+			finds the target address in O(1)
+	*/
+	SIZE init_slots(RBBL_SLOT slot, RBBL_SLOT *reloc_slots, const F_SIZE *slot_offsets, SIZE slot_num);
 	/* @Args: 
 	 *        cc_base represents the allocate address of code cache
 	 *		  gen_addr represents the BBL's postion in code cache
@@ -101,26 +132,51 @@ public:
 	 *        orig_x_load_base represents the load address of origin x region
 	 *        cc_offset represents the offset between the code cache with origin code region
 	 *        ss_offset represents the offset between the shadow stack with main stack
+	 *        rbbl_addrs represents the cc address of each rbbl slot
 	 */
 	void gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_ADDRX orig_x_load_base, P_SIZE cc_offset, P_SIZE ss_offset, \
-		P_ADDRX gs_base, LKM_SS_TYPE ss_type, RBBL_CC_MAPS &rbbl_maps, P_SIZE jmpin_offset);
+		P_ADDRX gs_base, LKM_SS_TYPE ss_type, const S_ADDRX *rbbl_addrs, P_SIZE jmpin_offset);
 	//This function is used to judge the last br target is fallthrough rbbl or not, if the fallthrough rbbl is follow by current rbbl,
 	//we have the chance to reduce the last jmp rel32 instruction!
 	F_SIZE get_last_br_target() const
 	{
 		#define REL32_LEN 4
-		BBL_RELA_VEC::const_reverse_iterator iter = _reloc_table.rbegin();
-		if(iter!=_reloc_table.rend()){
-			BBL_RELA rela = *iter;
-			if((rela.r_type==BRANCH_RELA_TYPE) && (rela.r_byte_pos==(_random_template.length()-REL32_LEN)) && (rela.r_byte_size==4))
+		if(_reloc_num!=0){
+			BBL_RELA rela = _reloc_ptr[_reloc_num-1];
+			if((rela.r_type==BRANCH_RELA_TYPE) && (rela.r_byte_pos==(_template_len-REL32_LEN)) && (rela.r_byte_size==4))
 				return rela.r_value;
 			else
 				return 0;
 		}else
 			return 0;
 	}
+	/*  @Arguments: 
+			1. has_reduce_jmp represents the last jmp rel32 is reduced
+			2. relaxed_size returns the reduced size if the trailing branch is relaxed into rel8 form
+		@Return: the relocation index of the trailing jmp/jcc rel32 of the generated code, -1 if not exist
+		@Introduction: no instruction of the rbbl follows the trailing branch, so relaxing it does not change the offsets of
+			the other instructions in the rbbl
+	*/
+	INT32 get_tail_branch(BOOL has_reduce_jmp, SIZE &relaxed_size) const;
+	RBBL_SLOT get_reloc_slot(SIZE idx) const {return _reloc_slots[idx];}
 	SIZE store_rbbl(S_ADDRX s_addrx);
-	static RandomBBL *read_rbbl(S_ADDRX r_addrx, SIZE &used_size);
+	//size of the record stored by store_rbbl
+	SIZE get_store_size() const
+	{
+		return 2*sizeof(UINT32) + 2*sizeof(UINT8) + sizeof(UINT16) + _reloc_num*sizeof(BBL_RELA) + sizeof(UINT16) + _template_len;
+	}
+	//r_end is the end of the section, reading a record past it is fatal
+	static RandomBBL *read_rbbl(S_ADDRX r_addrx, S_ADDRX r_end, SIZE &used_size);
+	/*  @Arguments: 
+			1. r_addrx is the rbbl record in the mapped db file
+			2. r_end is the end of the section, the record must not cross it
+			3. view_place is the memory to construct the rbbl view
+			4. used_size returns the record size
+		@Return: the rbbl view constructed in view_place
+		@Introduction: zero-copy reading, the view points to the relocations and template in the mapped db file
+	*/
+	static RandomBBL *read_rbbl_view(S_ADDRX r_addrx, S_ADDRX r_end, void *view_place, SIZE &used_size);
+	static SIZE get_rbbl_record_size(S_ADDRX r_addrx, S_ADDRX r_end);
 	void dump_template(P_ADDRX relocation_base);
 	void dump_relocation();
 };
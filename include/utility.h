@@ -41,8 +41,9 @@
 #define USE_JMPIN_REG_DESTORY_OPT
 #define USE_JMPIN_MEM_INDEX_DESTORY_OPT
 #define USE_MAIN_SWITCH_CASE_COPY_OPT
-#define USE_CLOSE_CLEAN_CC_OPT
+//#define USE_CLOSE_CLEAN_CC_OPT
 #define USE_TRAMP_RECORD_OPT
+#define USE_SHORT_BRANCH_OPT
 
 //bits define
 #define BITS_ARE_SET_ANY(value, bits)	   ( ((value)&(bits)) != 0 )
@@ -63,6 +64,9 @@
 #define X86_PAGE_IS_ALIGN(addr)	( ((addr)&(X86_PAGE_SIZE-1)) == 0 )
 #define X86_PAGE_ALIGN_CEIL(addr)  ( ((addr)+X86_PAGE_SIZE-1) & X86_PAGE_MASK )
 #define X86_PAGE_ALIGN_FLOOR(addr) ( (addr) & X86_PAGE_MASK )
+#define X86_HUGE_PAGE_SIZE (1ul<<21)	 // 2MiB
+#define X86_HUGE_PAGE_OFFSET(addr) ( (addr) & (X86_HUGE_PAGE_SIZE - 1) )
+#define X86_HUGE_PAGE_ALIGN_CEIL(addr)  ( ((addr)+X86_HUGE_PAGE_SIZE-1) & ~(X86_HUGE_PAGE_SIZE - 1) )
 
 //to string define
 #define btoa(x) ((x)?"true":"false")
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <pthread.h>
+#include <vector>
+#include <deque>
+
+#include "type.h"
+#include "utility.h"
+
+//long-lived work-stealing pool of the shuffle process, it is shared by code variant generation,
+//shadow stack patching and dlopen handling, so no thread is created or joined on the rerandomization path
+class WorkerPool
+{
+public:
+	typedef void (*TASK_HANDLER)(void *ctx, SIZE idx);
+	//tasks of the rerandomization path are handled before the queued tasks of code variant generation
+	typedef enum{
+		HIGH_PRIORITY = 0,
+		NORMAL_PRIORITY,
+		PRIORITY_NUM,
+	}PRIORITY;
+	typedef struct{
+		volatile SIZE remaining;
+		pthread_mutex_t mutex;
+		pthread_cond_t done;
+	}BATCH;
+	typedef struct{
+		TASK_HANDLER handler;
+		void *ctx;
+		SIZE idx;
+		BATCH *batch;
+	}TASK;
+	typedef struct{
+		pthread_mutex_t mutex;
+		std::deque<TASK> tasks[PRIORITY_NUM];
+	}WORKER_QUEUE;
+protected:
+	template <typename T>
+	struct ITEMS_CTX{
+		const std::vector<T> *items;
+		void (*handler)(T item, void *arg);
+		void *arg;
+	};
+	template <typename T>
+	static void handle_item(void *ctx, SIZE idx)
+	{
+		ITEMS_CTX<T> *items_ctx = (ITEMS_CTX<T>*)ctx;
+		items_ctx->handler((*items_ctx->items)[idx], items_ctx->arg);
+	}
+	static INT32 _thread_num;
+	static pthread_t *_threads;
+	static WORKER_QUEUE *_queues;
+	static volatile SIZE _queued_num;//number of tasks in all queues
+	static volatile UINT32 _next_queue;
+	static BOOL _need_stop;
+	static pthread_mutex_t _idle_mutex;
+	static pthread_cond_t _idle_cond;
+	static BOOL pop_task(INT32 queue_idx, PRIORITY priority, TASK &task);
+	static BOOL steal_task(INT32 queue_idx, PRIORITY priority, TASK &task);
+	static BOOL get_task(INT32 queue_idx, TASK &task);
+	//take a queued task of the batch, the submitter only helps its own batch
+	static BOOL take_batch_task(BATCH *batch, PRIORITY priority, TASK &task);
+	static void execute_task(TASK &task);
+	static void *worker_loop(void *arg);
+public:
+	/*  @Arguments: thread_num is the number of workers, 0 means the number of online cpus
+		@Return: None
+		@Introduction: create the workers, they sleep until tasks are submitted
+	*/
+	static void init(INT32 thread_num);
+	static void destroy();
+	static INT32 get_thread_num() {return _thread_num;}
+	/*  @Arguments: 
+			1. handler(ctx, idx) is called for each idx in [0, task_num)
+			2. priority is HIGH_PRIORITY for the batches of the rerandomization path
+		@Return: None
+		@Introduction: tasks are dealt round-robin into the queues of workers, idle workers steal the tasks
+			of the others, and the calling thread helps to handle the tasks of this batch until it is finished.
+			If the pool is not initialized, handle the tasks in order in the calling thread.
+	*/
+	static void run_batch(TASK_HANDLER handler, void *ctx, SIZE task_num, PRIORITY priority = NORMAL_PRIORITY);
+	//handle items like ParallelHandler, the items should be sorted from the most expensive one
+	template <typename T>
+	static void run(const std::vector<T> &items, void (*handler)(T item, void *arg), void *arg = NULL, \
+		PRIORITY priority = NORMAL_PRIORITY)
+	{
+		ITEMS_CTX<T> ctx = {&items, handler, arg};
+		run_batch(handle_item<T>, (void*)&ctx, items.size(), priority);
+	}
+};
+
@@ -91,6 +91,13 @@ void free_mem(unsigned long addr, size_t len)
 	}
 }
 
+//only called when the shuffle process runs with -H, and never with app_slot_lock held
+void advise_cc_huge_page(long cc_start, long cc_size)
+{
+	//only the 2MiB aligned parts are backed by huge pages, it fails on kernels without shmem THP
+	orig_madvise(cc_start, cc_size, MADV_HUGEPAGE);
+}
+
 long allocate_cc(long orig_x_size, const char *orig_name)
 {
 	int cc_fd = 0;
@@ -104,12 +111,18 @@ long allocate_cc(long orig_x_size, const char *orig_name)
 	
 	sprintf(shm_path, "/dev/shm/%d-%s.cc", curr_pid, file_name);
 	cc_fd = open_shm_file(shm_path);
-	orig_ftruncate(cc_fd, cc_size*2);
+	orig_ftruncate(cc_fd, CC_SHM_SIZE(cc_size));
 	cc_ret = orig_mmap(0, cc_size, PROT_EXEC|PROT_READ, MAP_SHARED, cc_fd, 0);
+	//the shm offset of the first code variant depends on the placed address, so remap it
+	if(CC_SHM_OFFSET(cc_ret, cc_size, 0)!=0)
+		cc_ret = orig_mmap(cc_ret, cc_size, PROT_EXEC|PROT_READ, MAP_SHARED|MAP_FIXED, cc_fd, CC_SHM_OFFSET(cc_ret, cc_size, 0));
 
 	x_start = cc_ret - CC_OFFSET;
 	app_slot_idx = insert_x_info(current, cc_ret, cc_ret+cc_size, shm_path);
 	close_shm_file(cc_fd);
+	//code caches allocated before the shuffle process is connected are advised by set_shuffle_pid
+	if(app_slot_idx!=-1 && need_huge_page(app_slot_idx))
+		advise_cc_huge_page(cc_ret, cc_size);
 	if(is_app_start(current)){//send message to shuffle process, dlopen(need stop all processes/threads, we only handle one process/thread now)
 		PRINTK("[%d] dlopen: %s\n", current->pid, orig_name);
 		send_dlopen_mesg_to_shuffle_process(current, app_slot_idx, x_start, x_start+orig_x_size, cc_size, orig_name, shm_path);
@@ -131,18 +144,20 @@ long allocate_cc_fixed(long orig_x_start, long orig_x_end, const char *orig_name
 	
 	sprintf(shm_path, "/dev/shm/%d-%s.cc", curr_pid, file_name);
 	cc_fd = open_shm_file(shm_path);
-	orig_ftruncate(cc_fd, cc_size*2);
-	cc_ret = orig_mmap(cc_start, cc_size, PROT_EXEC|PROT_READ, MAP_SHARED|MAP_FIXED, cc_fd, 0);
+	orig_ftruncate(cc_fd, CC_SHM_SIZE(cc_size));
+	cc_ret = orig_mmap(cc_start, cc_size, PROT_EXEC|PROT_READ, MAP_SHARED|MAP_FIXED, cc_fd, CC_SHM_OFFSET(cc_start, cc_size, 0));
 
 	app_slot_idx = insert_x_info(current, cc_ret, cc_ret+cc_size, shm_path);
 	close_shm_file(cc_fd);
+	if(app_slot_idx!=-1 && need_huge_page(app_slot_idx))
+		advise_cc_huge_page(cc_ret, cc_size);
 	if(is_app_start(current)){//send message to shuffle process, dlopen
 		send_dlopen_mesg_to_shuffle_process(current, app_slot_idx, orig_x_start, orig_x_end, cc_size, orig_name, shm_path);
 	}
 	return cc_ret;
 }
 
-extern void send_ss_create_mesg_to_shuffle_process(struct task_struct *ts, char app_slot_idx, int shuffle_pid, long stack_len, char *shm_file);
+extern void send_ss_create_mesg_to_shuffle_process(struct task_struct *ts, char app_slot_idx, int shuffle_pid, long stack_len, long ss_end, char *shm_file);
 
 long allocate_ss_fixed(long orig_stack_start, long orig_stack_end)
 {
@@ -167,7 +182,7 @@ long allocate_ss_fixed(long orig_stack_start, long orig_stack_end)
 	
 	if(is_app_start(current)){//send message to shuffle process, dlopen
 		shuffle_pid = get_shuffle_pid(app_slot_idx);
-		send_ss_create_mesg_to_shuffle_process(current, app_slot_idx, shuffle_pid, ss_size, shm_path);
+		send_ss_create_mesg_to_shuffle_process(current, app_slot_idx, shuffle_pid, ss_size, ss_ret+ss_size, shm_path);
 	}
 	return ss_ret;
 }
@@ -5,6 +5,13 @@
 /***************CR2 args******************/
 #define CC_OFFSET (1ul<<30)
 #define CC_MULTIPULE (8)
+//the shm file of each code cache holds a ring of at most MAX_CV_NUM code variants, tmpfs only allocates the used ones
+#define MAX_CV_NUM (8)
+#define DEFAULT_CV_NUM (2)
+//code variant cv_id is placed at the shm file offset congruent with cc_start modulo the huge page size,
+//so the 2MiB aligned parts of the code cache map 2MiB aligned parts of the shm file and can be backed by huge pages
+#define CC_SHM_OFFSET(cc_start, cc_size, cv_id) ( X86_HUGE_PAGE_OFFSET(cc_start) + (cv_id)*X86_HUGE_PAGE_ALIGN_CEIL(cc_size) )
+#define CC_SHM_SIZE(cc_size) ( X86_HUGE_PAGE_SIZE + MAX_CV_NUM*X86_HUGE_PAGE_ALIGN_CEIL(cc_size) )
 #define SS_OFFSET (1ul<<30)
 #define SS_MULTIPULE (20)
 #define GS_BASE (0x400000) //only used for LKM_SEG_SS_TYPE, it is not suitable to LKM_SEG_SS_PP_TYPE
@@ -17,6 +17,7 @@ typedef asmlinkage long (*CLOSE_FUNC_TYPE)(unsigned int fd);
 typedef asmlinkage long (*EXIT_GROUP_FUNC_TYPE)(ulong error);
 typedef asmlinkage long (*MPROTECT_FUNC_TYPE)(unsigned long start, size_t len, unsigned long prot);
 typedef asmlinkage long (*MUNMAP_FUNC_TYPE)(unsigned long addr, size_t len);
+typedef asmlinkage long (*MADVISE_FUNC_TYPE)(unsigned long start, size_t len, int behavior);
 
 extern MMAP_FUNC_TYPE orig_mmap;
 extern OPEN_FUNC_TYPE orig_open;
@@ -28,6 +29,7 @@ extern CLOSE_FUNC_TYPE orig_close;
 extern EXIT_GROUP_FUNC_TYPE orig_exit_group;
 extern MPROTECT_FUNC_TYPE orig_mprotect;
 extern MUNMAP_FUNC_TYPE orig_munmap;
+extern MADVISE_FUNC_TYPE orig_madvise;
 //
 typedef asmlinkage long (*UMASK_FUNC_TYPE)(int mask);
 extern UMASK_FUNC_TYPE orig_umask;
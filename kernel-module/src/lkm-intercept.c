@@ -429,7 +429,7 @@ asmlinkage long intercept_exit_group(ulong error)
 			shuffle_pid = get_shuffle_pid(app_slot_idx);
 			if(shuffle_pid==0){
 				shuffle_pid = connect_one_shuffle(monitor_idx, app_slot_idx);
-				set_shuffle_pid(app_slot_idx, shuffle_pid);
+				set_shuffle_pid(app_slot_idx, shuffle_pid, get_shuffle_cv_num(monitor_idx, shuffle_pid), get_shuffle_use_huge_page(monitor_idx, shuffle_pid));
 			}
 			return set_program_start(current, start_encode, app_slot_idx);
 		}else{
@@ -529,7 +529,7 @@ asmlinkage long intercept_rt_sigaction(int sig, struct sigaction __user *act, st
 
 		if(shuffle_pid==0 && is_app_start(current)==0){
 			shuffle_pid = connect_one_shuffle(monitor_idx, app_slot_idx);
-			set_shuffle_pid(app_slot_idx, shuffle_pid);
+			set_shuffle_pid(app_slot_idx, shuffle_pid, get_shuffle_cv_num(monitor_idx, shuffle_pid), get_shuffle_use_huge_page(monitor_idx, shuffle_pid));
 		}
 		
 		if(shuffle_pid!=0 && act && act->sa_handler!=SIG_IGN && act->sa_handler!=SIG_DFL && act->sa_handler!=SIG_ERR){
@@ -547,11 +547,12 @@ asmlinkage long intercept_rt_sigaction(int sig, struct sigaction __user *act, st
 	return ret;
 }
 
-void send_ss_create_mesg_to_shuffle_process(struct task_struct *ts, char app_slot_idx, int shuffle_pid, long stack_len, char *shm_file)
+void send_ss_create_mesg_to_shuffle_process(struct task_struct *ts, char app_slot_idx, int shuffle_pid, long stack_len, long ss_end, char *shm_file)
 {
 	struct pt_regs *regs = task_pt_regs(ts);
 	volatile char *start_flag = req_a_start_flag(app_slot_idx, ts->pid);
-	MESG_BAG msg = {CREATE_SS, ts->pid, regs->ip, {0}, stack_len, 0, 0, global_ss_type, "\0", "\0"};
+	//ss_offset is the end of the shadow stack, the shuffle process uses it to find the live frames
+	MESG_BAG msg = {CREATE_SS, ts->pid, regs->ip, {0}, stack_len, ss_end, 0, global_ss_type, "\0", "\0"};
 	strcpy(msg.app_name, ts->comm);
 	strcpy(msg.mesg, shm_file);
 	if(shuffle_pid!=0){
@@ -632,7 +633,7 @@ asmlinkage long intercept_clone(unsigned long clone_flags, unsigned long newsp,
 			vfree(bk_buf);
 			shm_file = get_stack_shm_info(current, &stack_len);
 			//send message to shuffle process
-			send_ss_create_mesg_to_shuffle_process(current, app_slot_idx, shuffle_pid, stack_len, shm_file);
+			send_ss_create_mesg_to_shuffle_process(current, app_slot_idx, shuffle_pid, stack_len, curr_stack_end, shm_file);
 		}		
 		PRINTK("[%d, %d] %s clone %ld\n", current->pid, pid_vnr(task_pgrp(current)), current->comm, ret);			
 	}
@@ -10,6 +10,7 @@
 #include "lkm-hook.h"
 #include "lkm-netlink.h"
 #include "lkm-monitor.h"
+#include "lkm-cc-ss.h"
 
 char* monitor_app_list[MAX_APP_LIST_NUM];
 
@@ -17,6 +18,8 @@ char* monitor_app_list[MAX_APP_LIST_NUM];
 typedef struct{
 	char app_slot_idx;
 	int shuffle_pid;
+	int cv_num;//number of code variants in the ring of the shuffle process
+	int use_huge_page;//the shuffle process runs with -H, code caches are advised to use huge pages
 }S_CONFIG;
 
 S_CONFIG shuffle_config_list[MAX_APP_LIST_NUM][MAX_SHUFFLE_NUM_FOR_ONE_APP];
@@ -37,17 +40,25 @@ void init_shuffle_config_list(void)
 		for(index = 0; index < MAX_SHUFFLE_NUM_FOR_ONE_APP; index++){
 			shuffle_config_list[index_app][index].shuffle_pid = 0;
 			shuffle_config_list[index_app][index].app_slot_idx = -1;
+			shuffle_config_list[index_app][index].cv_num = DEFAULT_CV_NUM;
+			shuffle_config_list[index_app][index].use_huge_page = 0;
 		}
 }
 
-void insert_shuffle_info(char monitor_list_idx, int shuffle_pid)
+void insert_shuffle_info(char monitor_list_idx, int shuffle_pid, int cv_num, int use_huge_page)
 {
 	int index;
+	if(cv_num<DEFAULT_CV_NUM || cv_num>MAX_CV_NUM){
+		PRINTK("shuffle process %d has wrong code variant number %d, use %d\n", shuffle_pid, cv_num, DEFAULT_CV_NUM);
+		cv_num = DEFAULT_CV_NUM;
+	}
 	spin_lock(&shuffle_config_lock);
 	for(index = 0; index < MAX_SHUFFLE_NUM_FOR_ONE_APP; index++){
 		//find a free
 		if(shuffle_config_list[(int)monitor_list_idx][index].shuffle_pid==0){
 			shuffle_config_list[(int)monitor_list_idx][index].shuffle_pid = shuffle_pid;
+			shuffle_config_list[(int)monitor_list_idx][index].cv_num = cv_num;
+			shuffle_config_list[(int)monitor_list_idx][index].use_huge_page = use_huge_page;
 			spin_unlock(&shuffle_config_lock);
 			return ;
 		}
@@ -110,6 +121,34 @@ int has_free_shuffle(char monitor_list_idx, char app_slot_idx)
 	return 0;
 }
 
+int get_shuffle_cv_num(char monitor_list_idx, int shuffle_pid)
+{
+	int index;
+	spin_lock(&shuffle_config_lock);
+	for(index = 0; index < MAX_SHUFFLE_NUM_FOR_ONE_APP; index++){
+		if(shuffle_config_list[(int)monitor_list_idx][index].shuffle_pid==shuffle_pid){
+			spin_unlock(&shuffle_config_lock);
+			return shuffle_config_list[(int)monitor_list_idx][index].cv_num;
+		}
+	}
+	spin_unlock(&shuffle_config_lock);
+	return DEFAULT_CV_NUM;
+}
+
+int get_shuffle_use_huge_page(char monitor_list_idx, int shuffle_pid)
+{
+	int index;
+	spin_lock(&shuffle_config_lock);
+	for(index = 0; index < MAX_SHUFFLE_NUM_FOR_ONE_APP; index++){
+		if(shuffle_config_list[(int)monitor_list_idx][index].shuffle_pid==shuffle_pid){
+			spin_unlock(&shuffle_config_lock);
+			return shuffle_config_list[(int)monitor_list_idx][index].use_huge_page;
+		}
+	}
+	spin_unlock(&shuffle_config_lock);
+	return 0;
+}
+
 char get_app_slot_idx_from_shuffle_config(char monitor_list_idx, int shuffle_pid)
 {
 	int index;
@@ -238,6 +277,8 @@ typedef struct{
 	int process_sum;
 	int ss_number;
 	int cc_id;//current cc used index
+	int cv_num;//code caches are remapped in the ring of cv_num code variants
+	char use_huge_page;//code caches are advised to use huge pages
 	ulong pc;//send by shuffle process
 	//volatile char start_flag;
 	START_FLAG start_flags[MAX_FLAG_NUM];
@@ -373,6 +414,8 @@ char init_app_slot(struct task_struct *ts)
 			app_slot_list[index].ss_number = 0;
 			app_slot_list[index].process_sum = 1;
 			app_slot_list[index].cc_id = 0;
+			app_slot_list[index].cv_num = DEFAULT_CV_NUM;
+			app_slot_list[index].use_huge_page = 0;
 			app_slot_list[index].pc = 0;
 			//app_slot_list[index].start_flag = 0;
 			app_slot_list[index].executed_start = 0;
@@ -621,11 +664,41 @@ char get_app_slot_idx(int pgid)
 	return -1;
 }
 
-void set_shuffle_pid(char app_slot_idx, int shuffle_pid)
+int need_huge_page(char app_slot_idx)
+{
+	int use_huge_page = 0;
+	spin_lock(&app_slot_lock); 
+	use_huge_page = app_slot_list[(int)app_slot_idx].use_huge_page;
+	spin_unlock(&app_slot_lock); 
+	return use_huge_page;
+}
+
+//madvise may sleep, so the code cache ranges are read under app_slot_lock and advised after unlocking it
+void advise_app_slot_huge_page(char app_slot_idx)
+{
+	int internal_index = 0;
+	long cc_start = 0;
+	long cc_end = 0;
+	for(internal_index = 0; internal_index<MAX_X_NUM; internal_index++){
+		spin_lock(&app_slot_lock); 
+		cc_start = app_slot_list[(int)app_slot_idx].xr[internal_index].cc_start;
+		cc_end = app_slot_list[(int)app_slot_idx].xr[internal_index].cc_end;
+		spin_unlock(&app_slot_lock); 
+		if(cc_start!=0)
+			advise_cc_huge_page(cc_start, cc_end-cc_start);
+	}
+}
+
+void set_shuffle_pid(char app_slot_idx, int shuffle_pid, int cv_num, int use_huge_page)
 {
 	spin_lock(&app_slot_lock); 
 	app_slot_list[(int)app_slot_idx].shuffle_pid = shuffle_pid;
+	app_slot_list[(int)app_slot_idx].cv_num = cv_num;
+	app_slot_list[(int)app_slot_idx].use_huge_page = use_huge_page;
 	spin_unlock(&app_slot_lock); 
+	//the code caches of the main program and ld.so are allocated before the shuffle process is connected
+	if(shuffle_pid!=0 && use_huge_page)
+		advise_app_slot_huge_page(app_slot_idx);
 }
 
 void set_shuffle_pc(char app_slot_idx, ulong pc)
@@ -996,31 +1069,59 @@ void free_dead_stack(struct task_struct *ts)
 }
 
 
+//the stopped pids are copied under app_slot_lock, because connect and disconnect may change the app slot
+void get_stopped_pids(char app_slot_idx, int pids[MAX_STOP_NUM])
+{
+	int index;
+	spin_lock(&app_slot_lock); 
+	for(index = 0; index<MAX_STOP_NUM; index++)
+		pids[index] = app_slot_list[(int)app_slot_idx].stopped_pid[index];
+	spin_unlock(&app_slot_lock); 
+}
+
 void init_stopped_ips_from_app_slot(char app_slot_idx, long ips[MAX_STOP_NUM])
 {
 	int index;
+	int pids[MAX_STOP_NUM];
 	struct task_struct *task;
+	get_stopped_pids(app_slot_idx, pids);
+	//find_vpid takes no reference of the struct pid, so the task is only used under rcu_read_lock
+	rcu_read_lock();
 	for(index = 0; index<MAX_STOP_NUM; index++){
-		if(app_slot_list[(int)app_slot_idx].stopped_pid[index]!=0){
-			task = pid_task(find_get_pid(app_slot_list[(int)app_slot_idx].stopped_pid[index]), PIDTYPE_PID);
-			ips[index] = task ? task_pt_regs(task)->ip : 0;
-		}else
-			ips[index] = 0;
+		task = pids[index]!=0 ? pid_task(find_vpid(pids[index]), PIDTYPE_PID) : NULL;
+		ips[index] = task ? task_pt_regs(task)->ip : 0;
+	}
+	rcu_read_unlock();
+}
+
+void init_stopped_sps_from_app_slot(char app_slot_idx, long sps[MAX_STOP_NUM])
+{
+	int index;
+	int pids[MAX_STOP_NUM];
+	struct task_struct *task;
+	get_stopped_pids(app_slot_idx, pids);
+	rcu_read_lock();
+	for(index = 0; index<MAX_STOP_NUM; index++){
+		task = pids[index]!=0 ? pid_task(find_vpid(pids[index]), PIDTYPE_PID) : NULL;
+		sps[index] = task ? task_pt_regs(task)->sp : 0;
 	}
+	rcu_read_unlock();
 }
 
 /**************************rerandomization and communication with shuffle process**************************/
 
-void send_rerandomization_mesg_to_shuffle_process(struct task_struct *ts, int curr_cc_id, char app_slot_idx)
+void send_rerandomization_mesg_to_shuffle_process(struct task_struct *ts, int curr_cc_id, int next_cc_id, char app_slot_idx)
 {
-	int connect = curr_cc_id==0 ? CURR_IS_CV1_NEED_CV2 : CURR_IS_CV2_NEED_CV1;
 	struct pt_regs *regs = task_pt_regs(ts);
 	int shuffle_pid = get_shuffle_pid(app_slot_idx);
 	volatile char *start_flag = req_a_start_flag(app_slot_idx, ts->pid);
-	MESG_BAG msg = {connect, ts->pid, regs->ip, {0}, CC_OFFSET, SS_OFFSET, GS_BASE, global_ss_type, "\0", "need rerandomization!"};
+	MESG_BAG msg = {CURR_CV_NEED_NEXT_CV, ts->pid, regs->ip, {0}, curr_cc_id, next_cc_id, GS_BASE, global_ss_type, "\0", "need rerandomization!"};
 	strcpy(msg.app_name, ts->comm);
 
 	init_stopped_ips_from_app_slot(app_slot_idx, msg.additional_ips);
+	//the shuffle process only patches the shadow stack frames above the stack pointers
+	msg.curr_sp = regs->sp;
+	init_stopped_sps_from_app_slot(app_slot_idx, msg.additional_sps);
 	
 	if(shuffle_pid!=0){
 		nl_send_msg(shuffle_pid, msg);
@@ -1184,9 +1285,11 @@ void rerandomization(struct task_struct *ts)
 	long cc_start = 0;
 	long cc_end = 0;
 	int curr_cc_id = 0;
+	int next_cc_id = 0;
 	long shm_off = 0;
 	long mmap_ret = 0;
 	int shuffle_pid = 0;
+	int use_huge_page = 0;
 	char index = get_app_slot_idx(pid_vnr(task_pgrp(ts)));
 	// 1.judge has a process/thread has rerandomization or not
 	if(has_rerandomization(index))
@@ -1199,12 +1302,15 @@ void rerandomization(struct task_struct *ts)
 	spin_lock(&app_slot_lock); 
 	curr_cc_id = app_slot_list[(int)index].cc_id;
 	shuffle_pid = app_slot_list[(int)index].shuffle_pid;
-	app_slot_list[(int)index].cc_id = curr_cc_id==0 ? 1 : 0;
+	//switch to the next code variant in the ring, the shuffle process has pre-generated it
+	next_cc_id = (curr_cc_id + 1)%app_slot_list[(int)index].cv_num;
+	app_slot_list[(int)index].cc_id = next_cc_id;
+	use_huge_page = app_slot_list[(int)index].use_huge_page;
 	for(internal_index = 0; internal_index<MAX_X_NUM; internal_index++){
 		cc_start = app_slot_list[(int)index].xr[internal_index].cc_start;
 		cc_end = app_slot_list[(int)index].xr[internal_index].cc_end;
 		if(cc_start!=0){
-			shm_off = curr_cc_id==0 ? (cc_end-cc_start) : 0;
+			shm_off = CC_SHM_OFFSET(cc_start, cc_end-cc_start, next_cc_id);
 			shm_fd = open_shm_file(app_slot_list[(int)index].xr[internal_index].shfile);
 			mmap_ret = orig_mmap(cc_start, cc_end-cc_start, PROT_READ|PROT_EXEC, MAP_SHARED|MAP_FIXED, shm_fd, shm_off);
 			//PRINTK("remap %s %lx (fd=%d, ret=%ld) \n", app_slot_list[(int)index].xr[internal_index].shfile, shm_off, shm_fd, mmap_ret);
@@ -1212,8 +1318,11 @@ void rerandomization(struct task_struct *ts)
 		}
 	}
 	spin_unlock(&app_slot_lock); 
+	// the remapped code caches lose the advice, advise them again after unlocking
+	if(use_huge_page)
+		advise_app_slot_huge_page(index);
 	// 4.send msg to shuffle process
-	send_rerandomization_mesg_to_shuffle_process(ts, curr_cc_id, index);
+	send_rerandomization_mesg_to_shuffle_process(ts, curr_cc_id, next_cc_id, index);
 	// 5.clear all flags
 	clear_rerandomization_and_send_stop(index);
 	// 6.wake all related processes
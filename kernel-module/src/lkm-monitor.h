@@ -4,7 +4,9 @@
 #include <linux/module.h>
 
 extern void init_shuffle_config_list(void);
-extern void insert_shuffle_info(char monitor_list_idx,int shuffle_pid);
+extern void insert_shuffle_info(char monitor_list_idx,int shuffle_pid, int cv_num, int use_huge_page);
+extern int get_shuffle_cv_num(char monitor_list_idx, int shuffle_pid);
+extern int get_shuffle_use_huge_page(char monitor_list_idx, int shuffle_pid);
 extern void free_one_shuffle_info(char monitor_list_idx, int shuffle_pid);
 extern 	int connect_one_shuffle(char monitor_list_idx, char app_slot_idx);
 extern int  has_free_shuffle(char monitor_list_idx, char app_slot_idx);
@@ -34,7 +36,8 @@ extern void clear_rerand_record(struct task_struct *ts);
 
 extern char *get_start_encode_and_set_entry(struct task_struct *ts, long program_entry);
 extern char *is_checkpoint(struct task_struct *ts, char *app_slot_idx);
-extern void set_shuffle_pid(char app_slot_idx, int shuffle_pid);
+extern void set_shuffle_pid(char app_slot_idx, int shuffle_pid, int cv_num, int use_huge_page);
+extern int need_huge_page(char app_slot_idx);
 extern char get_app_slot_idx(int pgid);
 extern void set_shuffle_pc(char app_slot_idx, ulong pc);
 extern void set_additional_pc(char app_slot_idx, long ips[]);
@@ -55,12 +55,13 @@ void nl_recv_msg(struct sk_buff *skb)
 	if(monitor_idx!=0){
 		switch(((MESG_BAG*)nlmsg_data(nlh))->connect){
 			case CONNECT:
-				insert_shuffle_info(monitor_idx, pid);
+				//cc_offset is the number of code variants in the ring, ss_offset is 1 when the shuffle process runs with -H
+				insert_shuffle_info(monitor_idx, pid, ((MESG_BAG*)nlmsg_data(nlh))->cc_offset, ((MESG_BAG*)nlmsg_data(nlh))->ss_offset!=0);
 				break;
 			case DISCONNECT:
 				free_one_shuffle_info(monitor_idx, pid);
 				break;
-			case CV1_IS_READY: case CV2_IS_READY: case SIGACTION_HANDLED: case SS_HANDLED: case DLOPERATION_HANDLED:
+			case CV_IS_READY: case SIGACTION_HANDLED: case SS_HANDLED: case DLOPERATION_HANDLED:
 				app_slot_idx = get_app_slot_idx_from_shuffle_config(monitor_idx, pid);
 				start_flag = get_start_flag(app_slot_idx, ((MESG_BAG*)nlmsg_data(nlh))->proctected_procid);
 				//set curr new pc
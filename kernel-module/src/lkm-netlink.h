@@ -31,17 +31,18 @@ typedef struct{
 	LKM_SS_TYPE lkm_ss_type;
 	char app_name[256];
 	char mesg[256];
+	//stack pointers of the current and stopped processes/threads, only used by rerandomization
+	long curr_sp;
+	long additional_sps[MAX_STOP_NUM];
 }MESG_BAG;
 
 #define DISCONNECT            0 //send by shuffle process
-#define CONNECT               1 //send by shuffle process
-#define CV1_IS_READY          2 //send by shuffle process
-#define CV2_IS_READY          3 //send by shuffle process
+#define CONNECT               1 //send by shuffle process, cc_offset is the number of code variants, ss_offset is the -H flag
+#define CV_IS_READY           2 //send by shuffle process, cc_offset is the id of the ready code variant
 #define SIGACTION_HANDLED     4 //send by shuffle process
 #define SS_HANDLED            5 //send by shuffle process
 #define DLOPERATION_HANDLED   6 //send by shuffle process
-#define CURR_IS_CV2_NEED_CV1  7 //send by kernel module
-#define CURR_IS_CV1_NEED_CV2  8 //send by kernel module
+#define CURR_CV_NEED_NEXT_CV  7 //send by kernel module, cc_offset/ss_offset are the ids of the current/next code variants
 #define P_PROCESS_IS_IN       9 //send by kernel module
 #define P_PROCESS_IS_OUT      10//send by kernel module
 #define SIGACTION_DETECTED    11//send by kernel module
@@ -23,6 +23,9 @@
 #define X86_PAGE_IS_ALIGN(addr)	( ((addr)&(X86_PAGE_SIZE-1)) == 0 )
 #define X86_PAGE_ALIGN_CEIL(addr)  ( ((addr)+X86_PAGE_SIZE-1) & X86_PAGE_MASK )
 #define X86_PAGE_ALIGN_FLOOR(addr) ( (addr) & X86_PAGE_MASK )
+#define X86_HUGE_PAGE_SIZE (1ul<<21)	 // 2MiB
+#define X86_HUGE_PAGE_OFFSET(addr) ( (addr) & (X86_HUGE_PAGE_SIZE - 1) )
+#define X86_HUGE_PAGE_ALIGN_CEIL(addr)  ( ((addr)+X86_HUGE_PAGE_SIZE-1) & ~(X86_HUGE_PAGE_SIZE - 1) )
 
 
 #endif
@@ -5,15 +5,24 @@
 #include "option.h"
 #include "code_variant_manager.h"
 #include "netlink.h"
+#include "db_format.h"
+#include "worker_pool.h"
+#include "latency_stats.h"
 
 int main(int argc, char **argv)
 {
     Options::parse(argc, argv);
+    // convert the v1 dbs into v2 format
+    if(Options::_need_upgrade_db)
+        DBFormat::upgrade_db_files(Options::_upgrade_db_path);
 
     if(Options::_static_analysis){
         // 1. parse elf
         ElfParser::init();
         ElfParser::parse_elf(Options::_elf_path.c_str());
+        // reuse the static analysis results in db cache (checking needs all modules' analysis)
+        if(Options::_has_db_cache && !Options::_need_check_static_analysis)
+            CodeVariantManager::init_from_db_cache(LKM_OFFSET_SS_TYPE);
         // 2. disassemble all modules into instructions
         Disassembler::init();
         Disassembler::disassemble_all_modules();
@@ -39,6 +48,11 @@ int main(int argc, char **argv)
     }
 
     if(Options::_dynamic_shuffle){
+        //block SIGUSR1 before creating any thread, it dumps the latency histograms
+        if(Options::_has_latency_log)
+            LatencyStats::init(Options::_latency_log_path);
+        //init the worker pool shared by code variant generation, shadow stack patching and dlopen
+        WorkerPool::init(Options::_worker_num);
         //init code variant manager
         if(!Options::_static_analysis){
             //read input relocation dbs
@@ -48,8 +62,11 @@ int main(int argc, char **argv)
             Module::init_cvm_from_modules();
             Module::generate_all_relocation_block(LKM_OFFSET_SS_TYPE);
         }
+        //the hot rbbus are initialized with the protected process's information
+        if(Options::_has_exec_profile)
+            CodeVariantManager::read_exec_profile(Options::_exec_profile_path);
         // 1.init netlink and get protected process's information
-        NetLink::connect_with_lkm(Options::_elf_path);
+        NetLink::connect_with_lkm(Options::_elf_path, (UINT32)Options::_cv_num, Options::_use_huge_page);
 
         // loop to listen 
         MESG_BAG mesg;
@@ -72,36 +89,52 @@ int main(int argc, char **argv)
                 return -1;
             }
         }
-        // 2.generate the first code variant
+        // 2.generate the first code variant, the kernel module maps the first one of the ring at first
         CodeVariantManager::init_protected_proc_info(mesg.proctected_procid, mesg.cc_offset, mesg.ss_offset, mesg.gs_base, mesg.lkm_ss_type);
         CodeVariantManager::start_gen_code_variants();
-        CodeVariantManager::wait_for_code_variant_ready(true); 
-        new_pc = CodeVariantManager::find_cc_paddrx_from_all_orig(mesg.new_ip, true);
+        CodeVariantManager::wait_for_code_variant_ready(0); 
+        new_pc = CodeVariantManager::find_cc_paddrx_from_all_orig(mesg.new_ip, 0);
         ASSERT(new_pc!=0);
         long new_ips[MAX_STOP_NUM] = {0};
         // 3.send message to switch to the new generated code variant
-        NetLink::send_cv_ready_mesg(mesg.proctected_procid, true, new_pc, new_ips, Options::_elf_path);
+        NetLink::send_cv_ready_mesg(mesg.proctected_procid, 0, new_pc, new_ips, Options::_elf_path);
         // 4.loop to listen for rereandomization and exit
         while(1){
             // block to recv message from kernel module
             MESG_BAG mesg = NetLink::recv_mesg();
+            UINT64 stop_start = LatencyStats::get_time_ns();
             
             if(mesg.connect==P_PROCESS_IS_OUT)
                 break;
-            else if(mesg.connect==CURR_IS_CV1_NEED_CV2 || mesg.connect==CURR_IS_CV2_NEED_CV1){
-                //handle rerandomization
-                BOOL need_cv1 = mesg.connect==CURR_IS_CV2_NEED_CV1;
-                CodeVariantManager::wait_for_code_variant_ready(need_cv1);
+            else if(mesg.connect==CURR_CV_NEED_NEXT_CV){
+                //handle rerandomization, the kernel module has remapped the next code variant of the ring
+                UINT32 curr_cv_id = (UINT32)mesg.cc_offset;
+                UINT32 next_cv_id = (UINT32)mesg.ss_offset;
+                FATAL(curr_cv_id>=Options::_cv_num || next_cv_id>=Options::_cv_num, "wrong code variant id %u->%u!\n", curr_cv_id, next_cv_id);
+                CodeVariantManager::wait_for_code_variant_ready(next_cv_id);
+                UINT64 wait_end = LatencyStats::get_time_ns();
                 //curr pc
-                new_pc = CodeVariantManager::get_new_pc_from_old_all(mesg.new_ip, need_cv1);
+                new_pc = CodeVariantManager::get_new_pc_from_old_all(mesg.new_ip, curr_cv_id, next_cv_id);
                 ASSERT(new_pc!=0);
-                CodeVariantManager::patch_new_ra_in_all_ss(need_cv1);
+                UINT64 translate_end = LatencyStats::get_time_ns();
+                CodeVariantManager::patch_new_ra_in_all_ss(curr_cv_id, next_cv_id, mesg.curr_sp, mesg.additional_sps);
+                UINT64 patch_ss_end = LatencyStats::get_time_ns();
                 //other processes and threads pc
                 long new_additional_ips[MAX_STOP_NUM];
-                CodeVariantManager::patch_new_pc(new_additional_ips, mesg.additional_ips, need_cv1);
+                CodeVariantManager::patch_new_pc(new_additional_ips, mesg.additional_ips, curr_cv_id, next_cv_id);
+                UINT64 patch_pc_end = LatencyStats::get_time_ns();
                 //send message
-                NetLink::send_cv_ready_mesg(mesg.proctected_procid, need_cv1, new_pc, new_additional_ips, Options::_elf_path);
-                CodeVariantManager::consume_cv(need_cv1 ? false : true);
+                NetLink::send_cv_ready_mesg(mesg.proctected_procid, next_cv_id, new_pc, new_additional_ips, Options::_elf_path);
+                UINT64 stop_end = LatencyStats::get_time_ns();
+                //the protected process is resumed, so the phases are recorded out of the stop window
+                LatencyStats::record(LatencyStats::WAIT_CV, stop_start, wait_end);
+                LatencyStats::record(LatencyStats::TRANSLATE_PC, wait_end, translate_end);
+                LatencyStats::record(LatencyStats::PATCH_SS, translate_end, patch_ss_end);
+                LatencyStats::record(LatencyStats::PATCH_PC, patch_ss_end, patch_pc_end);
+                LatencyStats::record(LatencyStats::STOP_TOTAL, stop_start, stop_end);
+                //only the old code variant is regenerated, the others of the ring are still ready for the next switches
+                CodeVariantManager::consume_cv(curr_cv_id);
+                CodeVariantManager::prepare_pc_translation(next_cv_id);
             }else if(mesg.connect==SIGACTION_DETECTED){
                 //handle sigaction
                 P_ADDRX sighandler_addr = mesg.cc_offset;
@@ -111,8 +144,9 @@ int main(int argc, char **argv)
                 NetLink::send_sigaction_handled_mesg(mesg.proctected_procid, new_pc, Options::_elf_path);
             }else if(mesg.connect==CREATE_SS){
                 SIZE ss_len = mesg.cc_offset;
+                P_ADDRX ss_end = mesg.ss_offset;
                 std::string shm_path = std::string(mesg.mesg);
-                CodeVariantManager::create_ss(ss_len, shm_path);
+                CodeVariantManager::create_ss(ss_len, shm_path, ss_end);
                 NetLink::send_ss_handled_mesg(mesg.proctected_procid, mesg.new_ip, Options::_elf_path);
             }else if(mesg.connect==FREE_SS){
                 SIZE ss_len = mesg.cc_offset;
@@ -140,6 +174,8 @@ int main(int argc, char **argv)
         CodeVariantManager::stop_gen_code_variants();
         // 6.recycle 
         CodeVariantManager::recycle();
+        WorkerPool::destroy();
+        LatencyStats::destroy();
         // 7.disconnect
         NetLink::disconnect_with_lkm(Options::_elf_path);
     }
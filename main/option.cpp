@@ -1,6 +1,8 @@
 #include <unistd.h>
+#include <sys/stat.h>
 #include<stdlib.h>
 #include "option.h"
+#include "netlink.h"
 
 BOOL  Options::_static_analysis = false;
 BOOL  Options::_dynamic_shuffle = false;
@@ -8,15 +10,32 @@ BOOL  Options::_need_check_static_analysis = false;
 BOOL  Options::_has_elf_path = false;
 BOOL  Options::_has_input_db_file = false;
 BOOL  Options::_has_output_db_file = false;
+BOOL  Options::_has_db_cache = false;
 BOOL  Options::_need_randomize_rbbl = false;
 BOOL  Options::_need_randomize_rbbu = false;
+BOOL  Options::_use_objdump = false;
+BOOL  Options::_use_mapped_db = false;
+BOOL  Options::_need_upgrade_db = false;
+BOOL  Options::_has_latency_log = false;
+BOOL  Options::_has_fixed_seed = false;
+BOOL  Options::_has_exec_profile = false;
+BOOL  Options::_use_huge_page = false;
 INT64 Options::_rbbu_range = 1;
 INT64 Options::_rbbu_padding = 0;
+INT64 Options::_analysis_thread_num = 1;
+INT64 Options::_worker_num = 0;
+INT64 Options::_cv_num = 2;
+INT64 Options::_fixed_seed = 0;
+INT64 Options::_hot_coverage = 90;
 
 std::string Options::_check_file;
 std::string Options::_elf_path;
 std::string Options::_input_db_file_path;
 std::string Options::_output_db_file_path;
+std::string Options::_db_cache_path;
+std::string Options::_upgrade_db_path;
+std::string Options::_latency_log_path;
+std::string Options::_exec_profile_path;
 
 void Options::show_system()
 {
@@ -40,20 +59,62 @@ void Options::print_usage(char *cr2)
     PRINT("Usage: %s, Copyright@WangZhe | ICT\n", cr2);
     PRINT("Option list (alphabetical order):\n");
     PRINT(" -A                             Static Analysis and Dynamic Shuffle code.\n");
+    PRINT(" -c /db/cache/path              Reuse and publish the static analysis db of each module in the shared db cache.\n");
     PRINT(" -C /path/*.cr2.indirect.log    Input indirect log file to check static analysis.\n");
+    PRINT(" -d                             Disassemble by objdump instead of the native linear sweep disassembler.\n");
     PRINT(" -D                             Dynamic Shuffle (Generate the shuffle code variants).\n");
     PRINT(" -h                             Display help information.\n");
+    PRINT(" -H                             Map the code caches at 2MiB aligned addresses and advise transparent huge pages.\n");
     PRINT(" -i /rela.db.path               Input the db file of relocation block.\n");
     PRINT(" -I /path/elf                   Handle elf binary file and its all dependence library.\n");
+    PRINT(" -j thread_num                  Analysis (or load the dbs of) modules concurrently with thread_num threads.\n");
+    PRINT(" -k cv_num                      Pre-generate a ring of cv_num code variants (default: 2, max: %d).\n", MAX_CV_NUM);
+    PRINT(" -l /path/latency.log           Dump the latency histograms of rerandomization into the log on SIGUSR1 and at exit.\n");
+    PRINT("                                (The log also has the per code variant histograms of the jmps eliminated and the branches relaxed).\n");
+    PRINT(" -m                             Keep db files mapped and use the relocation blocks in place (zero-copy).\n");
     PRINT(" -o /rela.db.path               Output relocation block to db file used for shuffle code at runtime.\n");
+    PRINT(" -p /path/exec.profile          Cluster the hot rbbus of the execution profile (\"module offset count\" lines).\n");
+    PRINT(" -P coverage                    Percent of the profiled samples covered by the hot rbbus (default: 90).\n");
     PRINT(" -R                             All relocation block should be randomized in code variant!\n");
     PRINT(" -r range_num padding_num       Reorder Basic Block Unit!\n");
+    PRINT("                                (Rbbus are the fall-through chains, a range_num covering all rbbus shuffles all chains).\n");
+    PRINT(" -s seed                        Randomize the code layouts with a fixed seed for reproducible benchmarking.\n");
     PRINT(" -S                             Static Analysis (Disassemble/Recognize IndirectJump Targets/Split BBLs/Classify BBLs).\n");
+    PRINT(" -u /db/path                    Upgrade the v1 db files in the directory to the v2 format.\n");
     PRINT(" -v                             Display version information.\n");
+    PRINT(" -w worker_num                  Size of the worker pool generating code variants (default: online cpus).\n");
 }
 
 void Options::check(char *cr2)
 {
+    if(_has_db_cache){
+        struct stat fileStat;
+        if(stat(_db_cache_path.c_str(), &fileStat)!=0 || !S_ISDIR(fileStat.st_mode)){
+            PRINT("%s: invalid option -- db cache path %s is not a directory\n", cr2, _db_cache_path.c_str());
+            exit(-1);
+        }
+        //others could replace the entries of a shared directory, unless it is sticky (like /tmp) and owned by root
+        if((fileStat.st_mode&(S_IWGRP|S_IWOTH)) && !((fileStat.st_mode&S_ISVTX) && fileStat.st_uid==0)){
+            PRINT("%s: invalid option -- db cache path %s is writable by others, but not sticky and owned by root\n", cr2, _db_cache_path.c_str());
+            exit(-1);
+        }
+    }
+    if(_analysis_thread_num<1){
+        PRINT("%s: invalid option -- -j thread_num should be larger than 0\n", cr2);
+        exit(-1);
+    }
+    if(_worker_num<0){
+        PRINT("%s: invalid option -- -w worker_num should not be negative\n", cr2);
+        exit(-1);
+    }
+    if(_hot_coverage<=0 || _hot_coverage>100){
+        PRINT("%s: invalid option -- -P coverage should be in (0, 100]\n", cr2);
+        exit(-1);
+    }
+    if(_cv_num<2 || _cv_num>MAX_CV_NUM){
+        PRINT("%s: invalid option -- -k cv_num should be in [2, %d]\n", cr2, MAX_CV_NUM);
+        exit(-1);
+    }
     if(_static_analysis){
         if(!_has_elf_path){
             PRINT("%s: invalid option -- when using static analysis, you should specified a binary (Forget -I)\n", cr2);
@@ -91,7 +152,7 @@ inline INT64 convert_str_to_num(const char* str, char** stopstring)
 void Options::parse(int argc, char** argv)
 {
     //1. process cr2 options
-    const char *opt_string = "AC:Dhi:I:o:Rr::Sv";
+    const char *opt_string = "Ac:C:dDhHi:I:j:k:l:mo:p:P:Rr::s:Su:vw:";
     INT32 ret;
     while((ret = getopt(argc, argv, opt_string))!=-1){
         switch (ret){
@@ -99,10 +160,19 @@ void Options::parse(int argc, char** argv)
                 _static_analysis = true;
                 _dynamic_shuffle = true;
                 break;
+            case 'c':
+                _has_db_cache = true;
+                _db_cache_path = std::string(optarg);
+                if(_db_cache_path[_db_cache_path.length()-1]!='/')
+                    _db_cache_path += '/';
+                break;
             case 'C':
                 _need_check_static_analysis = true;
                 _check_file = std::string(optarg);
                 break;
+            case 'd':
+                _use_objdump = true;
+                break;
             case 'D':
                 _dynamic_shuffle = true;
                 break;
@@ -111,6 +181,9 @@ void Options::parse(int argc, char** argv)
                 print_usage(argv[0]);
                 exit(0);
                 break;
+            case 'H':
+                _use_huge_page = true;
+                break;
             case 'i':
                 _has_input_db_file = true;
                 _input_db_file_path = std::string(optarg);
@@ -119,10 +192,30 @@ void Options::parse(int argc, char** argv)
                 _has_elf_path = true;
                 _elf_path = std::string(optarg);
                 break;
+            case 'j':
+                _analysis_thread_num = convert_str_to_num(optarg, NULL);
+                break;
+            case 'k':
+                _cv_num = convert_str_to_num(optarg, NULL);
+                break;
+            case 'l':
+                _has_latency_log = true;
+                _latency_log_path = std::string(optarg);
+                break;
+            case 'm':
+                _use_mapped_db = true;
+                break;
             case 'o':
                 _has_output_db_file = true;
                 _output_db_file_path = std::string(optarg);
                 break;
+            case 'p':
+                _has_exec_profile = true;
+                _exec_profile_path = std::string(optarg);
+                break;
+            case 'P':
+                _hot_coverage = convert_str_to_num(optarg, NULL);
+                break;
             case 'R':
                 _need_randomize_rbbl = true;
                 break;
@@ -131,13 +224,24 @@ void Options::parse(int argc, char** argv)
                 _rbbu_padding = convert_str_to_num(argv[optind++], NULL);
                 _need_randomize_rbbu = true;
                 break;
+            case 's':
+                _has_fixed_seed = true;
+                _fixed_seed = convert_str_to_num(optarg, NULL);
+                break;
             case 'S':
                 _static_analysis = true;
                 break;
+            case 'u':
+                _need_upgrade_db = true;
+                _upgrade_db_path = std::string(optarg);
+                break;
             case 'v' :
                 show_system();
                 exit(0);
                 break;
+            case 'w':
+                _worker_num = convert_str_to_num(optarg, NULL);
+                break;
             default:
                 print_usage(argv[0]);
                 exit(-1);
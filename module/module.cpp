@@ -1,12 +1,16 @@
 #include <fstream>
+#include <algorithm>
 
 #include "module.h"
 #include "elf-parser.h"
 #include "instruction.h"
 #include "basic-block.h"
 #include "code_variant_manager.h"
+#include "option.h"
+#include "parallel.h"
 
 Module::MODULE_MAP Module::_all_module_maps;
+SpinLock Module::_all_module_maps_lock;
 const std::string Module::func_type_name[Module::FUNC_TYPE_NUM] = 
 {
     "CALL_TARGET", "PROLOG_MATCH", "SYM_RECORD",
@@ -34,7 +38,9 @@ Module::Module(ElfParser *elf): _elf(elf), _real_load_base(0)
     }
         
     _elf->search_rela_x_section(_rela_targets);
+    _all_module_maps_lock.lock();
     _all_module_maps.insert(make_pair(_elf->get_elf_name(), this));
+    _all_module_maps_lock.unlock();
 }
 
 Module::~Module()
@@ -383,14 +389,17 @@ void Module::generate_relocation_block(LKM_SS_TYPE ss_type)
     _cvm->init_rbbl_unit();
 }
 
+void Module::generate_module_relocation_block(Module *module, void *arg)
+{
+    //ERR("%s\n", module->get_name().c_str());
+    module->generate_relocation_block(*(LKM_SS_TYPE*)arg);
+}
+
 void Module::generate_all_relocation_block(LKM_SS_TYPE ss_type)
 {
-    MODULE_MAP_ITERATOR it = _all_module_maps.begin();
-    for(; it!=_all_module_maps.end(); it++){
-        Module *module = it->second;
-        //ERR("%s\n", module->get_name().c_str());
-        module->generate_relocation_block(ss_type);
-    }
+    std::vector<Module*> modules;
+    get_all_modules_sorted_by_size(modules);
+    ParallelHandler<Module*>(modules, generate_module_relocation_block, (void*)&ss_type).run(Options::_analysis_thread_num);
 }
 
 #ifdef TRACE_DEBUG
@@ -682,13 +691,29 @@ void Module::split_bbl()
     }
 }
 
+static BOOL module_is_larger(Module *a, Module *b)
+{
+    return a->get_x_size() > b->get_x_size();
+}
+
+void Module::get_all_modules_sorted_by_size(std::vector<Module*> &modules)
+{
+    for(MODULE_MAP_ITERATOR it = _all_module_maps.begin(); it!=_all_module_maps.end(); it++)
+        modules.push_back(it->second);
+    std::stable_sort(modules.begin(), modules.end(), module_is_larger);
+}
+
+void Module::split_module_into_bbls(Module *module, void *arg)
+{
+    module->split_bbl();
+    module->examine_bbls();
+}
+
 void Module::split_all_modules_into_bbls()
 {
-   MODULE_MAP_ITERATOR it = _all_module_maps.begin();
-   for(; it!=_all_module_maps.end(); it++){
-        it->second->split_bbl();
-        it->second->examine_bbls();
-   }
+    std::vector<Module*> modules;
+    get_all_modules_sorted_by_size(modules);
+    ParallelHandler<Module*>(modules, split_module_into_bbls).run(Options::_analysis_thread_num);
 }
 
 void Module::examine_bbls()
@@ -1334,20 +1359,28 @@ BOOL Module::analysis_jump_table_in_so(F_SIZE jump_offset, F_SIZE &table_base, S
     }
 }
 
+void Module::analysis_module_indirect_jump_targets(Module *module, void *arg)
+{
+    module->analysis_indirect_jump_targets();
+}
+
 void Module::analysis_all_modules_indirect_jump_targets()
 {
-   MODULE_MAP_ITERATOR it = _all_module_maps.begin();
-   for(; it!=_all_module_maps.end(); it++){
-        it->second->analysis_indirect_jump_targets();
-   }
+    std::vector<Module*> modules;
+    get_all_modules_sorted_by_size(modules);
+    ParallelHandler<Module*>(modules, analysis_module_indirect_jump_targets).run(Options::_analysis_thread_num);
+}
+
+void Module::separate_movable_bbls_from_module(Module *module, void *arg)
+{
+    module->separate_movable_bbls();
 }
 
 void Module::separate_movable_bbls_from_all_modules()
 {
-   MODULE_MAP_ITERATOR it = _all_module_maps.begin();
-   for(; it!=_all_module_maps.end(); it++){
-        it->second->separate_movable_bbls();
-   }
+    std::vector<Module*> modules;
+    get_all_modules_sorted_by_size(modules);
+    ParallelHandler<Module*>(modules, separate_movable_bbls_from_module).run(Options::_analysis_thread_num);
 }
 
 void Module::dump_all_bbls_in_va(const P_ADDRX load_base)
@@ -9,21 +9,34 @@
 #include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <emmintrin.h>
 
 #include "option.h"
 #include "code_variant_manager.h"
 #include "instr_generator.h"
+#include "elf-parser.h"
+#include "db_format.h"
+#include "parallel.h"
+#include "worker_pool.h"
+#include "latency_stats.h"
+#include "random_generator.h"
 
 CodeVariantManager::CVM_MAPS CodeVariantManager::_all_cvm_maps;
+CodeVariantManager::CVM_RANGE_INDEX CodeVariantManager::_x_range_index;
+CodeVariantManager::CVM_RANGE_INDEX CodeVariantManager::_cc_range_index;
+CodeVariantManager::CVM_RANGE_INDEX CodeVariantManager::_cc_map_range_index;
 std::string CodeVariantManager::_code_variant_img_path;
 SIZE CodeVariantManager::_cc_offset = 0;
 SIZE CodeVariantManager::_ss_offset = 0;
 P_ADDRX CodeVariantManager::_gs_base = 0;
 P_ADDRX CodeVariantManager::_org_stack_load_base = 0;
 CodeVariantManager::SS_MAPS CodeVariantManager::_ss_maps;
-BOOL CodeVariantManager::_is_cv1_ready = false;
-BOOL CodeVariantManager::_is_cv2_ready = false;
+volatile BOOL CodeVariantManager::_is_cv_ready[MAX_CV_NUM] = {false};
 CodeVariantManager::SIG_HANDLERS CodeVariantManager::_sig_handlers;
+CodeVariantManager::EXEC_PROFILE CodeVariantManager::_exec_profile;
 BOOL CodeVariantManager::_has_init = false;
 
 inline UINT64 get_time_diff(struct timeval &start, struct timeval &end)
@@ -77,15 +90,31 @@ std::string get_real_name_from_path(std::string path)
 
 CodeVariantManager::CodeVariantManager(std::string module_path)
 {
-    _elf_real_name = get_real_name_from_path(get_real_path(module_path.c_str()));
+    _elf_real_path = get_real_path(module_path.c_str());
+    _elf_real_name = get_real_name_from_path(_elf_real_path);
+    _is_from_db_cache = false;
+    _db_load_time = 0;
+    _gen_time = 0;
+    _arrange_num = 0;
+    _hot_rbbl_num = 0;
+    _db_map_start = 0;
+    _db_map_size = 0;
+    _org_x_load_base = 0;
+    _org_x_load_size = 0;
+    _cc_load_base = 0;
+    _cc_load_size = 0;
+    _cc_map_base = 0;
+    _cc_map_size = 0;
     add_cvm(this);
+    for(UINT32 cv_id = 0; cv_id<MAX_CV_NUM; cv_id++)
+        _cvs[cv_id].translation.is_valid = false;
 #ifdef USE_TRAMP_RECORD_OPT
-    _has_common_record1 = false;
-    _has_common_record2 = false;
+    for(UINT32 cv_id = 0; cv_id<MAX_CV_NUM; cv_id++)
+        _cvs[cv_id].has_common_record = false;
 #endif
 }
 
-static INT32 map_shm_file(std::string shm_path, S_ADDRX &addr, F_SIZE &file_sz)
+static INT32 map_shm_file(std::string shm_path, S_ADDRX &addr, F_SIZE &file_sz, BOOL use_huge_page = false)
 {
     //1.open shm file
     INT32 fd = shm_open(shm_path.c_str(), O_RDWR, 0644);
@@ -96,8 +125,32 @@ static INT32 map_shm_file(std::string shm_path, S_ADDRX &addr, F_SIZE &file_sz)
     FATAL(ret!=0, "fstat failed %s!", strerror(errno));
     F_SIZE file_size = statbuf.st_size;
     //3.mmap file
-    void *map_ret = mmap(NULL, file_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-    PERROR(map_ret!=MAP_FAILED, "mmap failed!");
+    void *map_ret = NULL;
+    if(use_huge_page){
+        //3.1 reserve one more huge page and map the file at the 2MiB aligned address in it, so the 2MiB aligned parts
+        //    of the file are mapped at 2MiB aligned addresses
+        S_SIZE map_size = X86_PAGE_ALIGN_CEIL(file_size);
+        void *reserve_ret = mmap(NULL, map_size + X86_HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        PERROR(reserve_ret!=MAP_FAILED, "mmap failed!");
+        S_ADDRX reserve_start = (S_ADDRX)reserve_ret;
+        S_ADDRX reserve_end = reserve_start + map_size + X86_HUGE_PAGE_SIZE;
+        S_ADDRX aligned_start = X86_HUGE_PAGE_ALIGN_CEIL(reserve_start);
+        if(aligned_start>reserve_start)
+            munmap(reserve_ret, aligned_start - reserve_start);
+        if(reserve_end>aligned_start + map_size)
+            munmap((void*)(aligned_start + map_size), reserve_end - aligned_start - map_size);
+        map_ret = mmap((void*)aligned_start, file_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0);
+        PERROR(map_ret!=MAP_FAILED, "mmap failed!");
+        //3.2 shmem THP needs the advice when shmem_enabled is advise
+        static BOOL has_warned = false;
+        if(madvise(map_ret, file_size, MADV_HUGEPAGE)!=0 && !has_warned){
+            ERR("madvise(MADV_HUGEPAGE) failed (%s), code caches use 4KiB pages!\n", strerror(errno));
+            has_warned = true;
+        }
+    }else{
+        map_ret = mmap(NULL, file_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        PERROR(map_ret!=MAP_FAILED, "mmap failed!");
+    }
 
     //return 
     addr = (S_ADDRX)map_ret;
@@ -116,18 +169,29 @@ static void close_shm_file(INT32 fd, std::string shm_path)
 CodeVariantManager::~CodeVariantManager()
 {
     close_shm_file(_cc_fd, _cc_shm_path);
-    munmap((void*)_cc1_base, _cc_load_size*2);
+    munmap((void*)_cc_map_base, _cc_map_size);
+    //destroy rbbl views before unmapping the db file
+    for(std::vector<std::pair<RandomBBL*, SIZE> >::iterator iter = _db_rbbl_views.begin(); iter!=_db_rbbl_views.end(); iter++){
+        for(SIZE idx = 0; idx<iter->second; idx++)
+            iter->first[idx].~RandomBBL();
+        delete [](UINT8*)iter->first;
+    }
+    if(_db_map_start!=0)
+        munmap((void*)_db_map_start, _db_map_size);
 }
 
 void CodeVariantManager::init_cc()
 {
-    // 1.map cc
-    S_SIZE map_size = 0;
-    _cc_fd = map_shm_file(_cc_shm_path, _cc1_base, map_size);
-    ASSERT(map_size==(_cc_load_size*2));
-    _cc2_base = _cc1_base+map_size/2;  
-    _cc1_used_base = _cc1_base;
-    _cc2_used_base = _cc2_base;
+    // 1.map cc, the shm file holds the code caches of MAX_CV_NUM code variants
+    _cc_fd = map_shm_file(_cc_shm_path, _cc_map_base, _cc_map_size, Options::_use_huge_page);
+    FATAL(_cc_map_size!=CC_SHM_SIZE(_cc_load_size), "%s is not a ring of %d code caches!\n", _cc_shm_path.c_str(), MAX_CV_NUM);
+    // 2.init the code caches of the used code variants, they are placed as the kernel module maps them
+    for(UINT32 cv_id = 0; cv_id<Options::_cv_num; cv_id++){
+        _cvs[cv_id].cc_base = _cc_map_base + CC_SHM_OFFSET(_cc_load_base, _cc_load_size, cv_id);
+        _cvs[cv_id].cc_used_base = _cvs[cv_id].cc_base;
+        //the whole code cache is cleaned before the first code variant
+        _cvs[cv_id].cc_dirty_end = _cvs[cv_id].cc_base + _cc_load_size;
+    }
 }
 
 void CodeVariantManager::init_all_cc()
@@ -137,6 +201,51 @@ void CodeVariantManager::init_all_cc()
         iter->second->init_cc();
 }
 
+static bool is_lower_range(const CodeVariantManager::CVM_RANGE &range_a, const CodeVariantManager::CVM_RANGE &range_b)
+{
+    return range_a.start<range_b.start;
+}
+
+static bool is_higher_than_range(S_ADDRX addr, const CodeVariantManager::CVM_RANGE &range)
+{
+    return addr<range.start;
+}
+
+static void insert_range(CodeVariantManager::CVM_RANGE_INDEX &index, S_ADDRX start, S_SIZE size, CodeVariantManager *cvm)
+{
+    if(size==0)
+        return ;
+    CodeVariantManager::CVM_RANGE range = {start, start + size, cvm};
+    index.push_back(range);
+}
+
+void CodeVariantManager::update_range_index()
+{
+    //1. collect the ranges of all cvms
+    _x_range_index.clear();
+    _cc_range_index.clear();
+    _cc_map_range_index.clear();
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
+        CodeVariantManager *cvm = iter->second;
+        insert_range(_x_range_index, cvm->_org_x_load_base, cvm->_org_x_load_size, cvm);
+        insert_range(_cc_range_index, cvm->_cc_load_base, cvm->_cc_load_size, cvm);
+        insert_range(_cc_map_range_index, cvm->_cc_map_base, cvm->_cc_map_size, cvm);
+    }
+    //2. sort the ranges by start address
+    std::sort(_x_range_index.begin(), _x_range_index.end(), is_lower_range);
+    std::sort(_cc_range_index.begin(), _cc_range_index.end(), is_lower_range);
+    std::sort(_cc_map_range_index.begin(), _cc_map_range_index.end(), is_lower_range);
+}
+
+CodeVariantManager *CodeVariantManager::find_cvm_from_index(const CVM_RANGE_INDEX &index, S_ADDRX addr)
+{
+    CVM_RANGE_INDEX::const_iterator iter = std::upper_bound(index.begin(), index.end(), addr, is_higher_than_range);
+    if(iter==index.begin())
+        return NULL;
+    iter--;
+    return addr<iter->end ? iter->cvm : NULL;
+}
+
 typedef struct mapsRow{
 	P_ADDRX start;
 	P_ADDRX end;
@@ -227,7 +336,7 @@ void CodeVariantManager::parse_proc_maps(PID protected_pid)
             std::string maps_record_name = get_real_name_from_path(get_real_path(currentRow->pathname));
             if(is_shared(currentRow)){//shadow stack
                 if(maps_record_name.find(ss_sufix)!=std::string::npos)
-                    create_ss(currentRow->end-currentRow->start, maps_record_name);
+                    create_ss(currentRow->end-currentRow->start, maps_record_name, currentRow->end);
             }else{
                 if(strstr(currentRow->pathname, "[stack]"))//stack
                     set_stack_load_base(currentRow->end);
@@ -237,7 +346,7 @@ void CodeVariantManager::parse_proc_maps(PID protected_pid)
         if(is_shared(currentRow) && currentRow->inode!=0){
             std::string maps_record_name = get_real_name_from_path(get_real_path(currentRow->pathname));
             if(maps_record_name.find(ss_sufix)!=std::string::npos)
-                create_ss(currentRow->end-currentRow->start, maps_record_name);
+                create_ss(currentRow->end-currentRow->start, maps_record_name, currentRow->end);
         }
         
         if(strstr(currentRow->pathname, "[stack]"))//stack
@@ -269,306 +378,456 @@ void CodeVariantManager::parse_proc_maps(PID protected_pid)
 #define JMP8_OPCODE 0xeb
 #define JMP32_OPCODE 0xe9
 
-inline CC_LAYOUT_PAIR place_invalid_boundary(S_ADDRX invalid_addr, CC_LAYOUT &cc_layout)
+inline BOOL place_invalid_boundary(S_ADDRX invalid_addr, CC_LAYOUT &cc_layout)
 {
     std::string invalid_template = InstrGenerator::gen_invalid_instr();
     invalid_template.copy((char*)invalid_addr, invalid_template.length());
-    return cc_layout.insert(std::make_pair(Range<S_ADDRX>(invalid_addr, invalid_addr+invalid_template.length()-1), BOUNDARY_PTR));
+    return cc_layout.insert(invalid_addr, invalid_addr+invalid_template.length()-1, BOUNDARY_PTR);
 }
 
-inline CC_LAYOUT_PAIR place_invalid_trampoline(S_ADDRX invalid_addr, CC_LAYOUT &cc_layout)
+inline BOOL place_invalid_trampoline(S_ADDRX invalid_addr, CC_LAYOUT &cc_layout)
 {
     std::string invalid_template = InstrGenerator::gen_invalid_instr();
     invalid_template.copy((char*)invalid_addr, invalid_template.length());
-    return cc_layout.insert(std::make_pair(Range<S_ADDRX>(invalid_addr, invalid_addr+invalid_template.length()-1), INV_TRAMP_PTR));
+    return cc_layout.insert(invalid_addr, invalid_addr+invalid_template.length()-1, INV_TRAMP_PTR);
 }
 
-inline CC_LAYOUT_PAIR place_trampoline8(S_ADDRX tramp8_addr, INT8 offset8, CC_LAYOUT &cc_layout)
+inline BOOL place_trampoline8(S_ADDRX tramp8_addr, INT8 offset8, CC_LAYOUT &cc_layout)
 {
     //gen jmp rel8 instruction
     UINT16 pos = 0;
     std::string jmp_rel8_template = InstrGenerator::gen_jump_rel8_instr(pos, offset8);
     jmp_rel8_template.copy((char*)tramp8_addr, jmp_rel8_template.length());
     //insert trampoline8 into cc layout
-    return cc_layout.insert(std::make_pair(Range<S_ADDRX>(tramp8_addr, tramp8_addr+JMP8_LEN-1), TRAMP_JMP8_PTR));
+    return cc_layout.insert(tramp8_addr, tramp8_addr+JMP8_LEN-1, TRAMP_JMP8_PTR);
 }
-inline CC_LAYOUT_PAIR place_trampoline32(S_ADDRX tramp32_addr, INT32 offset32, CC_LAYOUT &cc_layout)
+inline BOOL place_trampoline32(S_ADDRX tramp32_addr, INT32 offset32, CC_LAYOUT &cc_layout)
 {
     //gen jmp rel32 instruction
     UINT16 pos = 0;
     std::string jmp_rel32_template = InstrGenerator::gen_jump_rel32_instr(pos, offset32);
     jmp_rel32_template.copy((char*)tramp32_addr, jmp_rel32_template.length());
     //insert trampoline8 into cc layout
-    return cc_layout.insert(std::make_pair(Range<S_ADDRX>(tramp32_addr, tramp32_addr+JMP32_LEN-1), TRAMP_JMP32_PTR));
+    return cc_layout.insert(tramp32_addr, tramp32_addr+JMP32_LEN-1, TRAMP_JMP32_PTR);
 }
 
-inline CC_LAYOUT_PAIR place_overlap_trampoline32(S_ADDRX tramp32_addr, INT32 offset32, CC_LAYOUT &cc_layout)
+inline BOOL place_overlap_trampoline32(S_ADDRX tramp32_addr, INT32 offset32, CC_LAYOUT &cc_layout)
 {
     //gen jmp rel32 instruction
     UINT16 pos = 0;
     std::string jmp_rel32_template = InstrGenerator::gen_jump_rel32_instr(pos, offset32);
     jmp_rel32_template.copy((char*)tramp32_addr, jmp_rel32_template.length());
     //insert trampoline8 into cc layout
-    return cc_layout.insert(std::make_pair(Range<S_ADDRX>(tramp32_addr, tramp32_addr+OVERLAP_JMP32_LEN-1), TRAMP_OVERLAP_JMP32_PTR));
+    return cc_layout.insert(tramp32_addr, tramp32_addr+OVERLAP_JMP32_LEN-1, TRAMP_OVERLAP_JMP32_PTR);
 }
 
 //this function is only used to place trampoline8 with trampoline32 
 S_ADDRX front_to_place_overlap_trampoline32(S_ADDRX overlap_tramp_addr, UINT8 overlap_byte, CC_LAYOUT &cc_layout)
 {
     // 1. set boundary to start searching
-    std::pair<CC_LAYOUT_ITER, BOOL> boundary = cc_layout.insert(std::make_pair(Range<S_ADDRX>(overlap_tramp_addr, \
-        overlap_tramp_addr+OVERLAP_JMP32_LEN-1), TRAMP_OVERLAP_JMP32_PTR));
-    CC_LAYOUT_ITER curr_iter = boundary.first, prev_iter = --boundary.first;
-    ASSERT(curr_iter!=cc_layout.begin());
+    SIZE boundary_idx = 0;
+    cc_layout.insert(overlap_tramp_addr, overlap_tramp_addr+OVERLAP_JMP32_LEN-1, TRAMP_OVERLAP_JMP32_PTR, boundary_idx);
+    ASSERT(boundary_idx!=0);
+    SIZE curr_idx = boundary_idx, prev_idx = boundary_idx - 1;
     S_ADDRX trampoline32_addr = 0;
-    //loop to find the space to place the tramp32
-    while(prev_iter!=cc_layout.end()){
-        S_SIZE left_space = curr_iter->first - prev_iter->first;
+    //loop to find the space to place the tramp32 (ranges are only inserted above curr_idx, so the indexes are stable)
+    while(curr_idx!=0){
+        S_SIZE left_space = CC_LAYOUT::get_space(cc_layout[prev_idx], cc_layout[curr_idx]);
         if(left_space>=JMP32_LEN){
-            trampoline32_addr = curr_iter->first.low() - JMP32_LEN;
-            S_ADDRX end = prev_iter->first.high() + 1;
+            trampoline32_addr = cc_layout[curr_idx].low - JMP32_LEN;
+            S_ADDRX end = cc_layout[prev_idx].high + 1;
             while(trampoline32_addr!=end){
                 INT32 offset32 = trampoline32_addr - overlap_tramp_addr - JMP32_LEN;
                 if(((offset32>>24)&0xff)==overlap_byte){
-                    CC_LAYOUT_PAIR ret = place_overlap_trampoline32(overlap_tramp_addr, offset32, cc_layout);
-                    FATAL(ret.second, "place overlap trampoline32 wrong!\n");
+                    BOOL ret = place_overlap_trampoline32(overlap_tramp_addr, offset32, cc_layout);
+                    FATAL(ret, "place overlap trampoline32 wrong!\n");
                     return trampoline32_addr;
                 }
                 trampoline32_addr--;
             }
         }
     
-        curr_iter--;
-        prev_iter--;
+        curr_idx--;
+        prev_idx--;
     }
-    ASSERT(prev_iter!=cc_layout.end());
+    ASSERT(curr_idx!=0);
     return trampoline32_addr;
 }
 
 S_ADDRX front_to_place_trampoline32(S_ADDRX fixed_trampoline_addr, CC_LAYOUT &cc_layout)
 {
     // 1. set boundary to start searching
-    std::pair<CC_LAYOUT_ITER, BOOL> boundary = cc_layout.insert(std::make_pair(Range<S_ADDRX>(fixed_trampoline_addr, \
-        fixed_trampoline_addr+JMP8_LEN-1), TRAMP_JMP8_PTR));
-    ASSERT(boundary.second);
-    // 2. init scanner
-    CC_LAYOUT_ITER curr_iter = boundary.first, prev_iter = --boundary.first;
-    ASSERT(curr_iter!=cc_layout.begin());
+    SIZE boundary_idx = 0;
+    BOOL boundary_ret = cc_layout.insert(fixed_trampoline_addr, fixed_trampoline_addr+JMP8_LEN-1, TRAMP_JMP8_PTR, boundary_idx);
+    FATAL(!boundary_ret, " place fixed trampoline8 wrong!\n");
+    // 2. init scanner (relay trampolines are only inserted above curr_idx, so the indexes are stable)
+    ASSERT(boundary_idx!=0);
+    SIZE curr_idx = boundary_idx, prev_idx = boundary_idx - 1;
     // 3. variables used to store the results
     S_ADDRX trampoline32_addr = 0;
     S_ADDRX trampoline8_base = fixed_trampoline_addr;
     S_ADDRX last_tramp8_addr = 0;
     // 4. loop to search
-    while(prev_iter!=cc_layout.begin()){
-        S_SIZE space = curr_iter->first - prev_iter->first;
+    while(prev_idx!=0){
+        S_SIZE space = CC_LAYOUT::get_space(cc_layout[prev_idx], cc_layout[curr_idx]);
         ASSERT(space>=0);
         // assumpe the dest can place tramp32
-        trampoline32_addr = curr_iter->first.low() - JMP32_LEN;
+        trampoline32_addr = cc_layout[curr_idx].low - JMP32_LEN;
         INT32 dest_offset8 = trampoline32_addr - trampoline8_base - JMP8_LEN;
         // 4.1 judge can place trampoline32
         if((space>=JMP32_LEN) && (dest_offset8>=SCHAR_MIN)){
-            CC_LAYOUT_PAIR ret = place_trampoline8(trampoline8_base, dest_offset8, cc_layout);
-            FATAL((trampoline8_base!=fixed_trampoline_addr) && !ret.second, " place trampoline8 wrong!\n");
+            BOOL ret = place_trampoline8(trampoline8_base, dest_offset8, cc_layout);
+            FATAL((trampoline8_base!=fixed_trampoline_addr) && !ret, " place trampoline8 wrong!\n");
             break;
         }
         // assumpe the dest can place tramp8
-        S_ADDRX tramp8_addr = curr_iter->first.low() - JMP8_LEN;
+        S_ADDRX tramp8_addr = cc_layout[curr_idx].low - JMP8_LEN;
         INT32 relay_offset8 = tramp8_addr - trampoline8_base - JMP8_LEN;
         // 4.2 judge is over 8 relative offset
         if(relay_offset8>=SCHAR_MIN)
             last_tramp8_addr = space>=JMP8_LEN ? tramp8_addr : last_tramp8_addr;
         else{//need relay
             if(last_tramp8_addr==0){
-                CC_LAYOUT_ITER erase_iter = cc_layout.upper_bound(Range<S_ADDRX>(fixed_trampoline_addr));
-                cc_layout.erase(--erase_iter);
+                cc_layout.erase(cc_layout.upper_bound(fixed_trampoline_addr) - 1);
                 return 0;
             }
             INT32 last_offset8 = last_tramp8_addr - trampoline8_base - JMP8_LEN;
             ASSERT(last_offset8>=SCHAR_MIN);
             //place the internal jmp8 rel8 template
-            CC_LAYOUT_PAIR ret = place_trampoline8(trampoline8_base, last_offset8, cc_layout);
-            FATAL((trampoline8_base!=fixed_trampoline_addr) && !ret.second, " place trampoline8 wrong!\n");
+            BOOL ret = place_trampoline8(trampoline8_base, last_offset8, cc_layout);
+            FATAL((trampoline8_base!=fixed_trampoline_addr) && !ret, " place trampoline8 wrong!\n");
             //clear last
             trampoline8_base = last_tramp8_addr;
             last_tramp8_addr = 0;
         }
 
-        curr_iter--;
-        prev_iter--;
+        curr_idx--;
+        prev_idx--;
     }
-    ASSERT(prev_iter!=cc_layout.begin());
+    ASSERT(prev_idx!=0);
     ASSERT(trampoline32_addr!=0);
     return trampoline32_addr;
 }
 
-S_ADDRX *random_rbbl(const CodeVariantManager::RAND_BBL_MAPS fixed_rbbls, const CodeVariantManager::RAND_BBL_MAPS movable_rbbls, \
-    SIZE &array_num)
+S_ADDRX *random_rbbl(const std::vector<RandomBBL*> &rbbls, SIZE &array_num)
 {
-    array_num = fixed_rbbls.size() + movable_rbbls.size();
+    array_num = rbbls.size();
     S_ADDRX *rbbl_array = new S_ADDRX[array_num];
     //init array
-    SIZE index = 0;
-    for(CodeVariantManager::RAND_BBL_MAPS::const_iterator iter = fixed_rbbls.begin(); iter!=fixed_rbbls.end(); iter++, index++)
-        rbbl_array[index] = (S_ADDRX)iter->second;
-    for(CodeVariantManager::RAND_BBL_MAPS::const_iterator iter = movable_rbbls.begin(); iter!=movable_rbbls.end(); iter++, index++)
-        rbbl_array[index] = (S_ADDRX)iter->second;
-    //random seed
-    srand((INT32)time(NULL));
-    for(SIZE idx=array_num-1; idx>0; idx--){
-        //swap
-        INT32 swap_idx = rand()%idx;
-        INT32 temp = rbbl_array[swap_idx];
-        rbbl_array[swap_idx] = rbbl_array[idx];
-        rbbl_array[idx] = temp;
-    }
-
+    for(SIZE index = 0; index<array_num; index++)
+        rbbl_array[index] = (S_ADDRX)rbbls[index];
+    //shuffle by the generator of this thread
+    RandomGenerator::shuffle(rbbl_array, array_num);
     return rbbl_array;
 }
 
-void random_range(CodeVariantManager::RAND_BBL_MAPS **rbbu_array, SIZE array_num)
+void random_range(CodeVariantManager::RBBU *rbbu_array, SIZE array_num)
 {
-    srand((INT32)time(NULL));
-    for(SIZE idx=array_num-1; idx>0; idx--){
-        INT32 swap_idx = rand()%idx;
-        CodeVariantManager::RAND_BBL_MAPS *temp = rbbu_array[swap_idx];
-        rbbu_array[swap_idx] = rbbu_array[idx];
-        rbbu_array[idx] = temp;
+    RandomGenerator::shuffle(rbbu_array, array_num);
+}
+
+//shuffle rbbus in each window of range rbbus
+void random_windows(CodeVariantManager::RBBU *rbbu_array, SIZE array_num, INT64 range)
+{
+    for(SIZE idx = 0; idx<array_num; idx += range)
+        random_range(rbbu_array+idx, std::min((SIZE)range, array_num-idx));
+}
+
+//copy the rbbls of rbbus into rbbl_array in order, return the number of rbbls
+SIZE flatten_rbbus(const CodeVariantManager::RBBU *rbbu_array, SIZE rbbu_num, const std::vector<RandomBBL*> &rbbls, \
+    S_ADDRX *rbbl_array)
+{
+    SIZE rbbl_idx = 0;
+    for(SIZE idx = 0; idx<rbbu_num; idx++){
+        for(UINT32 num = 0; num<rbbu_array[idx].num; num++)
+            rbbl_array[rbbl_idx++] = (S_ADDRX)rbbls[rbbu_array[idx].start + num];
     }
+    return rbbl_idx;
 }
 
-S_ADDRX *random_rbbu(CodeVariantManager::RAND_BBU_MAPS &rbbu_maps, SIZE array_num, INT64 range)
+S_ADDRX *random_rbbu(const CodeVariantManager::RAND_BBU_VEC &rbbus, const std::vector<RandomBBL*> &rbbls, SIZE array_num, \
+    INT64 range)
 {   
     S_ADDRX *rbbl_array = new S_ADDRX[array_num];
-    SIZE rbbu_array_num = rbbu_maps.size();
-    CodeVariantManager::RAND_BBL_MAPS **rbbu_array = new CodeVariantManager::RAND_BBL_MAPS*[rbbu_array_num]; 
-    SIZE idx = 0;
-    for(CodeVariantManager::RAND_BBU_MAPS::iterator iter = rbbu_maps.begin(); iter!=rbbu_maps.end(); iter++){
-        rbbu_array[idx++] = &(iter->second);
-    }
-    ASSERT(idx==rbbu_array_num);
-    
-    idx = 0;
-    while(1){
-        if((idx+range)<rbbu_array_num)
-            random_range(rbbu_array+idx, range);
-        else{
-            random_range(rbbu_array+idx, rbbu_array_num-idx);
+    CodeVariantManager::RAND_BBU_VEC rbbu_array(rbbus);
+    if(!rbbu_array.empty())
+        random_windows(&rbbu_array[0], rbbu_array.size(), range);
+    SIZE rbbl_num = rbbu_array.empty() ? 0 : flatten_rbbus(&rbbu_array[0], rbbu_array.size(), rbbls, rbbl_array);
+    FATAL(rbbl_num!=array_num, "rbbus are unmatched with rbbls!\n");
+    return rbbl_array;
+}
+
+static bool is_lower_rbbl(const CodeVariantManager::RBBL_ENTRY &entry_a, const CodeVariantManager::RBBL_ENTRY &entry_b)
+{
+    return entry_a.first<entry_b.first;
+}
+
+static bool is_same_rbbl(const CodeVariantManager::RBBL_ENTRY &entry_a, const CodeVariantManager::RBBL_ENTRY &entry_b)
+{
+    return entry_a.first==entry_b.first;
+}
+
+//rbbls of the db are already sorted, the static analysis may insert them in any order (the first one of an offset is kept)
+static void sort_rbbls(CodeVariantManager::RAND_BBL_VEC &rbbls)
+{
+    for(SIZE idx = 1; idx<rbbls.size(); idx++){
+        if(rbbls[idx-1].first>=rbbls[idx].first){
+            std::stable_sort(rbbls.begin(), rbbls.end(), is_lower_rbbl);
+            rbbls.erase(std::unique(rbbls.begin(), rbbls.end(), is_same_rbbl), rbbls.end());
             break;
         }
-        idx += range;
-    };
-    SIZE rbbl_idx = 0;
-    for(idx = 0; idx<rbbu_array_num; idx++){
-        for(CodeVariantManager::RAND_BBL_MAPS::iterator it = rbbu_array[idx]->begin(); it!=rbbu_array[idx]->end(); it++){
-            rbbl_array[rbbl_idx++] = (S_ADDRX)it->second;
-        }
     }
-    ASSERT(rbbl_idx==array_num);
-    //free
-    delete []rbbu_array;
-    return rbbl_array;
 }
 
-S_ADDRX *fallthrough_following(const CodeVariantManager::RAND_BBL_MAPS fixed_rbbls, const CodeVariantManager::RAND_BBL_MAPS movable_rbbls, \
-    SIZE &array_num)
+void CodeVariantManager::init_sorted_rbbls()
 {
-    array_num = fixed_rbbls.size() + movable_rbbls.size();
-    S_ADDRX *rbbl_array = new S_ADDRX[array_num];
-
-    //init array
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator fixed_iter = fixed_rbbls.begin();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator fixed_end = fixed_rbbls.end();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator movable_iter = movable_rbbls.begin();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator movable_end = movable_rbbls.end();
-    
-    for(SIZE index=0; index<array_num; index++){
+    sort_rbbls(_postion_fixed_rbbls);
+    sort_rbbls(_movable_rbbls);
+    RAND_BBL_VEC::const_iterator fixed_iter = _postion_fixed_rbbls.begin();
+    RAND_BBL_VEC::const_iterator fixed_end = _postion_fixed_rbbls.end();
+    RAND_BBL_VEC::const_iterator movable_iter = _movable_rbbls.begin();
+    RAND_BBL_VEC::const_iterator movable_end = _movable_rbbls.end();
+    SIZE rbbl_num = get_rbbl_num();
+    _rbbls.clear();
+    _rbbls.reserve(rbbl_num);
+    for(SIZE index=0; index<rbbl_num; index++){
         F_SIZE curr_fixed_offset = fixed_iter!=fixed_end ? fixed_iter->first : 0x7fffffff;
         F_SIZE curr_movable_offset = movable_iter!=movable_end ? movable_iter->first : 0x7fffffff;
         if(curr_fixed_offset<curr_movable_offset){
-            rbbl_array[index] = (S_ADDRX)fixed_iter->second;
+            _rbbls.push_back(fixed_iter->second);
             fixed_iter++;
         }else if(curr_fixed_offset>curr_movable_offset){
-            rbbl_array[index] = (S_ADDRX)movable_iter->second;
+            _rbbls.push_back(movable_iter->second);
             movable_iter++;
         }else
             FATAL(1, "Can not be exist the same offset in both fixed_rbbls and movable_rbbls!\n");
     }
-
-    return rbbl_array;
 }
 
 void CodeVariantManager::init_rbbl_unit()
 {
-    SIZE array_num = _postion_fixed_rbbl_maps.size() + _movable_rbbl_maps.size();
-    S_ADDRX *rbbl_array = new S_ADDRX[array_num];
-    //init array
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator fixed_iter = _postion_fixed_rbbl_maps.begin();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator fixed_end = _postion_fixed_rbbl_maps.end();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator movable_iter = _movable_rbbl_maps.begin();
-    CodeVariantManager::RAND_BBL_MAPS::const_iterator movable_end = _movable_rbbl_maps.end();
-    
-    for(SIZE index=0; index<array_num; index++){
-        F_SIZE curr_fixed_offset = fixed_iter!=fixed_end ? fixed_iter->first : 0x7fffffff;
-        F_SIZE curr_movable_offset = movable_iter!=movable_end ? movable_iter->first : 0x7fffffff;
-        if(curr_fixed_offset<curr_movable_offset){
-            rbbl_array[index] = (S_ADDRX)fixed_iter->second;
-            fixed_iter++;
-        }else if(curr_fixed_offset>curr_movable_offset){
-            rbbl_array[index] = (S_ADDRX)movable_iter->second;
-            movable_iter++;
+    init_sorted_rbbls();
+    //split basic block unit, the rbbu is ended if the next rbbl is not its fallthrough
+    SIZE rbbl_num = _rbbls.size();
+    _rbbus.clear();
+    RBBU curr_rbbu = {0, 0};
+    for(SIZE idx = 0; idx<rbbl_num; idx++){
+        RandomBBL *curr_rbbl = _rbbls[idx];
+        RandomBBL *next_rbbl = idx<(rbbl_num-1) ? _rbbls[idx+1] : NULL;
+        curr_rbbu.num++;
+        if(!next_rbbl || next_rbbl->get_rbbl_offset()!=curr_rbbl->get_last_br_target()){
+            _rbbus.push_back(curr_rbbu);
+            curr_rbbu.start = idx + 1;
+            curr_rbbu.num = 0;
+        }
+    }
+    return ;    
+}
+
+void CodeVariantManager::init_rbbl_unit(const UINT32 *rbbu_sizes, SIZE rbbu_num)
+{
+    init_sorted_rbbls();
+    SIZE rbbl_num = _rbbls.size();
+    SIZE used_num = 0;
+    //each rbbu is a run of rbbls in the order of rbbl offset
+    _rbbus.clear();
+    _rbbus.reserve(rbbu_num);
+    for(SIZE idx = 0; idx<rbbu_num; idx++){
+        FATAL(rbbu_sizes[idx]==0 || used_num+rbbu_sizes[idx]>rbbl_num, "rbbu section is unmatched with rbbls!\n");
+        RBBU rbbu = {(UINT32)used_num, rbbu_sizes[idx]};
+        _rbbus.push_back(rbbu);
+        used_num += rbbu_sizes[idx];
+    }
+    FATAL(used_num!=rbbl_num, "rbbu section is unmatched with rbbls!\n");
+}
+
+void CodeVariantManager::read_exec_profile(std::string profile_path)
+{
+    std::ifstream ifs(profile_path.c_str());
+    FATAL(!ifs.is_open(), "open execution profile %s failed!\n", profile_path.c_str());
+    std::string line;
+    char name[1024];
+    long long offset;
+    unsigned long long count;
+    while(std::getline(ifs, line)){
+        if(line.empty() || line[0]=='#')
+            continue;
+        INT32 ret = sscanf(line.c_str(), "%1023s %lli %llu", name, &offset, &count);
+        FATAL(ret!=3 || offset<0, "wrong execution profile line: %s\n", line.c_str());
+        _exec_profile[std::string(name)][(F_SIZE)offset] += count;
+    }
+    ifs.close();
+}
+
+void CodeVariantManager::init_all_hot_rbbus()
+{
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++)
+        iter->second->init_hot_rbbus();
+}
+
+static double log2_factorial(SIZE num)
+{
+    return lgamma((double)num + 1)/log(2.0);
+}
+
+//entropy of shuffling num items in each window of range items
+static double get_window_entropy(SIZE num, INT64 range)
+{
+    double entropy = 0;
+    for(SIZE idx = 0; idx<num; idx += range)
+        entropy += log2_factorial(std::min((SIZE)range, num - idx));
+    return entropy;
+}
+
+void CodeVariantManager::init_hot_rbbus()
+{
+    _hot_rbbus.clear();
+    _cold_rbbus.clear();
+    _hot_rbbl_num = 0;
+    EXEC_PROFILE::iterator profile_iter = _exec_profile.find(_elf_real_name);
+    if(profile_iter==_exec_profile.end() || _rbbus.empty())
+        return ;
+    //1. count the samples of each rbbu, a sample belongs to the rbbu with the nearest lower offset
+    const RAND_BBU_VEC &rbbus = _rbbus;
+    std::vector<F_SIZE> rbbu_offsets;
+    rbbu_offsets.reserve(rbbus.size());
+    for(RAND_BBU_VEC::const_iterator iter = rbbus.begin(); iter!=rbbus.end(); iter++)
+        rbbu_offsets.push_back(_rbbls[iter->start]->get_rbbl_offset());
+    std::vector<std::pair<UINT64, SIZE> > rbbu_counts;
+    std::map<SIZE, UINT64> sampled_rbbus;
+    UINT64 total_count = 0;
+    for(EXEC_COUNTS::iterator iter = profile_iter->second.begin(); iter!=profile_iter->second.end(); iter++){
+        SIZE idx = std::upper_bound(rbbu_offsets.begin(), rbbu_offsets.end(), iter->first) - rbbu_offsets.begin();
+        if(idx==0)
+            continue;
+        sampled_rbbus[idx-1] += iter->second;
+        total_count += iter->second;
+    }
+    if(total_count==0)
+        return ;
+    //2. rank the sampled rbbus, the top ones covering the coverage of samples are hot
+    for(std::map<SIZE, UINT64>::iterator iter = sampled_rbbus.begin(); iter!=sampled_rbbus.end(); iter++)
+        rbbu_counts.push_back(std::make_pair(iter->second, iter->first));
+    std::stable_sort(rbbu_counts.begin(), rbbu_counts.end(), std::greater<std::pair<UINT64, SIZE> >());
+    std::vector<BOOL> is_hot(rbbus.size(), false);
+    UINT64 hot_count = 0;
+    for(SIZE idx = 0; idx<rbbu_counts.size() && hot_count*100<total_count*(UINT64)Options::_hot_coverage; idx++){
+        is_hot[rbbu_counts[idx].second] = true;
+        hot_count += rbbu_counts[idx].first;
+    }
+    //3. split rbbus in offset order
+    for(SIZE idx = 0; idx<rbbus.size(); idx++){
+        if(is_hot[idx]){
+            _hot_rbbus.push_back(rbbus[idx]);
+            _hot_rbbl_num += rbbus[idx].num;
         }else
-            FATAL(1, "Can not be exist the same offset in both fixed_rbbls and movable_rbbls!\n");
+            _cold_rbbus.push_back(rbbus[idx]);
     }
-    //split basic block unit   
-    F_SIZE curr_rbbu_offset = ((RandomBBL*)rbbl_array[0])->get_rbbl_offset();
-    std::map<F_SIZE, RandomBBL*> curr_rbbu;
-    curr_rbbu.insert(std::make_pair(curr_rbbu_offset, (RandomBBL*)rbbl_array[0]));
+    //4. report the expected entropy of the rbbl order (padding is excluded)
+    SIZE rbbl_num = get_rbbl_num();
+    double hot_entropy, cold_entropy, orig_entropy;
+    if(Options::_need_randomize_rbbl){
+        hot_entropy = log2_factorial(_hot_rbbl_num);
+        cold_entropy = log2_factorial(rbbl_num - _hot_rbbl_num);
+        orig_entropy = log2_factorial(rbbl_num);
+    }else{
+        hot_entropy = log2_factorial(_hot_rbbus.size());
+        cold_entropy = get_window_entropy(_cold_rbbus.size(), Options::_rbbu_range);
+        orig_entropy = get_window_entropy(rbbus.size(), Options::_rbbu_range);
+    }
+    BLUE("[PROFILE] %s: %ld/%ld hot rbbus (%ld rbbls) cover %.1f%% samples, layout entropy %.1f bits (hot %.1f + cold %.1f), %.1f bits without profile\n", \
+        _elf_real_name.c_str(), _hot_rbbus.size(), rbbus.size(), _hot_rbbl_num, hot_count*100.0/total_count, \
+        hot_entropy + cold_entropy, hot_entropy, cold_entropy, orig_entropy);
+}
 
-    for(SIZE idx = 0; idx<array_num; idx++){
-        RandomBBL *curr_rbbl = (RandomBBL*)rbbl_array[idx];
-        RandomBBL *next_rbbl = idx<(array_num-1) ? (RandomBBL*)rbbl_array[idx+1] : NULL;
-        
-        if(next_rbbl){
-            F_SIZE next_rbbl_offset = next_rbbl->get_rbbl_offset();
-            if(next_rbbl_offset!=curr_rbbl->get_last_br_target()){
-                _rbbu_maps.insert(std::make_pair(curr_rbbu_offset, curr_rbbu));
-                curr_rbbu.clear();
-                curr_rbbu_offset = next_rbbl_offset;
-            }            
-            curr_rbbu.insert(std::make_pair(next_rbbl_offset, next_rbbl));
-        }else{
-            if(curr_rbbu.size()!=0)
-                _rbbu_maps.insert(std::make_pair(curr_rbbu_offset, curr_rbbu));
-        }
-            
+S_ADDRX *CodeVariantManager::random_hot_and_cold_rbbus(SIZE array_num)
+{
+    S_ADDRX *rbbl_array = new S_ADDRX[array_num];
+    RAND_BBU_VEC hot_rbbus(_hot_rbbus);
+    RAND_BBU_VEC cold_rbbus(_cold_rbbus);
+    if(!Options::_need_randomize_rbbl){
+        //1. -r: hot rbbus are shuffled as one window, cold rbbus are shuffled in the windows of the range
+        random_range(&hot_rbbus[0], hot_rbbus.size());
+        if(!cold_rbbus.empty())
+            random_windows(&cold_rbbus[0], cold_rbbus.size(), Options::_rbbu_range);
     }
-    delete []rbbl_array;
-    
-    return ;    
+    //2. hot rbbls are placed in a dense region before the cold rbbls
+    SIZE hot_num = flatten_rbbus(&hot_rbbus[0], hot_rbbus.size(), _rbbls, rbbl_array);
+    SIZE cold_num = cold_rbbus.empty() ? 0 : flatten_rbbus(&cold_rbbus[0], cold_rbbus.size(), _rbbls, rbbl_array + hot_num);
+    ASSERT(hot_num==_hot_rbbl_num && (hot_num + cold_num)==array_num);
+    if(Options::_need_randomize_rbbl){
+        //3. -R: rbbls are shuffled in the hot region and in the cold region separately
+        RandomGenerator::shuffle(rbbl_array, hot_num);
+        RandomGenerator::shuffle(rbbl_array + hot_num, cold_num);
+    }
+    return rbbl_array;
+}
+
+void CodeVariantManager::init_rbbl_slots()
+{
+    //1. assign slots to the rbbls in the order of offset, which are sorted by init_rbbl_unit
+    const std::vector<RandomBBL*> &rbbls = _rbbls;
+    SIZE rbbl_num = rbbls.size();
+    FATAL(rbbl_num!=get_rbbl_num(), "rbbls of %s are not sorted!\n", _elf_real_name.c_str());
+    _slot_offsets.clear();
+    _slot_offsets.reserve(rbbl_num);
+    SIZE reloc_sum = 0;
+    for(SIZE index = 0; index<rbbl_num; index++){
+        RandomBBL *rbbl = rbbls[index];
+        _slot_offsets.push_back(rbbl->get_rbbl_offset());
+        if(rbbl->has_lock_and_repeat_prefix())//the instruction without prefix can be the target
+            _slot_offsets.push_back(rbbl->get_rbbl_offset()+1);
+        reloc_sum += rbbl->get_reloc_num();
+    }
+    //2. resolve the relocation targets into slots
+    _reloc_slots.assign(reloc_sum, get_invalid_slot());
+    RBBL_SLOT slot = 0;
+    SIZE used_num = 0, unresolved_num = 0;
+    for(SIZE idx = 0; idx<rbbl_num; idx++){
+        RandomBBL *rbbl = rbbls[idx];
+        RBBL_SLOT *reloc_slots = reloc_sum!=0 ? &_reloc_slots[0] + used_num : NULL;
+        unresolved_num += rbbl->init_slots(slot, reloc_slots, &_slot_offsets[0], _slot_offsets.size());
+        used_num += rbbl->get_reloc_num();
+        slot += rbbl->has_lock_and_repeat_prefix() ? 2 : 1;
+    }
+    ASSERT(used_num==reloc_sum && slot==get_invalid_slot());
+    if(unresolved_num!=0)
+        ERR("%s has %ld unresolved relocation targets, they jump to the invalid boundary!\n", _elf_real_name.c_str(), unresolved_num);
+    //3. init the cc address of slots, the last one is the invalid boundary
+    for(UINT32 cv_id = 0; cv_id<Options::_cv_num; cv_id++)
+        _cvs[cv_id].rbbl_addrs.assign(_slot_offsets.size() + 1, 0);
 }
 
-S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_layout, \
-    RBBL_CC_MAPS &rbbl_maps, JMPIN_CC_OFFSET &jmpin_rbbl_offsets)
+S_ADDRX CodeVariantManager::arrange_cc_layout(CODE_VARIANT &cv)
 {
+    S_ADDRX cc_base = cv.cc_base;
+    CC_LAYOUT &cc_layout = cv.cc_layout;
+    RBBL_CC_ADDRS &rbbl_addrs = cv.rbbl_addrs;
+    JMPIN_CC_OFFSET &jmpin_rbbl_offsets = cv.jmpin_rbbl_offsets;
     S_ADDRX used_cc_base = 0;
     S_ADDRX trampoline32_addr = 0;
+    //the fixed seed is mixed with the module and the number of arranged layouts, so the layouts do not depend
+    //on which worker arranges the module
+    if(Options::_has_fixed_seed)
+        RandomGenerator::seed((UINT64)Options::_fixed_seed, RandomGenerator::hash_string(_elf_real_name) + _arrange_num);
+    _arrange_num++;
 
 #ifdef USE_TRAMP_RECORD_OPT 
-    BOOL &has_common_record = cc_base==_cc1_base ? _has_common_record1 : _has_common_record2;
-	CC_LAYOUT &common_cc_layout = cc_base==_cc1_base ? _common_cc_layout1 : _common_cc_layout2;
-	JMPIN_CC_OFFSET &common_jmpin_offset = cc_base==_cc1_base ? _common_jmpin_offset1 : _common_jmpin_offset2;
-	S_ADDRX &common_used_cc_base = cc_base==_cc1_base ? _common_used_cc_base1 : _common_used_cc_base2;
-	COMMON_DATA &common_data = cc_base==_cc1_base ? _common_data1 : _common_data2;	
+    BOOL &has_common_record = cv.has_common_record;
+	CC_LAYOUT &common_cc_layout = cv.common_cc_layout;
+	JMPIN_CC_OFFSET &common_jmpin_offset = cv.common_jmpin_offset;
+	S_ADDRX &common_used_cc_base = cv.common_used_cc_base;
+	COMMON_DATA &common_data = cv.common_data;	
 
     if(!has_common_record){
 #endif
     // 1.place fixed rbbl's trampoline  
-    CC_LAYOUT_PAIR invalid_ret = place_invalid_boundary(cc_base, cc_layout);
-    FATAL(!invalid_ret.second, " place invalid boundary wrong!\n");
-    for(RAND_BBL_MAPS::iterator iter = _postion_fixed_rbbl_maps.begin(); iter!=_postion_fixed_rbbl_maps.end(); iter++){
-        RAND_BBL_MAPS::iterator iter_bk = iter;
+    BOOL invalid_ret = place_invalid_boundary(cc_base, cc_layout);
+    FATAL(!invalid_ret, " place invalid boundary wrong!\n");
+    for(RAND_BBL_VEC::iterator iter = _postion_fixed_rbbls.begin(); iter!=_postion_fixed_rbbls.end(); iter++){
+        RAND_BBL_VEC::iterator iter_bk = iter;
         F_SIZE curr_bbl_offset = iter->first;
-        F_SIZE next_bbl_offset = (++iter)!=_postion_fixed_rbbl_maps.end() ? iter->first : curr_bbl_offset+JMP32_LEN;
+        F_SIZE next_bbl_offset = (++iter)!=_postion_fixed_rbbls.end() ? iter->first : curr_bbl_offset+JMP32_LEN;
         S_SIZE left_space = next_bbl_offset - curr_bbl_offset;
         iter = iter_bk;
         S_ADDRX inv_trampoline_addr = 0;
@@ -591,16 +850,16 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
             
             used_cc_base = next_bbl_offset + cc_base;
         }
-        CC_LAYOUT_PAIR ret;
+        BOOL ret;
         if(inv_trampoline_addr!=0){
             //place invalid instr
             ret = place_invalid_trampoline(inv_trampoline_addr, cc_layout);
-            FATAL(!ret.second, " place inv_trampoline wrong!\n");
+            FATAL(!ret, " place inv_trampoline wrong!\n");
             inv_trampoline_addr = 0;
         }else{
-            //place tramp32
-            ret = place_trampoline32(trampoline32_addr, curr_bbl_offset, cc_layout);
-            FATAL(!ret.second, " place trampoline32 wrong!\n");
+            //place tramp32, the offset is the target slot until relocation
+            ret = place_trampoline32(trampoline32_addr, iter->second->get_slot(), cc_layout);
+            FATAL(!ret, " place trampoline32 wrong!\n");
         }
     }
 #ifdef USE_MAIN_SWITCH_CASE_COPY_OPT
@@ -612,12 +871,12 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
         JMP_TABLE_CONTENT &table_content = iter->second;
         for(JMP_TABLE_CONTENT::iterator it = table_content.begin(); it!=table_content.end(); it++, entry_idx++){
             S_ADDRX placed_saddrx = cc_base + table_offset + entry_idx*sizeof(F_SIZE);
-            //place target rbbl offset
-            *(F_SIZE *)placed_saddrx = *it;
+            //place target rbbl slot
+            *(F_SIZE *)placed_saddrx = get_slot_from_offset(*it);
             used_cc_base = placed_saddrx + sizeof(F_SIZE);
             FATAL(used_cc_base<old_used_cc_base, "jump table should be place after x section!\n");
             //record    
-            cc_layout.insert(std::make_pair(Range<S_ADDRX>(placed_saddrx, used_cc_base-1), MAIN_JMP_TABLE));
+            cc_layout.insert(placed_saddrx, used_cc_base-1, MAIN_JMP_TABLE);
         }
     }
 #endif    
@@ -660,16 +919,16 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
             used_cc_base = next_bbl_offset + new_cc_base;
         }
 
-        CC_LAYOUT_PAIR ret;
+        BOOL ret;
         if(inv_trampoline_addr!=0){
             //place invalid instr
             ret = place_invalid_trampoline(inv_trampoline_addr, cc_layout);
-            FATAL(!ret.second, " place inv_trampoline wrong!\n");
+            FATAL(!ret, " place inv_trampoline wrong!\n");
             inv_trampoline_addr = 0;
         }else{
-            //place tramp32
-            ret = place_trampoline32(trampoline32_addr, curr_bbl_offset, cc_layout);
-            FATAL(!ret.second, " place trampoline32 wrong!\n");
+            //place tramp32, the offset is the target slot until relocation
+            ret = place_trampoline32(trampoline32_addr, get_slot_from_offset(curr_bbl_offset), cc_layout);
+            FATAL(!ret, " place trampoline32 wrong!\n");
         }
     }
 #ifdef USE_TRAMP_RECORD_OPT 
@@ -677,8 +936,8 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
         common_used_cc_base = used_cc_base;
         common_cc_layout = cc_layout;
         common_jmpin_offset = jmpin_rbbl_offsets;
-        for(CC_LAYOUT_ITER iter = common_cc_layout.begin(); iter!=common_cc_layout.end(); iter++){
-            S_ADDRX saddrx = iter->first.low();
+        for(SIZE idx = 0; idx<common_cc_layout.size(); idx++){
+            S_ADDRX saddrx = common_cc_layout[idx].low;
             common_data.insert(std::make_pair(saddrx, *(UINT64*)saddrx));
         }
         has_common_record = true;
@@ -697,19 +956,29 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
     // 5.1 random fixed and movable rbbls
     SIZE rbbl_array_size;
     S_ADDRX *rbbl_array = NULL;
-    if(Options::_need_randomize_rbbl)
-        rbbl_array = random_rbbl(_postion_fixed_rbbl_maps, _movable_rbbl_maps, rbbl_array_size);
+    if(!_hot_rbbus.empty()){
+        rbbl_array_size = get_rbbl_num();
+        rbbl_array = random_hot_and_cold_rbbus(rbbl_array_size);
+    }else if(Options::_need_randomize_rbbl)
+        rbbl_array = random_rbbl(_rbbls, rbbl_array_size);
     else{
         ASSERT(Options::_need_randomize_rbbu);
-        rbbl_array_size = _postion_fixed_rbbl_maps.size()+_movable_rbbl_maps.size();
-        rbbl_array = random_rbbu(_rbbu_maps, rbbl_array_size, Options::_rbbu_range);
+        rbbl_array_size = get_rbbl_num();
+        rbbl_array = random_rbbu(_rbbus, _rbbls, rbbl_array_size, Options::_rbbu_range);
     }
-    // 5.2 place rbbls
+    cc_layout.reserve(cc_layout.size() + rbbl_array_size);
+    rbbl_addrs[get_invalid_slot()] = cc_base;
+    // 5.2 calculate the place size and padding of rbbls
+    std::vector<RBBL_PLACEMENT> placements(rbbl_array_size);
     BOOL has_reduce_jmp = false;    
-    srand((INT32)time(NULL));
+    cv.reduced_jmp_num = 0;
+    cv.relaxed_br_num = 0;
+    cv.tail_br_num = 0;
+    cv.relaxed_bytes = 0;
     for(SIZE idx = 0; idx<rbbl_array_size; idx++){
         RandomBBL *curr_rbbl = (RandomBBL*)rbbl_array[idx];
         RandomBBL *next_rbbl = idx<(rbbl_array_size-1) ? (RandomBBL*)rbbl_array[idx+1] : NULL;
+        RBBL_PLACEMENT &placement = placements[idx];
         S_SIZE place_size = curr_rbbl->get_template_size();
         
         if(next_rbbl){
@@ -717,42 +986,97 @@ S_ADDRX CodeVariantManager::arrange_cc_layout(S_ADDRX cc_base, CC_LAYOUT &cc_lay
             if(next_rbbl_offset==curr_rbbl->get_last_br_target()){
                 place_size -= JMP32_LEN;//JMP_REL32 instruction len
                 has_reduce_jmp = true;
+                cv.reduced_jmp_num++;
             }else
                 has_reduce_jmp = false;
         }
-        F_SIZE curr_rbbl_offset = curr_rbbl->get_rbbl_offset();
-        rbbl_maps.insert(std::make_pair(curr_rbbl_offset, used_cc_base));
-        if(curr_rbbl->has_lock_and_repeat_prefix()){//consider prefix
-            ASSERT(place_size>1);
-            S_ADDRX prefix_start = used_cc_base + 1;
-#ifdef TRACE_DEBUG
-            if(_org_x_load_base<0x7fffffff)//main executable 
-                prefix_start += 29;
-#endif
-#ifdef LAST_RBBL_DEBUG
-            prefix_start += 22;
+        placement.place_size = place_size;
+        placement.padding_num = 0;
+        placement.relaxed_size = 0;
+        placement.is_relaxed = false;
+        placement.tail_idx = place_size>0 ? curr_rbbl->get_tail_branch(has_reduce_jmp, placement.relaxed_size) : -1;
+        cv.tail_br_num += placement.tail_idx>=0 ? 1 : 0;
+        //random padding '0xd6'
+        if(place_size>0 && !has_reduce_jmp && Options::_rbbu_padding>0)
+            placement.padding_num = RandomGenerator::next_bounded(Options::_rbbu_padding);
+    }
+#ifdef USE_SHORT_BRANCH_OPT
+    // 5.3 relax the trailing branches into rel8 form, the following rbbls are compacted
+    cv.relaxed_br_num = relax_tail_branches(rbbl_array, rbbl_array_size, placements, used_cc_base, rbbl_addrs);
 #endif
-            rbbl_maps.insert(std::make_pair(curr_rbbl_offset+1, prefix_start));      
-        }
-
-        if(place_size>0){
-            cc_layout.insert(std::make_pair(Range<S_ADDRX>(used_cc_base, used_cc_base+place_size-1), (S_ADDRX)curr_rbbl));
-            used_cc_base += place_size;
-            //place random padding '0xd6'
-            if(!has_reduce_jmp && Options::_rbbu_padding>0){
-                SIZE padding_num = rand()%Options::_rbbu_padding;
-                used_cc_base += padding_num;
-            }
+    // 5.4 place rbbls
+    for(SIZE idx = 0; idx<rbbl_array_size; idx++){
+        RandomBBL *curr_rbbl = (RandomBBL*)rbbl_array[idx];
+        const RBBL_PLACEMENT &placement = placements[idx];
+        set_rbbl_addr(rbbl_addrs, curr_rbbl, used_cc_base);
+        if(placement.place_size>0){
+            cc_layout.insert(used_cc_base, used_cc_base+placement.place_size-1, (S_ADDRX)curr_rbbl);
+            used_cc_base += placement.place_size + placement.padding_num;
+            cv.relaxed_bytes += placement.is_relaxed ? placement.relaxed_size : 0;
         }else
-            ASSERT(place_size==0);
+            ASSERT(placement.place_size==0);
     }
-    // 5.3 free array
+    // 5.5 free array
     delete []rbbl_array;
     //judge used cc size
     FATAL((used_cc_base - cc_base)>_cc_load_size, "code cache overflow!\n");
     return used_cc_base;
 }
 
+void CodeVariantManager::set_rbbl_addr(RBBL_CC_ADDRS &rbbl_addrs, RandomBBL *rbbl, S_ADDRX rbbl_addr)
+{
+    rbbl_addrs[rbbl->get_slot()] = rbbl_addr;
+    if(rbbl->has_lock_and_repeat_prefix()){//consider prefix
+        ASSERT(rbbl->get_template_size()>1);
+        S_ADDRX prefix_start = rbbl_addr + 1;
+#ifdef TRACE_DEBUG
+        if(_org_x_load_base<0x7fffffff)//main executable 
+            prefix_start += 29;
+#endif
+#ifdef LAST_RBBL_DEBUG
+        prefix_start += 22;
+#endif
+        rbbl_addrs[rbbl->get_prefix_slot()] = prefix_start;
+    }
+}
+
+#define RELAX_MAX_PASS_NUM 16
+
+SIZE CodeVariantManager::relax_tail_branches(S_ADDRX *rbbl_array, SIZE rbbl_array_size, std::vector<RBBL_PLACEMENT> &placements, \
+    S_ADDRX used_cc_base, RBBL_CC_ADDRS &rbbl_addrs)
+{
+    SIZE relaxed_num = 0;
+    BOOL has_relaxed = true;
+    for(SIZE pass = 0; has_relaxed && pass<RELAX_MAX_PASS_NUM; pass++){
+        //1. place rbbls with the current sizes
+        S_ADDRX curr_addr = used_cc_base;
+        for(SIZE idx = 0; idx<rbbl_array_size; idx++){
+            set_rbbl_addr(rbbl_addrs, (RandomBBL*)rbbl_array[idx], curr_addr);
+            curr_addr += placements[idx].place_size + placements[idx].padding_num;
+        }
+        //2. relax the trailing branches whose targets are in the rel8 range of the relaxed branches
+        has_relaxed = false;
+        curr_addr = used_cc_base;
+        for(SIZE idx = 0; idx<rbbl_array_size; idx++){
+            RandomBBL *rbbl = (RandomBBL*)rbbl_array[idx];
+            RBBL_PLACEMENT &placement = placements[idx];
+            S_ADDRX next_addr = curr_addr + placement.place_size + placement.padding_num;
+            if(placement.tail_idx>=0 && !placement.is_relaxed){
+                S_ADDRX target_addr = rbbl_addrs[rbbl->get_reloc_slot(placement.tail_idx)];
+                INT64 offset64 = (INT64)target_addr - (INT64)(curr_addr + placement.place_size - placement.relaxed_size);
+                if(offset64>=-128 && offset64<=127){
+                    placement.place_size -= placement.relaxed_size;
+                    placement.is_relaxed = true;
+                    has_relaxed = true;
+                    relaxed_num++;
+                }
+            }
+            curr_addr = next_addr;
+        }
+    }
+    return relaxed_num;
+}
+
 #include <fstream>
 #include <iomanip>
 
@@ -775,17 +1099,19 @@ void close_os(std::ofstream &os)
     os.close();
 }
 
-void CodeVariantManager::relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, S_ADDRX cc_base, \
-    RBBL_CC_MAPS &rbbl_maps, JMPIN_CC_OFFSET &jmpin_rbbl_offsets)
+void CodeVariantManager::relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, SIZE start_idx, SIZE end_idx, S_ADDRX cc_base, \
+    RBBL_CC_ADDRS &rbbl_addrs, JMPIN_CC_OFFSET &jmpin_rbbl_offsets)
 {/*
     std::ofstream os;
-    if(cc_base==_cc1_base)
+    if(cc_base==_cvs[0].cc_base)
         open_os(_elf_real_name, os);
    */ 
-    for(CC_LAYOUT::iterator iter = cc_layout.begin(); iter!=cc_layout.end(); iter++){
-        S_ADDRX range_base_addr = iter->first.low();
-        S_SIZE range_size = iter->first.high() - range_base_addr + 1;
-        switch(iter->second){
+    ASSERT(start_idx<=end_idx && end_idx<=cc_layout.size());
+    for(SIZE idx = start_idx; idx<end_idx; idx++){
+        const CC_LAYOUT::ENTRY &entry = cc_layout[idx];
+        S_ADDRX range_base_addr = entry.low;
+        S_SIZE range_size = entry.high - range_base_addr + 1;
+        switch(entry.ptr){
             case BOUNDARY_PTR: break;
             case INV_TRAMP_PTR: break;
             case TRAMP_JMP8_PTR: ASSERT(range_size>=JMP8_LEN); break;//has already relocated, when generate the jmp rel8
@@ -795,12 +1121,11 @@ void CodeVariantManager::relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, S_ADDRX
                     ASSERT(range_size>=JMP32_LEN);
                     S_ADDRX relocate_addr = range_base_addr + 0x1;//opcode
                     S_ADDRX curr_pc = range_base_addr + JMP32_LEN;
-                    F_SIZE target_rbbl_offset = (F_SIZE)(*(INT32*)relocate_addr);
-                    RBBL_CC_MAPS::iterator ret = rbbl_maps.find(target_rbbl_offset);
-                    ASSERT(ret!=rbbl_maps.end());
-                    S_ADDRX target_rbbl_addr = ret->second;
+                    RBBL_SLOT target_slot = (RBBL_SLOT)(*(INT32*)relocate_addr);
+                    ASSERT(target_slot<=get_invalid_slot());
+                    S_ADDRX target_rbbl_addr = rbbl_addrs[target_slot];
                     
-                   // if(cc_base==_cc1_base)
+                   // if(cc_base==_cvs[0].cc_base)
                    //     record_fixed_bbl_pos(os, target_rbbl_addr-cc_base);
                     
                     INT64 offset64 = target_rbbl_addr - curr_pc;
@@ -811,30 +1136,29 @@ void CodeVariantManager::relocate_rbbls_and_tramps(CC_LAYOUT &cc_layout, S_ADDRX
             case MAIN_JMP_TABLE:
                 {
                     ASSERT(range_size==sizeof(F_SIZE));
-                    F_SIZE target_rbbl_offset = *(F_SIZE*)range_base_addr;
-                    RBBL_CC_MAPS::iterator ret = rbbl_maps.find(target_rbbl_offset);
-                    ASSERT(ret!=rbbl_maps.end());
-                    P_ADDRX target_rbbl_addr = ret->second - cc_base + _org_x_load_base + _cc_offset;
+                    RBBL_SLOT target_slot = (RBBL_SLOT)(*(F_SIZE*)range_base_addr);
+                    ASSERT(target_slot<=get_invalid_slot());
+                    P_ADDRX target_rbbl_addr = rbbl_addrs[target_slot] - cc_base + _org_x_load_base + _cc_offset;
                     *(S_ADDRX*)range_base_addr = target_rbbl_addr;
                 }
                 break;
             default://rbbl
                 {
-                    RandomBBL *rbbl = (RandomBBL*)iter->second;
+                    RandomBBL *rbbl = (RandomBBL*)entry.ptr;
                     F_SIZE rbbl_offset = rbbl->get_rbbl_offset();
                     JMPIN_CC_OFFSET::iterator ret = jmpin_rbbl_offsets.find(rbbl_offset);
                     P_SIZE jmpin_offset = ret!=jmpin_rbbl_offsets.end() ? ret->second : 0;//judge is switch case or not
                     rbbl->gen_code(cc_base, range_base_addr, range_size, _org_x_load_base, _cc_offset, _ss_offset, _gs_base, \
-                        _ss_type, rbbl_maps, jmpin_offset);
+                        _ss_type, &rbbl_addrs[0], jmpin_offset);
                 }
         }
     }
     
-   // if(cc_base==_cc1_base)
+   // if(cc_base==_cvs[0].cc_base)
    //     close_os(os);
 }
 
-void CodeVariantManager::create_ss(P_SIZE ss_size, std::string ss_shm_path)
+void CodeVariantManager::create_ss(P_SIZE ss_size, std::string ss_shm_path, P_ADDRX ss_load_end)
 {
 	S_SIZE map_size;
 	S_ADDRX map_start;
@@ -842,7 +1166,7 @@ void CodeVariantManager::create_ss(P_SIZE ss_size, std::string ss_shm_path)
 	INT32 ss_fd = map_shm_file(ss_shm_file, map_start, map_size);
 	ASSERT(map_size==ss_size);
     S_SIZE ss_base = map_start + map_size;
-	SS_INFO ss_info = {ss_base, map_size, ss_fd, ss_shm_file};
+	SS_INFO ss_info = {ss_base, map_size, ss_load_end, ss_fd, ss_shm_file};
     _ss_maps.insert(std::make_pair(ss_shm_file, ss_info));
 }
 
@@ -865,8 +1189,7 @@ void CodeVariantManager::handle_dlopen(P_ADDRX orig_x_base, P_ADDRX orig_x_end,
 {
     handle_directory_path(db_path);
     //1.wait for all ready
-    wait_for_code_variant_ready(true);
-    wait_for_code_variant_ready(false);
+    wait_for_all_code_variants_ready();
     //2.pause gen code variants
     pause_gen_code_variants();
     //3.init cvm and generate code variant
@@ -877,8 +1200,13 @@ void CodeVariantManager::handle_dlopen(P_ADDRX orig_x_base, P_ADDRX orig_x_end,
     cvm->set_x_load_base(orig_x_base, orig_x_end - orig_x_base);
     cvm->set_cc_load_info(cc_base, cc_size, get_real_name_from_path(shm_path));
     cvm->init_cc();
-    cvm->generate_code_variant(true);
-    cvm->generate_code_variant(false);
+    update_range_index();
+    cvm->init_hot_rbbus();
+    std::vector<CodeVariantManager*> cvms(1, cvm);
+    for(UINT32 cv_id = 0; cv_id<Options::_cv_num; cv_id++)
+        generate_code_variants(cvms, cv_id);
+    for(UINT32 cv_id = 0; cv_id<Options::_cv_num; cv_id++)
+        cvm->build_pc_translation(get_prev_cv(cv_id), cv_id);
     //4.continue 
     continue_gen_code_variants();
 }
@@ -895,88 +1223,161 @@ void CodeVariantManager::free_a_cvm(std::string name, std::string shm_path)
 void CodeVariantManager::handle_dlclose(std::string lib_name, std::string shm_path)
 {
     //1.wait for all ready
-    wait_for_code_variant_ready(true);
-    wait_for_code_variant_ready(false);
+    wait_for_all_code_variants_ready();
     //2.pause gen code variants
     pause_gen_code_variants();
     //3.munmap cvm
     ASSERTM(CodeVariantManager::is_added(lib_name), "Should not be handled!\n");
     free_a_cvm(lib_name, shm_path);
+    update_range_index();
     //4.continue
     continue_gen_code_variants();
 }
 
-void CodeVariantManager::clean_cc(BOOL is_first_cc)
+static void fill_byte_non_temporal(S_ADDRX start, S_ADDRX end, UINT8 value)
 {
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    S_ADDRX place_addr = cc_base;
-    std::string invalid_instr = InstrGenerator::gen_invalid_instr();
-    S_SIZE instr_len = invalid_instr.length();
-    S_ADDRX cc_end = cc_base + _cc_load_size - instr_len;
-
-    while(place_addr<=cc_end){
-        invalid_instr.copy((char*)place_addr, instr_len);
-        place_addr += instr_len;
+    //1. fill the unaligned head
+    while(start<end && (start&0xf)!=0)
+        *(UINT8*)start++ = value;
+    //2. fill 64 bytes in each loop by streaming stores, the filled bytes do not pollute the cache
+    __m128i pattern = _mm_set1_epi8((char)value);
+    while(start + 64<=end){
+        _mm_stream_si128((__m128i*)start, pattern);
+        _mm_stream_si128((__m128i*)(start + 16), pattern);
+        _mm_stream_si128((__m128i*)(start + 32), pattern);
+        _mm_stream_si128((__m128i*)(start + 48), pattern);
+        start += 64;
+    }
+    while(start + 16<=end){
+        _mm_stream_si128((__m128i*)start, pattern);
+        start += 16;
     }
+    //3. fill the tail and order the streaming stores before the relocation
+    while(start<end)
+        *(UINT8*)start++ = value;
+    _mm_sfence();
+}
+
+void CodeVariantManager::clean_cc(UINT32 cv_id)
+{
+    CODE_VARIANT &cv = _cvs[cv_id];
+    std::string invalid_instr = InstrGenerator::gen_invalid_instr();
+    FATAL(invalid_instr.length()!=1, "invalid instruction should be one byte!\n");
+    //only [cc_base, cc_dirty_end) is used by the consumed code variants, the others are still invalid instructions
+    fill_byte_non_temporal(cv.cc_base, cv.cc_dirty_end, (UINT8)invalid_instr[0]);
+    cv.cc_dirty_end = cv.cc_base;
     return ;
 }
 
-void CodeVariantManager::generate_code_variant(BOOL is_first_cc)
+void CodeVariantManager::arrange_code_variant(UINT32 cv_id)
 {
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    CC_LAYOUT &cc_layout = is_first_cc ? _cc_layout1 : _cc_layout2;
-    RBBL_CC_MAPS &rbbl_maps = is_first_cc ? _rbbl_maps1 : _rbbl_maps2;
-    JMPIN_CC_OFFSET &jmpin_rbbl_offsets = is_first_cc ? _jmpin_rbbl_offsets1 : _jmpin_rbbl_offsets2;
-    S_ADDRX &cc_used_base = is_first_cc ? _cc1_used_base : _cc2_used_base;
+    CODE_VARIANT &cv = _cvs[cv_id];
     // 1.clean code cache
 #ifndef USE_CLOSE_CLEAN_CC_OPT    
-    clean_cc(is_first_cc);
+    clean_cc(cv_id);
 #endif
     // 2.arrange the code layout
-    cc_used_base = arrange_cc_layout(cc_base, cc_layout, rbbl_maps, jmpin_rbbl_offsets);
-    // 3.generate the code
-    relocate_rbbls_and_tramps(cc_layout, cc_base, rbbl_maps, jmpin_rbbl_offsets);
+    cv.cc_used_base = arrange_cc_layout(cv);
+    return ;
+}
+
+void CodeVariantManager::relocate_code_variant(UINT32 cv_id, SIZE start_idx, SIZE end_idx)
+{
+    CODE_VARIANT &cv = _cvs[cv_id];
+    relocate_rbbls_and_tramps(cv.cc_layout, start_idx, end_idx, cv.cc_base, cv.rbbl_addrs, cv.jmpin_rbbl_offsets);
     return ;
 }
 
+//relocation chunk is a run of ranges in the arranged layout of one module
 typedef struct{
     CodeVariantManager *cvm;
-    BOOL is_first_cc;
-}THREAD_GCV_ARG;
+    SIZE start_idx;
+    SIZE end_idx;
+}RELOC_CHUNK;
+
+#define RELOC_CHUNK_RANGE_NUM 0x1000
 
-void *CodeVariantManager::thread_gen_code_variant(void *arg)
+static bool is_larger_cvm(CodeVariantManager *cvm_a, CodeVariantManager *cvm_b)
 {
-    THREAD_GCV_ARG *thread_arg = (THREAD_GCV_ARG*)arg;
-    thread_arg->cvm->generate_code_variant(thread_arg->is_first_cc);
-    
-    return NULL;
+    return cvm_a->get_rbbl_num()>cvm_b->get_rbbl_num();
 }
 
-void CodeVariantManager::generate_all_code_variant(BOOL is_first_cc)
+static bool is_larger_chunk(const RELOC_CHUNK &chunk_a, const RELOC_CHUNK &chunk_b)
 {
-    INT32 thread_sum = _all_cvm_maps.size();
-    INT32 thread_idx = 0;
-    pthread_t *thread = new pthread_t[thread_sum];
-    THREAD_GCV_ARG *args = new THREAD_GCV_ARG[thread_sum];
-    
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++, thread_idx++){
-        args[thread_idx].cvm = iter->second;
-        args[thread_idx].is_first_cc = is_first_cc;
-        pthread_create(&thread[thread_idx], NULL, thread_gen_code_variant, (void*)&args[thread_idx]);
+    return (chunk_a.end_idx - chunk_a.start_idx)>(chunk_b.end_idx - chunk_b.start_idx);
+}
+
+static void arrange_a_cvm(CodeVariantManager *cvm, void *arg)
+{
+    UINT64 start = LatencyStats::is_enabled() ? LatencyStats::get_time_ns() : 0;
+    cvm->arrange_code_variant(*(UINT32*)arg);
+    if(LatencyStats::is_enabled())
+        cvm->add_gen_time(LatencyStats::get_time_ns() - start);
+}
+
+static void relocate_a_chunk(RELOC_CHUNK chunk, void *arg)
+{
+    UINT64 start = LatencyStats::is_enabled() ? LatencyStats::get_time_ns() : 0;
+    chunk.cvm->relocate_code_variant(*(UINT32*)arg, chunk.start_idx, chunk.end_idx);
+    if(LatencyStats::is_enabled())
+        chunk.cvm->add_gen_time(LatencyStats::get_time_ns() - start);
+}
+
+void CodeVariantManager::generate_code_variants(std::vector<CodeVariantManager*> cvms, UINT32 cv_id)
+{
+    //1. arrange the layouts, the layout of one module is arranged by one worker
+    std::stable_sort(cvms.begin(), cvms.end(), is_larger_cvm);
+    WorkerPool::run(cvms, arrange_a_cvm, (void*)&cv_id);
+    //2. ranges of the arranged layouts are independent, so the layouts are split into chunks and relocated 
+    //   concurrently, large modules (libc or the main executable) are relocated by multiple threads
+    std::vector<RELOC_CHUNK> chunks;
+    for(std::vector<CodeVariantManager*>::iterator iter = cvms.begin(); iter!=cvms.end(); iter++){
+        SIZE range_num = (*iter)->get_cc_layout_size(cv_id);
+        for(SIZE start_idx = 0; start_idx<range_num; start_idx += RELOC_CHUNK_RANGE_NUM){
+            SIZE end_idx = start_idx + RELOC_CHUNK_RANGE_NUM;
+            RELOC_CHUNK chunk = {*iter, start_idx, end_idx<range_num ? end_idx : range_num};
+            chunks.push_back(chunk);
+        }
     }
+    std::stable_sort(chunks.begin(), chunks.end(), is_larger_chunk);
+    WorkerPool::run(chunks, relocate_a_chunk, (void*)&cv_id);
+    if(LatencyStats::is_enabled()){
+        //3. record the eliminated jmps and relaxed branches of the code variant
+        UINT64 counters[LatencyStats::LAYOUT_COUNTER_NUM] = {0};
+        for(std::vector<CodeVariantManager*>::iterator iter = cvms.begin(); iter!=cvms.end(); iter++){
+            counters[LatencyStats::LAYOUT_RBBL_NUM] += (*iter)->get_rbbl_num();
+            counters[LatencyStats::LAYOUT_REDUCED_JMP_NUM] += (*iter)->get_reduced_jmp_num(cv_id);
+            counters[LatencyStats::LAYOUT_RELAXED_BR_NUM] += (*iter)->get_relaxed_br_num(cv_id);
+            counters[LatencyStats::LAYOUT_TAIL_BR_NUM] += (*iter)->get_tail_br_num(cv_id);
+            counters[LatencyStats::LAYOUT_RELAXED_BYTES] += (*iter)->get_relaxed_bytes(cv_id);
+        }
+        LatencyStats::record_layout(counters);
+        //4. record the generation time of each module
+        for(std::vector<CodeVariantManager*>::iterator iter = cvms.begin(); iter!=cvms.end(); iter++){
+            LatencyStats::record_module((*iter)->_elf_real_name, (*iter)->_gen_time);
+            (*iter)->_gen_time = 0;
+        }
+    }
+    return ;
+}
 
-    for(thread_idx = 0; thread_idx<thread_sum; thread_idx++)
-        pthread_join(thread[thread_idx], NULL);
-            
-    delete []thread;
-    delete []args;
+void CodeVariantManager::generate_all_code_variant(UINT32 cv_id)
+{
+    std::vector<CodeVariantManager*> cvms;
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++)
+        cvms.push_back(iter->second);
+    generate_code_variants(cvms, cv_id);
 
-    patch_all_sigaction_entry(is_first_cc);
+    patch_all_sigaction_entry(cv_id);
     return ;
 }
 
+//the generator and the switcher are synchronized by cv_mutex, ready flags, need_stop and need_pause are only
+//modified under cv_mutex, and cv_cond is broadcasted when any of them is changed
 static BOOL need_stop = false;
 static BOOL need_pause = false;
+static pthread_mutex_t cv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv_cond = PTHREAD_COND_INITIALIZER;
 pthread_t child_thread;
 
 void CodeVariantManager::start_gen_code_variants()
@@ -987,147 +1388,180 @@ void CodeVariantManager::start_gen_code_variants()
 
 void CodeVariantManager::stop_gen_code_variants()
 {
+    pthread_mutex_lock(&cv_mutex);
     need_stop = true;
+    pthread_cond_broadcast(&cv_cond);
+    pthread_mutex_unlock(&cv_mutex);
     pthread_join(child_thread, NULL);
 }
 
 void CodeVariantManager::pause_gen_code_variants()
 {
+    pthread_mutex_lock(&cv_mutex);
     need_pause = true;
+    pthread_mutex_unlock(&cv_mutex);
 }
 
 void CodeVariantManager::continue_gen_code_variants()
 {
+    pthread_mutex_lock(&cv_mutex);
     need_pause = false;
+    pthread_cond_broadcast(&cv_cond);
+    pthread_mutex_unlock(&cv_mutex);
 }
 
-void* CodeVariantManager::generate_code_variant_concurrently(void *arg)
+UINT32 CodeVariantManager::get_unready_cv()
 {
-    while(!need_stop){
-        if(!_is_cv1_ready){
-            generate_all_code_variant(true);
-            _is_cv1_ready = true;
-        }
+    UINT32 cv_id = 0;
+    while(cv_id<Options::_cv_num && _is_cv_ready[cv_id])
+        cv_id++;
+    return cv_id;
+}
 
-        if(!_is_cv2_ready){
-            generate_all_code_variant(false);
-            _is_cv2_ready = true;
-        }
-        
-        while(need_pause)
-            sched_yield();
-        
-        sched_yield();
+UINT32 CodeVariantManager::get_prev_cv(UINT32 cv_id)
+{
+    return (cv_id + Options::_cv_num - 1)%Options::_cv_num;
+}
+
+UINT32 CodeVariantManager::get_next_cv(UINT32 cv_id)
+{
+    return (cv_id + 1)%Options::_cv_num;
+}
+
+void* CodeVariantManager::generate_code_variant_concurrently(void *arg)
+{
+    pthread_mutex_lock(&cv_mutex);
+    while(1){
+        //1. sleep until a code variant is consumed, continued or stopped
+        while(!need_stop && (need_pause || get_unready_cv()==Options::_cv_num))
+            pthread_cond_wait(&cv_cond, &cv_mutex);
+        if(need_stop)
+            break;
+        //2. generate the consumed code variant without holding the lock
+        UINT32 cv_id = get_unready_cv();
+        UINT32 prev_cv_id = get_prev_cv(cv_id);
+        //the previous code variant is only consumed after switching to this one, so it stays ready
+        BOOL prev_is_ready = _is_cv_ready[prev_cv_id];
+        pthread_mutex_unlock(&cv_mutex);
+        UINT64 gen_start = LatencyStats::get_time_ns();
+        generate_all_code_variant(cv_id);
+        if(prev_is_ready)
+            build_all_pc_translation(prev_cv_id, cv_id);
+        LatencyStats::record(LatencyStats::GEN_CV, gen_start, LatencyStats::get_time_ns());
+        //3. publish the code variant and wake up the waiting switcher
+        pthread_mutex_lock(&cv_mutex);
+        _is_cv_ready[cv_id] = true;
+        pthread_cond_broadcast(&cv_cond);
     }
+    pthread_mutex_unlock(&cv_mutex);
     return NULL;
 }
 
-void CodeVariantManager::clear_sighandler(BOOL is_first_cc)
+void CodeVariantManager::clear_sighandler(UINT32 cv_id)
 {
-    for(SIG_HANDLERS::iterator iter = _sig_handlers.begin(); iter!=_sig_handlers.end(); iter++){
-        SIG_INFO &sig_info = iter->second;
-        BOOL &handled = is_first_cc ? sig_info.cv1_handled : sig_info.cv2_handled;
-        handled = false;
-    }
+    for(SIG_HANDLERS::iterator iter = _sig_handlers.begin(); iter!=_sig_handlers.end(); iter++)
+        iter->second.cv_handled[cv_id] = false;
 }
 
-void CodeVariantManager::clear_cv(BOOL is_first_cc)
+void CodeVariantManager::clear_cv(UINT32 cv_id)
 {
-    CC_LAYOUT &cc_layout = is_first_cc ? _cc_layout1 : _cc_layout2;
-    RBBL_CC_MAPS &rbbl_maps = is_first_cc ? _rbbl_maps1 : _rbbl_maps2;
-    JMPIN_CC_OFFSET &jmpin_rbbl_offsets = is_first_cc ? _jmpin_rbbl_offsets1 : _jmpin_rbbl_offsets2;
-    S_ADDRX &cc_used_base = is_first_cc ? _cc1_used_base : _cc2_used_base;
-    S_ADDRX &cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    cc_layout.clear();
-    rbbl_maps.clear();
-    jmpin_rbbl_offsets.clear();
-    cc_used_base = cc_base;
-    clear_sighandler(is_first_cc);
+    CODE_VARIANT &cv = _cvs[cv_id];
+    //record the used range to clean before generating this code variant again
+    if(cv.cc_used_base>cv.cc_dirty_end)
+        cv.cc_dirty_end = cv.cc_used_base;
+    cv.cc_layout.clear();
+    std::fill(cv.rbbl_addrs.begin(), cv.rbbl_addrs.end(), 0);
+    cv.jmpin_rbbl_offsets.clear();
+    cv.cc_used_base = cv.cc_base;
+    //the translations from and to the consumed code variant are stale
+    cv.translation.is_valid = false;
+    _cvs[get_next_cv(cv_id)].translation.is_valid = false;
+    clear_sighandler(cv_id);
 }
 
-void CodeVariantManager::clear_all_cv(BOOL is_first_cc)
+void CodeVariantManager::clear_all_cv(UINT32 cv_id)
 {
     for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++)
-        iter->second->clear_cv(is_first_cc);
+        iter->second->clear_cv(cv_id);
 }
 
-void CodeVariantManager::consume_cv(BOOL is_first_cc)
+void CodeVariantManager::consume_cv(UINT32 cv_id)
 {
     // 1.clear all code variants
-    clear_all_cv(is_first_cc);
-    // 2.clear ready flags
-    if(is_first_cc){
-        ASSERT(_is_cv1_ready);
-        _is_cv1_ready = false;
-    }else{
-        ASSERT(_is_cv2_ready);
-        
-        _is_cv2_ready = false;
-    }
+    clear_all_cv(cv_id);
+    // 2.clear ready flags and wake up the generator
+    pthread_mutex_lock(&cv_mutex);
+    ASSERT(_is_cv_ready[cv_id]);
+    _is_cv_ready[cv_id] = false;
+    pthread_cond_broadcast(&cv_cond);
+    pthread_mutex_unlock(&cv_mutex);
 }
 
-void CodeVariantManager::wait_for_code_variant_ready(BOOL is_first_cc)
+void CodeVariantManager::wait_for_code_variant_ready(UINT32 cv_id)
 {
-    BOOL &is_ready = is_first_cc ? _is_cv1_ready : _is_cv2_ready;
-    while(!is_ready)
-        sched_yield();
+    pthread_mutex_lock(&cv_mutex);
+    while(!_is_cv_ready[cv_id])
+        pthread_cond_wait(&cv_cond, &cv_mutex);
+    pthread_mutex_unlock(&cv_mutex);
+}
+
+void CodeVariantManager::wait_for_all_code_variants_ready()
+{
+    pthread_mutex_lock(&cv_mutex);
+    while(get_unready_cv()!=Options::_cv_num)
+        pthread_cond_wait(&cv_cond, &cv_mutex);
+    pthread_mutex_unlock(&cv_mutex);
 }
 
 void CodeVariantManager::check_double_cv()
 {
-    //debug check 
+    //debug check, trampolines and fixed rbbls of all code variants should be the same
     for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        ASSERT(iter->second->_cc1_used_base==iter->second->_cc1_used_base);
-        S_ADDRX *ptr1 = (S_ADDRX*)iter->second->_cc1_base;
-        S_ADDRX *ptr2 = (S_ADDRX*)iter->second->_cc2_base;
-        while((S_ADDRX)ptr1<=iter->second->_cc1_used_base){
-            ASSERT(*ptr1==*ptr2);
-            ptr1++;
-            ptr2++;
+        CODE_VARIANT *cvs = iter->second->_cvs;
+        for(UINT32 cv_id = 1; cv_id<Options::_cv_num; cv_id++){
+            S_ADDRX *ptr1 = (S_ADDRX*)cvs[0].cc_base;
+            S_ADDRX *ptr2 = (S_ADDRX*)cvs[cv_id].cc_base;
+            while((S_ADDRX)ptr1<=cvs[0].cc_used_base){
+                ASSERT(*ptr1==*ptr2);
+                ptr1++;
+                ptr2++;
+            }
         }
     }
 }
 
-RandomBBL *CodeVariantManager::find_rbbl_from_all_paddrx(P_ADDRX p_addr, BOOL is_first_cc)
+RandomBBL *CodeVariantManager::find_rbbl_from_all_paddrx(P_ADDRX p_addr, UINT32 cv_id)
 {
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        RandomBBL *rbbl = iter->second->find_rbbl_from_paddrx(p_addr, is_first_cc);
-        if(rbbl)
-            return rbbl;
-    }
-    return NULL;
+    CodeVariantManager *cvm = find_cvm_from_index(_cc_range_index, p_addr);
+    return cvm ? cvm->find_rbbl_from_paddrx(p_addr, cv_id) : NULL;
 }
 
-RandomBBL *CodeVariantManager::find_rbbl_from_all_saddrx(S_ADDRX s_addr, BOOL is_first_cc)
+RandomBBL *CodeVariantManager::find_rbbl_from_all_saddrx(S_ADDRX s_addr, UINT32 cv_id)
 {
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        RandomBBL *rbbl = iter->second->find_rbbl_from_saddrx(s_addr, is_first_cc);
-        if(rbbl)
-            return rbbl;
-    }
-    return NULL;
+    CodeVariantManager *cvm = find_cvm_from_index(_cc_map_range_index, s_addr);
+    return cvm ? cvm->find_rbbl_from_saddrx(s_addr, cv_id) : NULL;
 }
 
-RandomBBL *CodeVariantManager::find_rbbl_from_paddrx(P_ADDRX p_addr, BOOL is_first_cc)
+RandomBBL *CodeVariantManager::find_rbbl_from_paddrx(P_ADDRX p_addr, UINT32 cv_id)
 {
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
+    S_ADDRX cc_base = _cvs[cv_id].cc_base;
     
     if(p_addr>=_cc_load_base && p_addr<(_cc_load_base+_cc_load_size))
-        return find_rbbl_from_saddrx(p_addr - _cc_load_base + cc_base, is_first_cc);
+        return find_rbbl_from_saddrx(p_addr - _cc_load_base + cc_base, cv_id);
     else
         return NULL;
 }
 
-RandomBBL *CodeVariantManager::find_rbbl_from_saddrx(S_ADDRX s_addr, BOOL is_first_cc)
+RandomBBL *CodeVariantManager::find_rbbl_from_saddrx(S_ADDRX s_addr, UINT32 cv_id)
 {
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    CC_LAYOUT &cc_layout = is_first_cc ? _cc_layout1 : _cc_layout2;
+    S_ADDRX cc_base = _cvs[cv_id].cc_base;
+    CC_LAYOUT &cc_layout = _cvs[cv_id].cc_layout;
 
     if(s_addr>=cc_base && s_addr<(cc_base+_cc_load_size)){
-        CC_LAYOUT_ITER iter = cc_layout.upper_bound(Range<S_ADDRX>(s_addr));
-        if(iter!=cc_layout.end() && s_addr<=(--iter)->first.high() && s_addr>=iter->first.low()){
-            S_ADDRX ptr = iter->second;
-            S_ADDRX start = iter->first.low();
+        const CC_LAYOUT::ENTRY *entry = cc_layout.find_cover(s_addr);
+        if(entry){
+            S_ADDRX ptr = entry->ptr;
+            S_ADDRX start = entry->low;
             switch(ptr){
                 case BOUNDARY_PTR: return NULL;
                 case TRAMP_JMP8_PTR: 
@@ -1137,7 +1571,7 @@ RandomBBL *CodeVariantManager::find_rbbl_from_saddrx(S_ADDRX s_addr, BOOL is_fir
                         ASSERT(*(UINT8*)start==JMP8_OPCODE);    
                         INT8 offset8 = *(INT8*)(start+OFFSET_POS);
                         S_ADDRX target_addr = s_addr + JMP8_LEN + offset8;    
-                        return find_rbbl_from_saddrx(target_addr, is_first_cc);
+                        return find_rbbl_from_saddrx(target_addr, cv_id);
                     }
                 case TRAMP_OVERLAP_JMP32_PTR: ASSERT(0); return NULL;
                 case TRAMP_JMP32_PTR://need relocate the trampolines
@@ -1147,7 +1581,7 @@ RandomBBL *CodeVariantManager::find_rbbl_from_saddrx(S_ADDRX s_addr, BOOL is_fir
                         ASSERT(*(UINT8*)start==JMP32_OPCODE);    
                         INT32 offset32 = *(INT32*)(start+OFFSET_POS);
                         S_ADDRX target_addr = s_addr + JMP32_LEN + offset32;
-                        return find_rbbl_from_saddrx(target_addr, is_first_cc);
+                        return find_rbbl_from_saddrx(target_addr, cv_id);
                     }
                 default://rbbl
                     return (RandomBBL*)ptr;
@@ -1158,112 +1592,176 @@ RandomBBL *CodeVariantManager::find_rbbl_from_saddrx(S_ADDRX s_addr, BOOL is_fir
         return NULL;
 }
 
-P_ADDRX CodeVariantManager::find_cc_paddrx_from_all_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc)
+P_ADDRX CodeVariantManager::find_cc_paddrx_from_all_orig(P_ADDRX orig_p_addrx, UINT32 cv_id)
 {
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        P_ADDRX ret_addrx = iter->second->find_cc_paddrx_from_orig(orig_p_addrx, is_first_cc);
-        if(ret_addrx!=0)
-            return ret_addrx;
-    }
-    return 0;
+    CodeVariantManager *cvm = find_cvm_from_index(_x_range_index, orig_p_addrx);
+    return cvm ? cvm->find_cc_paddrx_from_orig(orig_p_addrx, cv_id) : 0;
 }
 
-S_ADDRX CodeVariantManager::find_cc_saddrx_from_all_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc)
+S_ADDRX CodeVariantManager::find_cc_saddrx_from_all_orig(P_ADDRX orig_p_addrx, UINT32 cv_id)
 {
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        P_ADDRX ret_addrx = iter->second->find_cc_saddrx_from_orig(orig_p_addrx, is_first_cc);
-        if(ret_addrx!=0)
-            return ret_addrx;
-    }
-    return 0;
+    CodeVariantManager *cvm = find_cvm_from_index(_x_range_index, orig_p_addrx);
+    return cvm ? cvm->find_cc_saddrx_from_orig(orig_p_addrx, cv_id) : 0;
 }
 
-S_ADDRX CodeVariantManager::find_cc_saddrx_from_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc)
+S_ADDRX CodeVariantManager::find_cc_saddrx_from_orig(P_ADDRX orig_p_addrx, UINT32 cv_id)
 {
-    RBBL_CC_MAPS &rbbl_maps = is_first_cc ? _rbbl_maps1 : _rbbl_maps2;
+    RBBL_CC_ADDRS &rbbl_addrs = _cvs[cv_id].rbbl_addrs;
     F_SIZE pc_size = orig_p_addrx - _org_x_load_base;
     if(pc_size<_org_x_load_size){
-        RBBL_CC_MAPS::iterator iter = rbbl_maps.find(pc_size);
-        return iter!=rbbl_maps.end() ? iter->second : 0;
+        RBBL_SLOT slot = get_slot_from_offset(pc_size);
+        return slot!=get_invalid_slot() ? rbbl_addrs[slot] : 0;
     }else
         return 0;
 }
 
-P_ADDRX CodeVariantManager::find_cc_paddrx_from_orig(P_ADDRX orig_p_addrx, BOOL is_first_cc)
+P_ADDRX CodeVariantManager::find_cc_paddrx_from_orig(P_ADDRX orig_p_addrx, UINT32 cv_id)
 {
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    S_ADDRX ret_addrx = find_cc_saddrx_from_orig(orig_p_addrx, is_first_cc);
+    S_ADDRX cc_base = _cvs[cv_id].cc_base;
+    S_ADDRX ret_addrx = find_cc_saddrx_from_orig(orig_p_addrx, cv_id);
     return ret_addrx!=0 ? (ret_addrx - cc_base + _cc_load_base) : 0;
 }
 
-P_ADDRX CodeVariantManager::find_cc_paddrx_from_rbbl(RandomBBL *rbbl, BOOL is_first_cc)
+P_ADDRX CodeVariantManager::find_cc_paddrx_from_rbbl(RandomBBL *rbbl, UINT32 cv_id)
 {
-    RBBL_CC_MAPS &rbbl_maps = is_first_cc ? _rbbl_maps1 : _rbbl_maps2;    
-    CC_LAYOUT &cc_layout = is_first_cc ? _cc_layout1 : _cc_layout2;
+    RBBL_CC_ADDRS &rbbl_addrs = _cvs[cv_id].rbbl_addrs;    
+    CC_LAYOUT &cc_layout = _cvs[cv_id].cc_layout;
     F_SIZE rbbl_offset = rbbl->get_rbbl_offset();
-    S_ADDRX cc_base = is_first_cc ? _cc1_base : _cc2_base;
-    
-    RBBL_CC_MAPS::iterator iter = rbbl_maps.find(rbbl_offset);
-    if(iter!=rbbl_maps.end()){
-        S_ADDRX s_addrx = iter->second;
-        CC_LAYOUT_ITER it = cc_layout.lower_bound(Range<S_ADDRX>(s_addrx));
-        return (it!=cc_layout.end())&&(it->second==(S_ADDRX)rbbl)? (_cc_load_base + s_addrx - cc_base) : 0; 
+    S_ADDRX cc_base = _cvs[cv_id].cc_base;
+    //rbbl may belong to the other cvm, so the slot is searched by offset
+    RBBL_SLOT slot = get_slot_from_offset(rbbl_offset);
+    if(slot!=get_invalid_slot() && rbbl_addrs[slot]!=0){
+        S_ADDRX s_addrx = rbbl_addrs[slot];
+        SIZE idx = cc_layout.lower_bound(s_addrx);
+        return (idx<cc_layout.size())&&(cc_layout[idx].ptr==(S_ADDRX)rbbl)? (_cc_load_base + s_addrx - cc_base) : 0; 
     }else
         return 0;
 }
 
-P_ADDRX CodeVariantManager::find_cc_paddrx_from_all_rbbls(RandomBBL *rbbl, BOOL is_first_cc)
+P_ADDRX CodeVariantManager::find_cc_paddrx_from_all_rbbls(RandomBBL *rbbl, UINT32 cv_id)
 {
     for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        P_ADDRX ret_addrx = iter->second->find_cc_paddrx_from_rbbl(rbbl, is_first_cc);
+        P_ADDRX ret_addrx = iter->second->find_cc_paddrx_from_rbbl(rbbl, cv_id);
         if(ret_addrx!=0)
             return ret_addrx;
     }
     return 0;
 }
 
-P_ADDRX CodeVariantManager::get_new_pc_from_old(P_ADDRX old_pc, BOOL first_cc_is_new)
+static bool is_lower_run(const CodeVariantManager::PC_RUN &run, UINT32 offset)
+{
+    return run.old_offset + run.len<=offset;
+}
+
+void CodeVariantManager::build_pc_translation(UINT32 old_cv_id, UINT32 new_cv_id)
+{
+    CODE_VARIANT &old_cv = _cvs[old_cv_id];
+    CODE_VARIANT &new_cv = _cvs[new_cv_id];
+    PC_TRANSLATION &translation = new_cv.translation;
+    translation.runs.clear();
+    //1. rbbls of the old layout are sorted, so the runs are sorted by old_offset
+    for(SIZE idx = 0; idx<old_cv.cc_layout.size(); idx++){
+        const CC_LAYOUT::ENTRY &entry = old_cv.cc_layout[idx];
+        if(entry.ptr<RBBL_PTR_MIN)
+            continue;
+        RandomBBL *rbbl = (RandomBBL*)entry.ptr;
+        S_ADDRX new_rbbl_addr = new_cv.rbbl_addrs[rbbl->get_slot()];
+        ASSERT(new_rbbl_addr!=0);
+        PC_RUN run = {(UINT32)(entry.low - old_cv.cc_base), (UINT32)(entry.high - entry.low + 1), \
+            (UINT32)(new_rbbl_addr - new_cv.cc_base)};
+        //2. merge the rbbls which are adjacent in both code variants
+        if(!translation.runs.empty()){
+            PC_RUN &last = translation.runs.back();
+            if(last.old_offset + last.len==run.old_offset && last.new_offset + last.len==run.new_offset){
+                last.len += run.len;
+                continue;
+            }
+        }
+        translation.runs.push_back(run);
+    }
+    translation.old_cv_id = old_cv_id;
+    translation.is_valid = true;
+}
+
+void CodeVariantManager::build_all_pc_translation(UINT32 old_cv_id, UINT32 new_cv_id)
+{
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++)
+        iter->second->build_pc_translation(old_cv_id, new_cv_id);
+}
+
+void CodeVariantManager::prepare_pc_translation(UINT32 curr_cv_id)
+{
+    UINT32 next_cv_id = get_next_cv(curr_cv_id);
+    pthread_mutex_lock(&cv_mutex);
+    BOOL next_is_ready = _is_cv_ready[next_cv_id];
+    pthread_mutex_unlock(&cv_mutex);
+    //the generator builds the translation before publishing the next code variant if the current one is ready,
+    //otherwise the translation is built here, ready code variants are only consumed by the switcher
+    if(!next_is_ready)
+        return ;
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
+        PC_TRANSLATION &translation = iter->second->_cvs[next_cv_id].translation;
+        if(!translation.is_valid || translation.old_cv_id!=curr_cv_id)
+            iter->second->build_pc_translation(curr_cv_id, next_cv_id);
+    }
+}
+
+P_ADDRX CodeVariantManager::translate_pc(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id)
 {
-    RandomBBL *rbbl = find_rbbl_from_paddrx(old_pc, first_cc_is_new ? false : true);
+    PC_TRANSLATION &translation = _cvs[new_cv_id].translation;
+    if(!translation.is_valid || translation.old_cv_id!=old_cv_id)
+        return 0;
+    if(old_pc<_cc_load_base || old_pc>=_cc_load_base + _cc_load_size)
+        return 0;
+    UINT32 old_offset = (UINT32)(old_pc - _cc_load_base);
+    std::vector<PC_RUN>::iterator iter = std::lower_bound(translation.runs.begin(), translation.runs.end(), \
+        old_offset, is_lower_run);
+    if(iter==translation.runs.end() || iter->old_offset>old_offset)
+        return 0;
+    return _cc_load_base + iter->new_offset + (old_offset - iter->old_offset);
+}
+
+P_ADDRX CodeVariantManager::get_new_pc_from_old(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id)
+{
+    //1. pcs in rbbls are translated by the precomputed runs
+    P_ADDRX new_pc = translate_pc(old_pc, old_cv_id, new_cv_id);
+    if(new_pc!=0)
+        return new_pc;
+    //2. pcs in trampolines or without translation are translated by the layouts
+    RandomBBL *rbbl = find_rbbl_from_paddrx(old_pc, old_cv_id);
     if(rbbl){
         //get old and new code variant information
-        RBBL_CC_MAPS &old_rbbl_maps = first_cc_is_new ? _rbbl_maps2 : _rbbl_maps1;
-        RBBL_CC_MAPS &new_rbbl_maps = first_cc_is_new ? _rbbl_maps1 : _rbbl_maps2;
-        S_ADDRX old_cc_base = first_cc_is_new ? _cc2_base : _cc1_base;
-        S_ADDRX new_cc_base = first_cc_is_new ? _cc1_base : _cc2_base;
+        RBBL_CC_ADDRS &old_rbbl_addrs = _cvs[old_cv_id].rbbl_addrs;
+        RBBL_CC_ADDRS &new_rbbl_addrs = _cvs[new_cv_id].rbbl_addrs;
+        S_ADDRX old_cc_base = _cvs[old_cv_id].cc_base;
+        S_ADDRX new_cc_base = _cvs[new_cv_id].cc_base;
         //get old rbbl offset
-        RBBL_CC_MAPS::iterator it = old_rbbl_maps.find(rbbl->get_rbbl_offset());
-        ASSERT(it!=old_rbbl_maps.end());
+        RBBL_SLOT slot = rbbl->get_slot();
+        ASSERT(old_rbbl_addrs[slot]!=0);
         S_ADDRX old_pc_saddrx = old_pc - _cc_load_base + old_cc_base;
-        S_SIZE rbbl_internal_offset = old_pc_saddrx - it->second;
+        S_SIZE rbbl_internal_offset = old_pc_saddrx - old_rbbl_addrs[slot];
         //get new rbbl saddrx
-        it = new_rbbl_maps.find(rbbl->get_rbbl_offset());
-        ASSERT(it!=new_rbbl_maps.end());
-        S_ADDRX new_pc_saddrx = it->second + rbbl_internal_offset;
+        ASSERT(new_rbbl_addrs[slot]!=0);
+        S_ADDRX new_pc_saddrx = new_rbbl_addrs[slot] + rbbl_internal_offset;
         return new_pc_saddrx - new_cc_base + _cc_load_base;
     }else
         return 0;
 }
 
-P_ADDRX CodeVariantManager::get_new_pc_from_old_all(P_ADDRX old_pc, BOOL first_cc_is_new)
+P_ADDRX CodeVariantManager::get_new_pc_from_old_all(P_ADDRX old_pc, UINT32 old_cv_id, UINT32 new_cv_id)
 {
-    ASSERT(_is_cv1_ready&&_is_cv2_ready);
-
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        P_ADDRX new_pc = iter->second->get_new_pc_from_old(old_pc, first_cc_is_new);
-        if(new_pc!=0)
-            return new_pc;                
-    }
-    
-    return 0;
+    ASSERT(_is_cv_ready[old_cv_id] && _is_cv_ready[new_cv_id]);
+    //the shadow stack patching calls it for each live slot, so the cvm is found by the index
+    CodeVariantManager *cvm = find_cvm_from_index(_cc_range_index, old_pc);
+    return cvm ? cvm->get_new_pc_from_old(old_pc, old_cv_id, new_cv_id) : 0;
 }
 
 void CodeVariantManager::patch_new_pc(long new_ips[MAX_STOP_NUM], long old_ips[MAX_STOP_NUM],\
-    BOOL first_cc_is_new)
+    UINT32 old_cv_id, UINT32 new_cv_id)
 {
     for(INT32 idx = 0; idx<MAX_STOP_NUM; idx++){
         if(old_ips[idx]!=0)
-            new_ips[idx] = get_new_pc_from_old_all(old_ips[idx], first_cc_is_new);
+            new_ips[idx] = get_new_pc_from_old_all(old_ips[idx], old_cv_id, new_cv_id);
         else
             new_ips[idx] = 0;
     }
@@ -1271,21 +1769,28 @@ void CodeVariantManager::patch_new_pc(long new_ips[MAX_STOP_NUM], long old_ips[M
 }
 
 typedef struct{
-    BOOL first_cc_is_new;
     S_ADDRX start_ptr;
     S_ADDRX end;
-}THREAD_PRA_ARG;
+}SS_PATCH_CHUNK;
+
+typedef struct{
+    UINT32 old_cv_id;
+    UINT32 new_cv_id;
+}CV_SWITCH;
+
+#define SS_PATCH_CHUNK_SIZE (1ul<<20)
 
-void *patch_new_ra_in_ss(void *arg)
+static void patch_new_ra_in_ss(SS_PATCH_CHUNK chunk, void *arg)
 {
-    BOOL first_cc_is_new = ((THREAD_PRA_ARG*)arg)->first_cc_is_new;
-    S_ADDRX start_ptr = ((THREAD_PRA_ARG*)arg)->start_ptr;
-    S_ADDRX end = ((THREAD_PRA_ARG*)arg)->end;
+    CV_SWITCH *cv_switch = (CV_SWITCH*)arg;
+    S_ADDRX start_ptr = chunk.start_ptr;
+    S_ADDRX end = chunk.end;
     
     while(start_ptr>=end){
         P_ADDRX old_return_addr = *(P_ADDRX *)start_ptr;
         if(old_return_addr!=0){
-            P_ADDRX new_return_addr = CodeVariantManager::get_new_pc_from_old_all(old_return_addr, first_cc_is_new);
+            P_ADDRX new_return_addr = CodeVariantManager::get_new_pc_from_old_all(old_return_addr, \
+                cv_switch->old_cv_id, cv_switch->new_cv_id);
             if(new_return_addr!=0){
                 //modify old return address to the new return address
                 *(P_ADDRX *)start_ptr = new_return_addr;
@@ -1293,43 +1798,57 @@ void *patch_new_ra_in_ss(void *arg)
         }
         start_ptr -= sizeof(P_ADDRX);
     }
-    return NULL;
 }
 
-void CodeVariantManager::patch_new_ra_in_all_ss(BOOL first_cc_is_new)
+//size of the live frames in the shadow stack, the shadow stacks of processes/threads which are not stopped
+//by the kernel module (or the stack pointers are unknown) are scanned entirely
+static S_SIZE get_live_ss_size(const CodeVariantManager::SS_INFO &info, const std::vector<P_ADDRX> &sps, SIZE ss_offset)
+{
+    if(info.ss_load_end==0)
+        return info.ss_size;
+    P_ADDRX ss_load_start = info.ss_load_end - info.ss_size;
+    S_SIZE live_size = 0;
+    BOOL has_sp = false;
+    //processes share the same shadow stack address after fork, so the deepest stack pointer is used
+    for(std::vector<P_ADDRX>::const_iterator iter = sps.begin(); iter!=sps.end(); iter++){
+        P_ADDRX ss_sp = *iter - ss_offset;
+        if(ss_sp>=ss_load_start && ss_sp<info.ss_load_end){
+            S_SIZE size = info.ss_load_end - ss_sp;
+            live_size = size>live_size ? size : live_size;
+            has_sp = true;
+        }
+    }
+    if(!has_sp)
+        return info.ss_size;
+    //align to the return address slot
+    return (live_size + sizeof(P_ADDRX) - 1) & ~(sizeof(P_ADDRX) - 1);
+}
+
+void CodeVariantManager::patch_new_ra_in_all_ss(UINT32 old_cv_id, UINT32 new_cv_id, long curr_sp, long additional_sps[MAX_STOP_NUM])
 {
     //TODO: we only handle ordinary shadow stack, not shadow stack++
-    ASSERT(_is_cv1_ready && _is_cv2_ready);
-    
-    INT32 ss_num = _ss_maps.size();
-    ASSERT(ss_num>=1);
-    THREAD_PRA_ARG *args = new THREAD_PRA_ARG[ss_num];
+    ASSERT(_is_cv_ready[old_cv_id] && _is_cv_ready[new_cv_id]);
     
-    if(ss_num==1){
-        SS_INFO &info = _ss_maps.begin()->second;
-        args[0].first_cc_is_new = first_cc_is_new;
-        args[0].start_ptr = info.ss_base - sizeof(P_ADDRX);
-        args[0].end = info.ss_base - info.ss_size;
-        patch_new_ra_in_ss((void*)(&args[0]));
-    }else{
-        INT32 idx = 0;
-        pthread_t *thread = new pthread_t[ss_num];
-        //create threads
-        for(SS_MAPS::iterator iter = _ss_maps.begin(); iter!=_ss_maps.end(); iter++, idx++){
-            SS_INFO &info = iter->second;
-            args[idx].first_cc_is_new = first_cc_is_new;
-            args[idx].start_ptr = info.ss_base - sizeof(P_ADDRX);
-            args[idx].end = info.ss_base - info.ss_size;
-            pthread_create(&thread[idx], NULL, patch_new_ra_in_ss, (void*)&args[idx]);
+    ASSERT(_ss_maps.size()>=1);
+    //1. collect the stack pointers of all stopped processes/threads
+    std::vector<P_ADDRX> sps(1, (P_ADDRX)curr_sp);
+    for(INT32 idx = 0; idx<MAX_STOP_NUM; idx++){
+        if(additional_sps[idx]!=0)
+            sps.push_back((P_ADDRX)additional_sps[idx]);
+    }
+    //2. split the live part of shadow stacks into chunks (from the top of each shadow stack) and patch them by the worker pool
+    std::vector<SS_PATCH_CHUNK> chunks;
+    for(SS_MAPS::iterator iter = _ss_maps.begin(); iter!=_ss_maps.end(); iter++){
+        SS_INFO &info = iter->second;
+        S_ADDRX ss_end = info.ss_base - get_live_ss_size(info, sps, _ss_offset);
+        for(S_ADDRX chunk_top = info.ss_base; chunk_top>ss_end; chunk_top -= SS_PATCH_CHUNK_SIZE){
+            S_ADDRX chunk_end = chunk_top - ss_end>SS_PATCH_CHUNK_SIZE ? chunk_top - SS_PATCH_CHUNK_SIZE : ss_end;
+            SS_PATCH_CHUNK chunk = {chunk_top - sizeof(P_ADDRX), chunk_end};
+            chunks.push_back(chunk);
         }
-        //join threads
-        for(idx = 0; idx<ss_num; idx++)
-            pthread_join(thread[idx], NULL);
-
-        delete []thread;
     }
-
-    delete []args;
+    CV_SWITCH cv_switch = {old_cv_id, new_cv_id};
+    WorkerPool::run(chunks, patch_new_ra_in_ss, (void*)&cv_switch, WorkerPool::HIGH_PRIORITY);
 }
 
 BOOL CodeVariantManager::is_added(const std::string elf_path)
@@ -1353,182 +1872,151 @@ void CodeVariantManager::recycle()
     }
 }
 
-/************DB SEG*************/
-/* 32BIT SEG TYPE + 32BIT NUM  */
-/*******************************/
-static UINT32 db_seg_movable = 0;
-static UINT32 db_seg_fixed = 1;
-static UINT32 db_seg_all_jmpin = 2;
-static UINT32 db_seg_main_jump_table = 3;
-//db_seg_jmpin: the offset of jmpin src, it must be larger than 3
-
-static SIZE read_rbbls(S_ADDRX r_addrx, CodeVariantManager *cvm, BOOL is_movable)
+/************DB SECTIONS (v2)**************/
+/* see db_format.h, entry nums are stored */
+/* in the section directory               */
+/******************************************/
+//r_end is the end of the section, the zero-copy db skips the crcs of sections, so each record and table is checked
+//against r_end before it is read
+static SIZE read_rbbls(S_ADDRX r_addrx, S_ADDRX r_end, SIZE rbbl_sum, CodeVariantManager *cvm, BOOL is_movable, BOOL is_view)
 {
     S_ADDRX start_addrx = r_addrx;
-    UINT32 *ptr_32 = NULL;
-    //1. read seg type
-    ptr_32 = (UINT32*)r_addrx;
-    INT32 should_type = is_movable ? db_seg_movable : db_seg_fixed;
-    INT32 seg_type = *ptr_32++;
-    FATAL(should_type!=seg_type, "seg type (%d) is wrong, should be %d!\n", seg_type, should_type);
-    //2. read rbbl num
-    SIZE rbbl_sum = *ptr_32++;
-    r_addrx = (S_ADDRX)ptr_32;
-    //3. store all rbbls
+    //0. each record has its header, table size and template size at least
+    FATAL(rbbl_sum>(r_end-r_addrx)/(2*sizeof(UINT32) + 2*sizeof(UINT8) + 2*sizeof(UINT16)), "rbbl sum %ld exceeds the section!\n", rbbl_sum);
+    //1. views of one section are constructed in one array
+    RandomBBL *views = NULL;
+    if(is_view && rbbl_sum!=0){
+        views = (RandomBBL*)new UINT8[rbbl_sum*sizeof(RandomBBL)];
+        cvm->insert_rbbl_views(views, rbbl_sum);
+    }
+    cvm->reserve_random_bbls(rbbl_sum, is_movable);
+    //2. store all rbbls
     for(SIZE index = 0; index<rbbl_sum; index++){
-        //3.1 read rbbl
+        //2.1 read rbbl
         SIZE used_size = 0;
-        RandomBBL *rbbl = RandomBBL::read_rbbl(r_addrx, used_size);
+        RandomBBL *rbbl = is_view ? RandomBBL::read_rbbl_view(r_addrx, r_end, (void*)(views+index), used_size) \
+            : RandomBBL::read_rbbl(r_addrx, r_end, used_size);
         ASSERT(used_size!=0 && rbbl);
         r_addrx += used_size;
-        //3.2 insert
+        //2.2 insert
         if(is_movable)
             cvm->insert_movable_random_bbl(rbbl->get_rbbl_offset(), rbbl);
         else
             cvm->insert_fixed_random_bbl(rbbl->get_rbbl_offset(), rbbl);
     }
-    //4. return
+    //3. return
     return r_addrx - start_addrx;
-
 }
 
-static SIZE read_switch_case_info(S_ADDRX r_addrx, CodeVariantManager *cvm)
+static SIZE read_switch_case_info(S_ADDRX r_addrx, S_ADDRX r_end, SIZE jmpin_sum, CodeVariantManager *cvm)
 {
-    UINT32 *ptr_32 = NULL;
-    //1. read seg type
-    ptr_32 = (UINT32*)r_addrx;
-    UINT32 seg_type = *ptr_32++;
-    FATAL(seg_type!=db_seg_all_jmpin, "type unmatched!\n");
-    //2. read jmpin sum
-    SIZE jmpin_sum = *ptr_32++;
-    //3. read all jmpins
+    UINT64 *ptr_64 = (UINT64*)r_addrx;
+    UINT64 *end_64 = (UINT64*)r_end;
+    //1. read all jmpins
     for(SIZE index = 0; index<jmpin_sum; index++){
-        //3.1 read jmpin offset
-        F_SIZE jmpin_offset = *ptr_32++;
-        //3.2 read target sum
-        SIZE target_sum = *ptr_32++;
-        //3.3 read all targets
+        FATAL(end_64-ptr_64<2, "switch case jmpin %ld exceeds the section end!\n", index);
+        //1.1 read jmpin offset
+        F_SIZE jmpin_offset = *ptr_64++;
+        //1.2 read target sum
+        SIZE target_sum = *ptr_64++;
+        FATAL(target_sum>(SIZE)(end_64-ptr_64), "targets of switch case jmpin %lx exceed the section end!\n", jmpin_offset);
+        //1.3 read all targets
         CodeVariantManager::TARGET_SET target_set;
         for(SIZE idx = 0; idx<target_sum; idx++)
-            target_set.insert((F_SIZE)*ptr_32++);
-        //3.4 insert
+            target_set.insert((F_SIZE)*ptr_64++);
+        //1.4 insert
         cvm->insert_switch_case_jmpin_rbbl(jmpin_offset, target_set);
         target_set.clear();
     }
-
-    //4. return
-    return (S_ADDRX)ptr_32 - r_addrx;
+    //2. return
+    return (S_ADDRX)ptr_64 - r_addrx;
 }
 
-static SIZE read_main_jump_table_info(S_ADDRX r_addrx, CodeVariantManager *cvm)
+static SIZE read_main_jump_table_info(S_ADDRX r_addrx, S_ADDRX r_end, SIZE table_sum, CodeVariantManager *cvm)
 {
-    UINT32 *ptr_32 = NULL;
-    //1. read seg type
-    ptr_32 = (UINT32*)r_addrx;
-    UINT32 seg_type = *ptr_32++;
-    FATAL(seg_type!=db_seg_main_jump_table, "type unmatched!\n");
-    //2. read jmpin sum
-    SIZE table_sum = *ptr_32++;
-    //3. read all jmpins
+    UINT64 *ptr_64 = (UINT64*)r_addrx;
+    UINT64 *end_64 = (UINT64*)r_end;
+    //1. read all tables
     for(SIZE index = 0; index<table_sum; index++){
-        //3.1 read jmpin offset
-        F_SIZE jmpin_offset = *ptr_32++;
-        //3.2 read target sum
-        SIZE target_sum = *ptr_32++;
-        //3.3 read all targets
+        FATAL(end_64-ptr_64<2, "main jump table %ld exceeds the section end!\n", index);
+        //1.1 read jmpin offset
+        F_SIZE jmpin_offset = *ptr_64++;
+        //1.2 read target sum
+        SIZE target_sum = *ptr_64++;
+        FATAL(target_sum>(SIZE)(end_64-ptr_64), "targets of main jump table %lx exceed the section end!\n", jmpin_offset);
+        //1.3 read all targets
         CodeVariantManager::JMP_TABLE_CONTENT table_content;
         for(SIZE idx = 0; idx<target_sum; idx++)
-            table_content.push_back((F_SIZE)*ptr_32++);
-        //3.4 insert
+            table_content.push_back((F_SIZE)*ptr_64++);
+        //1.4 insert
         cvm->insert_main_switch_case_jump_table(jmpin_offset, table_content);
         table_content.clear();
     }
-
-    //4. return
-    return (S_ADDRX)ptr_32 - r_addrx;
+    //2. return
+    return (S_ADDRX)ptr_64 - r_addrx;
 }
 
-static SIZE store_rbbls(S_ADDRX s_addrx, CodeVariantManager::RAND_BBL_MAPS &rbbl_maps, BOOL is_movable)
+static void store_rbbls(DBWriter &writer, CodeVariantManager::RAND_BBL_VEC &rbbl_maps, UINT32 type)
 {
-    S_ADDRX start_addrx = s_addrx;
-    UINT32 *ptr_32 = NULL;
-    //1. store seg type
-    ptr_32 = (UINT32*)s_addrx;
-    *ptr_32++ = is_movable ? db_seg_movable : db_seg_fixed;
-    //2. store rbbl num
-    SIZE rbbl_num = rbbl_maps.size();
-    ASSERT(rbbl_num<=UINT_MAX);
-    *ptr_32++ = (UINT32)rbbl_num;
-    s_addrx = (S_ADDRX)ptr_32;
-    //3. store all rbbls
-    for(CodeVariantManager::RAND_BBL_MAPS::iterator iter = rbbl_maps.begin(); iter!=rbbl_maps.end(); iter++){
+    writer.begin_section();
+    //1. store all rbbls
+    for(CodeVariantManager::RAND_BBL_VEC::iterator iter = rbbl_maps.begin(); iter!=rbbl_maps.end(); iter++){
         RandomBBL *rbbl = iter->second;
-        s_addrx += rbbl->store_rbbl(s_addrx);
+        S_ADDRX s_addrx = writer.reserve(rbbl->get_store_size());
+        writer.commit(rbbl->store_rbbl(s_addrx));
     }
-    //4. return
-    return s_addrx - start_addrx;
+    //2. rbbl num is stored in the section directory
+    writer.end_section(type, rbbl_maps.size());
 }
 
-static SIZE store_switch_case_info(S_ADDRX s_addrx, CodeVariantManager::JMPIN_TARGETS_MAPS &jmpin_maps)
+static void store_rbbus(DBWriter &writer, CodeVariantManager::RAND_BBU_VEC &rbbus)
 {
-    UINT32 *ptr_32 = NULL;
-    //1. store seg type
-    ptr_32 = (UINT32*)s_addrx;
-    *ptr_32++ = db_seg_all_jmpin;
-    //2. store jmpin num
-    SIZE jmpin_num = jmpin_maps.size();
-    *ptr_32++ = (UINT32)jmpin_num;
-    //3. store all jmpins
+    writer.begin_section();
+    //1. store the rbbl num of each rbbu, rbbus are runs of rbbls in the order of rbbl offset
+    for(CodeVariantManager::RAND_BBU_VEC::iterator iter = rbbus.begin(); iter!=rbbus.end(); iter++)
+        writer.write(&iter->num, sizeof(UINT32));
+    //2. rbbu num is stored in the section directory
+    writer.end_section(DB_SEC_RBBU, rbbus.size());
+}
+
+static void store_switch_case_info(DBWriter &writer, CodeVariantManager::JMPIN_TARGETS_MAPS &jmpin_maps)
+{
+    writer.begin_section();
+    //1. store all jmpins
     for(CodeVariantManager::JMPIN_ITERATOR iter = jmpin_maps.begin(); iter!=jmpin_maps.end(); iter++){
-        F_SIZE jmpin_offset = iter->first;
         CodeVariantManager::TARGET_SET &target_set = iter->second;
-        SIZE target_num = target_set.size();
-        //3.1 store jmpin offset
-        ASSERT(jmpin_offset<=UINT_MAX);
-        *ptr_32++ = (UINT32)jmpin_offset;
-        //3.2 store target num
-        ASSERT(target_num<=UINT_MAX);
-        *ptr_32++ = (UINT32)target_num;
-        //3.3 store all targets
-        for(CodeVariantManager::TARGET_ITERATOR it = target_set.begin(); it!=target_set.end(); it++){
-            F_SIZE target_offset = *it;
-            ASSERT(target_offset<=UINT_MAX);
-            *ptr_32++ = (UINT32)target_offset;
-        }
+        UINT64 *ptr_64 = (UINT64*)writer.reserve((2+target_set.size())*sizeof(UINT64));
+        //1.1 store jmpin offset
+        *ptr_64++ = iter->first;
+        //1.2 store target num
+        *ptr_64++ = target_set.size();
+        //1.3 store all targets
+        for(CodeVariantManager::TARGET_ITERATOR it = target_set.begin(); it!=target_set.end(); it++)
+            *ptr_64++ = *it;
+        writer.commit((2+target_set.size())*sizeof(UINT64));
     }
-    //4. return
-    return (S_ADDRX)ptr_32 - s_addrx;
+    //2. jmpin num is stored in the section directory
+    writer.end_section(DB_SEC_SWITCH_CASE_JMPIN, jmpin_maps.size());
 }
 
-static SIZE store_main_jump_table_info(S_ADDRX s_addrx, CodeVariantManager::JMP_TABLE_MAPS &table_maps)
+static void store_main_jump_table_info(DBWriter &writer, CodeVariantManager::JMP_TABLE_MAPS &table_maps)
 {
-    UINT32 *ptr_32 = NULL;
-    //1. store seg type
-    ptr_32 = (UINT32*)s_addrx;
-    *ptr_32++ = db_seg_main_jump_table;
-    //2. store table num
-    SIZE table_num = table_maps.size();
-    *ptr_32++ = (UINT32)table_num;
-    //3. store all jmpins
+    writer.begin_section();
+    //1. store all tables
     for(CodeVariantManager::JMP_TABLE_MAPS::iterator iter = table_maps.begin(); iter!=table_maps.end(); iter++){
-        F_SIZE jmpin_offset = iter->first;
         CodeVariantManager::JMP_TABLE_CONTENT &table_content = iter->second;
-        SIZE table_size = table_content.size();
-        //3.1 store jmpin offset
-        ASSERT(jmpin_offset<=UINT_MAX);
-        *ptr_32++ = (UINT32)jmpin_offset;
-        //3.2 store target num
-        ASSERT(table_size<=UINT_MAX);
-        *ptr_32++ = (UINT32)table_size;
-        //3.3 store all targets
-        for(CodeVariantManager::JMP_TABLE_CONTENT::iterator it = table_content.begin(); it!=table_content.end(); it++){
-            F_SIZE target_offset = *it;
-            ASSERT(target_offset<=UINT_MAX);
-            *ptr_32++ = (UINT32)target_offset;
-        }
+        UINT64 *ptr_64 = (UINT64*)writer.reserve((2+table_content.size())*sizeof(UINT64));
+        //1.1 store jmpin offset
+        *ptr_64++ = iter->first;
+        //1.2 store target num
+        *ptr_64++ = table_content.size();
+        //1.3 store all targets
+        for(CodeVariantManager::JMP_TABLE_CONTENT::iterator it = table_content.begin(); it!=table_content.end(); it++)
+            *ptr_64++ = *it;
+        writer.commit((2+table_content.size())*sizeof(UINT64));
     }
-    //4. return
-    return (S_ADDRX)ptr_32 - s_addrx;
+    //2. table num is stored in the section directory
+    writer.end_section(DB_SEC_MAIN_JUMP_TABLE, table_maps.size());
 }
 
 void handle_directory_path(std::string &db_path)
@@ -1543,43 +2031,14 @@ void handle_directory_path(std::string &db_path)
 
 static void find_dependence_lib_to_init_cvm(std::string elf_path, std::vector<CodeVariantManager*> &cvm_vec)
 {
-    // get the path of all dependence libraries
-    // 1.generate command string
-    char command[128];
-    sprintf(command, "/usr/bin/ldd %s", elf_path.c_str());
-    char type[3] = "r";
-    // 2.get stream of command's output
-    FILE *p_stream = popen(command, type);
-    ASSERTM(p_stream, "popen() error!\n");
-    // 4.parse the stream to get dependence libraries
-    SIZE len = 500;
-    char *line_buf = new char[len];
-    while(getline(&line_buf, &len, p_stream)!=-1) {  
-        char name[100];
-        char path[100];
-        char *pos = NULL;
-        P_ADDRX addr;
-        // get name and path of images
-        if((pos = strstr(line_buf, "ld-linux-x86-64"))!=NULL){
-            sscanf(line_buf, "%s (0x%lx)\n", path, &addr);
-            sscanf(pos, "%s (0x%lx)", name, &addr);
-        }else if((pos = strstr(line_buf, "linux-vdso"))!=NULL){
-            sscanf(line_buf, "%s => (0x%lx)\n", name, &addr);
-            path[0] = '\0';
-        }else if((pos = strstr(line_buf, "statically"))!=NULL){
-            path[0] = '\0';
-            name[0] = '\0';
-        }else{    
-            sscanf(line_buf, "%s => %s (0x%lx)\n", name, path, &addr);
-            ASSERTM(strstr(path, name), "Name(%s) is not in Path(%s)\n", name, path);
-        }
-        //construct the CodeVariantManager
-        if((path[0]!='\0') && !CodeVariantManager::is_added(std::string(path)))
-            cvm_vec.push_back(new CodeVariantManager(std::string(path)));
+    // 1.get the path of all dependence libraries
+    std::vector<std::string> lib_paths;
+    ElfParser::resolve_dependence_libs(elf_path, lib_paths);
+    // 2.construct the CodeVariantManager
+    for(std::vector<std::string>::iterator iter = lib_paths.begin(); iter!=lib_paths.end(); iter++){
+        if(!CodeVariantManager::is_added(*iter))
+            cvm_vec.push_back(new CodeVariantManager(*iter));
     }
-    free(line_buf);
-    // 5.close stream
-    pclose(p_stream);
 }
 
 static std::string get_ss_suffix(LKM_SS_TYPE ss_type)
@@ -1597,44 +2056,128 @@ static std::string get_ss_suffix(LKM_SS_TYPE ss_type)
     }
 }
 
+static std::string get_db_cache_path(std::string elf_path, std::string elf_id, LKM_SS_TYPE ss_type)
+{
+    //db cache entry is keyed by the elf id (GNU build-id or content hash), so it can be shared by all applications
+    return Options::_db_cache_path + ElfParser::get_name(elf_path) + "-" + elf_id + get_ss_suffix(ss_type);
+}
+
+static const DBFormat::SECTION *get_db_section(S_ADDRX db_start, UINT32 type, std::string &db_path)
+{
+    const DBFormat::SECTION *section = DBFormat::get_section(db_start, type);
+    FATAL(!section, "%s lacks section %d!\n", db_path.c_str(), type);
+    return section;
+}
+
 void CodeVariantManager::read_db_files(std::string db_path, LKM_SS_TYPE ss_type)
 {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
     //1. prepare shadow stack suffix
     std::string ss_suffix = get_ss_suffix(ss_type);
     //2. construct the db path
     std::string cvm_db_path = db_path + get_name() + ss_suffix;
-    //3. open db file
-    INT32 fd = open(cvm_db_path.c_str(), O_RDWR);
+    std::string elf_id = ElfParser::calculate_elf_id(_elf_real_path);
+    //3. use the db cache if the db file is not exist
+    if(Options::_has_db_cache && access(cvm_db_path.c_str(), F_OK)!=0){
+        std::string cache_path = get_db_cache_path(_elf_real_path, elf_id, ss_type);
+        if(DBFormat::check_db_header(cache_path, ss_type, elf_id, true)){
+            cvm_db_path = cache_path;
+            _is_from_db_cache = true;
+        }
+    }
+    //4. read db file
+    load_db_file(cvm_db_path, ss_type, elf_id);
+    gettimeofday(&end, NULL);
+    _db_load_time = get_time_diff(start, end);
+}
+
+void CodeVariantManager::load_db_file(std::string cvm_db_path, LKM_SS_TYPE ss_type, std::string elf_id)
+{
+    BOOL is_view = Options::_use_mapped_db;
+    //1. open db file, the db is only written by the process producing it, so the loaded db (maybe a db cache entry
+    //   owned by another user) is opened read-only
+    INT32 fd = open(cvm_db_path.c_str(), O_RDONLY);
     FATAL(fd==-1, "Open db file %s failed!\n", cvm_db_path.c_str());
-    //4. get map size
+    //2. get map size
     struct stat statbuf;
     INT32 ret = fstat(fd, &statbuf);
     FATAL(ret!=0, "Get %s information failed!\n", cvm_db_path.c_str());
+    //the db cache entry is checked again on the opened fd, it may be replaced after its header is checked
+    FATAL(_is_from_db_cache && !DBFormat::is_trusted_db(statbuf), "db cache entry %s is not trusted!\n", cvm_db_path.c_str());
     SIZE map_size = X86_PAGE_ALIGN_CEIL(statbuf.st_size);
-    //5. map the file
-    void *buf_start = mmap(NULL, map_size, PROT_WRITE|PROT_READ, MAP_SHARED, fd, 0);
-    ASSERT(buf_start!=MAP_FAILED);
-    S_ADDRX read_ptr = (S_ADDRX)buf_start;
-    
-    //6. read cvm information
+    //3. map the file
+    void *buf_start = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    FATAL(buf_start==MAP_FAILED, "Map db file %s failed!\n", cvm_db_path.c_str());
+    S_ADDRX db_start = (S_ADDRX)buf_start;
+    //4. reject the stale or broken db, the zero-copy db only checks the header and directory, the crc pass over
+    //   all sections is skipped, so the template bytes are only touched when they are generated
+    const char *err = DBFormat::check_db(db_start, statbuf.st_size, ss_type, elf_id, !is_view);
+    FATAL(err, "Illegal db file %s: %s!\n", cvm_db_path.c_str(), err);
+    //5. read cvm information, each section is loaded independently
     set_ss_type(ss_type);
-     //6.1 read postion fixed rbbl
-    read_ptr += read_rbbls(read_ptr, this, false);
-     //6.2 read movable rbbls
-    read_ptr += read_rbbls(read_ptr, this, true);
-     //6.3 read switch_case jmpin targets
-    read_ptr += read_switch_case_info(read_ptr, this);
-     //6.4 read main jump table info
-    read_ptr += read_main_jump_table_info(read_ptr, this);
+    const DBFormat::SECTION *section = NULL;
+     //5.1 read postion fixed rbbl, check_db has checked that all sections are inside the file, each reader stops
+     //    at the section end before reading past it
+    section = get_db_section(db_start, DB_SEC_FIXED_RBBL, cvm_db_path);
+    read_rbbls(db_start+section->offset, db_start+section->offset+section->size, section->entry_num, this, false, is_view);
+     //5.2 read movable rbbls
+    section = get_db_section(db_start, DB_SEC_MOVABLE_RBBL, cvm_db_path);
+    read_rbbls(db_start+section->offset, db_start+section->offset+section->size, section->entry_num, this, true, is_view);
+     //5.3 read switch_case jmpin targets
+    section = get_db_section(db_start, DB_SEC_SWITCH_CASE_JMPIN, cvm_db_path);
+    read_switch_case_info(db_start+section->offset, db_start+section->offset+section->size, section->entry_num, this);
+     //5.4 read main jump table info
+    section = get_db_section(db_start, DB_SEC_MAIN_JUMP_TABLE, cvm_db_path);
+    read_main_jump_table_info(db_start+section->offset, db_start+section->offset+section->size, section->entry_num, this);
+     //5.5 read rbbu partition, db converted from v1 has no rbbu section
+    section = DBFormat::get_section(db_start, DB_SEC_RBBU);
+    if(section){
+        FATAL(section->entry_num*sizeof(UINT32)>section->size, "rbbu section of %s is broken!\n", cvm_db_path.c_str());
+        init_rbbl_unit((const UINT32*)(db_start+section->offset), section->entry_num);
+    }else
+        init_rbbl_unit();
+     //5.6 resolve relocation targets into dense slots
+    init_rbbl_slots();
     
-    ASSERT(read_ptr==(statbuf.st_size+(S_ADDRX)buf_start));
-    //7. unmap 
-    ret = munmap(buf_start, map_size);
-    ASSERT(ret==0);
-    //8. close the file
+    //6. unmap, the mapping of zero-copy db is kept until the cvm is destroyed
+    if(is_view){
+        ASSERT(_db_map_start==0);
+        _db_map_start = (S_ADDRX)buf_start;
+        _db_map_size = map_size;
+    }else{
+        ret = munmap(buf_start, map_size);
+        ASSERT(ret==0);
+    }
+    //7. close the file
     close(fd);
-    //9. init rbbl unit    
-    init_rbbl_unit();
+}
+
+typedef struct{
+    std::string db_path;
+    LKM_SS_TYPE ss_type;
+}DB_LOAD_ARG;
+
+static void load_a_cvm(CodeVariantManager *cvm, void *arg)
+{
+    DB_LOAD_ARG *load_arg = (DB_LOAD_ARG*)arg;
+    cvm->read_db_files(load_arg->db_path, load_arg->ss_type);
+}
+
+static SIZE get_file_size(std::string path)
+{
+    struct stat statbuf;
+    return stat(path.c_str(), &statbuf)==0 ? statbuf.st_size : 0;
+}
+
+static bool is_larger_elf(CodeVariantManager *cvm_a, CodeVariantManager *cvm_b)
+{
+    return get_file_size(cvm_a->get_elf_path())>get_file_size(cvm_b->get_elf_path());
+}
+
+static bool is_slower_loaded(CodeVariantManager *cvm_a, CodeVariantManager *cvm_b)
+{
+    return cvm_a->get_db_load_time()>cvm_b->get_db_load_time();
 }
 
 void CodeVariantManager::init_from_db(std::string elf_path, std::string db_path, LKM_SS_TYPE ss_type)
@@ -1646,70 +2189,88 @@ void CodeVariantManager::init_from_db(std::string elf_path, std::string db_path,
     if(!CodeVariantManager::is_added(elf_path))
         init_cvm_vec.push_back(new CodeVariantManager(elf_path));
     find_dependence_lib_to_init_cvm(elf_path, init_cvm_vec);
-    //3. read db to initialize the code variant manager
+    //3. read dbs to initialize the code variant managers concurrently, cvms have been inserted into _all_cvm_maps
+    //   by the constructors in order, so only the per-module data is initialized by the workers
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    std::stable_sort(init_cvm_vec.begin(), init_cvm_vec.end(), is_larger_elf);
+    DB_LOAD_ARG load_arg = {db_path, ss_type};
+    ParallelHandler<CodeVariantManager*>(init_cvm_vec, load_a_cvm, (void*)&load_arg).run(Options::_analysis_thread_num);
+    gettimeofday(&end, NULL);
+    //4. report the load time of each module, the slowest first
+    std::stable_sort(init_cvm_vec.begin(), init_cvm_vec.end(), is_slower_loaded);
     for(std::vector<CodeVariantManager*>::iterator iter = init_cvm_vec.begin(); iter!=init_cvm_vec.end(); iter++){
         CodeVariantManager *cvm = *iter;
-        cvm->read_db_files(db_path, ss_type);  
+        BLUE("[DB] %-32s %8.3f ms (%ld rbbls%s)\n", cvm->get_name().c_str(), cvm->_db_load_time/1000.0, cvm->get_rbbl_num(), \
+            cvm->_is_from_db_cache ? ", db cache" : "");
     }
+    BLUE("[DB] load %ld modules in %.3f ms with %lld threads\n", init_cvm_vec.size(), get_time_diff(start, end)/1000.0, \
+        Options::_analysis_thread_num);
+}
+
+void CodeVariantManager::init_from_db_cache(LKM_SS_TYPE ss_type)
+{
+    ElfParser::PARSED_ELF_ITERATOR it = ElfParser::_all_parsed_elfs.begin();
+    for(; it!=ElfParser::_all_parsed_elfs.end(); it++){
+        ElfParser *elf = it->second;
+        //1. search the db cache
+        std::string cache_path = get_db_cache_path(elf->get_elf_path(), elf->get_elf_id(), ss_type);
+        if(is_added(elf->get_elf_path()) || !DBFormat::check_db_header(cache_path, ss_type, elf->get_elf_id(), true))
+            continue;
+        //2. reuse the static analysis result
+        CodeVariantManager *cvm = new CodeVariantManager(elf->get_elf_path());
+        cvm->_is_from_db_cache = true;
+        cvm->load_db_file(cache_path, ss_type, elf->get_elf_id());
+        elf->set_db_cached();
+    }
+}
+
+void CodeVariantManager::store_db_file(CodeVariantManager *cvm, std::string cvm_db_path, std::string elf_id)
+{
+    //1. write into the temp file, which is renamed into cvm_db_path by finish
+    DBWriter writer(cvm_db_path, cvm->_ss_type, elf_id, 5);
+    //2. store cvm information
+     //2.1 store postion fixed rbbl
+    store_rbbls(writer, cvm->_postion_fixed_rbbls, DB_SEC_FIXED_RBBL);
+     //2.2 store movable rbbls
+    store_rbbls(writer, cvm->_movable_rbbls, DB_SEC_MOVABLE_RBBL);
+     //2.3 store switch_case jmpin targets
+    store_switch_case_info(writer, cvm->_switch_case_jmpin_rbbl_maps);
+     //2.4 store main jump table info
+    store_main_jump_table_info(writer, cvm->_main_switch_case_jump_table);
+     //2.5 store rbbu partition computed at analysis time
+    store_rbbus(writer, cvm->_rbbus);
+    writer.finish();
+}
+
+static void store_a_cvm(CodeVariantManager *cvm, void *arg)
+{
+    cvm->store_into_db_path(*(std::string*)arg);
+}
+
+void CodeVariantManager::store_into_db_path(std::string db_path)
+{
+    //1. prepare shadow stack suffix
+    std::string ss_suffix = get_ss_suffix(_ss_type);
+    //2. store the module into db path
+    std::string cvm_db_path = db_path + get_name() + ss_suffix;
+    std::string elf_id = ElfParser::calculate_elf_id(_elf_real_path);
+    store_db_file(this, cvm_db_path, elf_id);
+    //3. publish the new analysed module into db cache
+    if(Options::_has_db_cache && !_is_from_db_cache)
+        store_db_file(this, get_db_cache_path(_elf_real_path, elf_id, _ss_type), elf_id);
 }
 
 void CodeVariantManager::store_into_db(std::string db_path)
 {
     //judge the directory is exist or not
     handle_directory_path(db_path);
-    //record all information
-    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
-        CodeVariantManager *cvm = iter->second;
-        //1. prepare shadow stack suffix
-        std::string ss_suffix = get_ss_suffix(cvm->_ss_type);
-        //2. store all modules
-        #define BUF_SIZE (1ull<<32)
-         //2.1 construct the db path for each cvm
-        std::string cvm_name = cvm->get_name();
-        std::string cvm_db_path = db_path + cvm_name+ss_suffix;
-         //2.2 remove the old db 
-        remove(cvm_db_path.c_str());
-         //2.3 create db
-        INT32 fd = creat(cvm_db_path.c_str(), S_IRUSR|S_IWUSR);
-        FATAL(fd==-1, "Create %s failed!\n", cvm_db_path.c_str());    
-        close(fd);
-         //2.4 open db file
-        fd = open(cvm_db_path.c_str(), O_RDWR);
-        FATAL(fd==-1, "Can not open %s\n", cvm_db_path.c_str());     
-         //2.5 enlarge the file      
-        struct stat statbuf;
-        INT32 ret = fstat(fd, &statbuf);
-        FATAL(ret!=0, "Get %s information failed!\n", cvm_db_path.c_str());
-        ret = ftruncate(fd, BUF_SIZE);
-        FATAL(ret!=0, "Enlarge %s failed!\n", cvm_db_path.c_str());    
-         //2.6 map the buffer with the db file
-        void *buf_start = mmap(NULL, BUF_SIZE, PROT_WRITE|PROT_READ, MAP_SHARED, fd, 0);
-        ASSERT(buf_start!=MAP_FAILED);
-        S_ADDRX store_ptr = (S_ADDRX)buf_start;
-         //2.7 protect the last page
-        ret = mprotect((void*)((S_ADDRX)buf_start+BUF_SIZE-X86_PAGE_SIZE), X86_PAGE_SIZE, PROT_NONE);
-        FATAL(ret!=0, "protect the last page error!\n");
-        
-        //3. store cvm information
-         //3.1 store postion fixed rbbl
-        store_ptr += store_rbbls(store_ptr, cvm->_postion_fixed_rbbl_maps, false);
-         //3.2 store movable rbbls
-        store_ptr += store_rbbls(store_ptr, cvm->_movable_rbbl_maps, true);
-         //3.3 store switch_case jmpin targets
-        store_ptr += store_switch_case_info(store_ptr, cvm->_switch_case_jmpin_rbbl_maps);
-         //3.4 store main jump table info
-        store_ptr += store_main_jump_table_info(store_ptr, cvm->_main_switch_case_jump_table);
-         
-        //4. unmap and dwindle the file
-        ret = munmap(buf_start, BUF_SIZE);
-        ASSERT(ret==0);
-        SIZE used_size = store_ptr-(S_ADDRX)buf_start;
-        ret = ftruncate(fd, used_size);
-        FATAL(ret!=0, "Dwindle %s failed!\n", cvm_db_path.c_str());   
-        
-        //5. close the file
-        close(fd);
-    }
+    //record all modules in parallel, the largest modules are stored first
+    std::vector<CodeVariantManager*> cvms;
+    for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++)
+        cvms.push_back(iter->second);
+    std::stable_sort(cvms.begin(), cvms.end(), is_larger_cvm);
+    ParallelHandler<CodeVariantManager*>(cvms, store_a_cvm, (void*)&db_path).run(Options::_analysis_thread_num);
 }
 
 //patched code do not exist in cc_layout, we should modify the cc_layout in future
@@ -1761,31 +2322,32 @@ S_ADDRX patch_sigreturn_ss_template(S_ADDRX cc_used_base, LKM_SS_TYPE ss_type, S
     return cc_used_base;
 }
 
-void CodeVariantManager::patch_sigaction_entry(BOOL is_first_cc, P_ADDRX handler_paddrx, P_ADDRX sigreturn_paddrx)
+void CodeVariantManager::patch_sigaction_entry(UINT32 cv_id, P_ADDRX handler_paddrx, P_ADDRX sigreturn_paddrx)
 {
-    CC_LAYOUT &cc_layout = is_first_cc ? _cc_layout1 : _cc_layout2;
-    S_ADDRX base_saddrx = is_first_cc ? _cc1_base : _cc2_base;
-    RBBL_CC_MAPS &rbbl_maps = is_first_cc ? _rbbl_maps1 : _rbbl_maps2;
-    S_ADDRX &cc_used_base = is_first_cc ? _cc1_used_base : _cc2_used_base;
+    CC_LAYOUT &cc_layout = _cvs[cv_id].cc_layout;
+    S_ADDRX base_saddrx = _cvs[cv_id].cc_base;
+    RBBL_CC_ADDRS &rbbl_addrs = _cvs[cv_id].rbbl_addrs;
+    S_ADDRX &cc_used_base = _cvs[cv_id].cc_used_base;
 
     if(handler_paddrx>=_org_x_load_base && handler_paddrx<(_org_x_load_base + _org_x_load_size)){
         //1. get offset 
         F_SIZE handler_offset = handler_paddrx - _org_x_load_base;
-        ASSERTM(_postion_fixed_rbbl_maps.find(handler_offset)!=_postion_fixed_rbbl_maps.end(),\
+        ASSERTM(std::binary_search(_postion_fixed_rbbls.begin(), _postion_fixed_rbbls.end(), \
+            std::make_pair(handler_offset, (RandomBBL*)NULL), is_lower_rbbl),\
             "signal handler entry basic block must be position fixed!\n");
         //2. get handler addr in code variant
-        RBBL_CC_MAPS::iterator handler_iter = rbbl_maps.find(handler_offset);
-        FATAL(handler_iter==rbbl_maps.end(), "find no handler!\n");
+        RBBL_SLOT handler_slot = get_slot_from_offset(handler_offset);
+        FATAL(handler_slot==get_invalid_slot() || rbbl_addrs[handler_slot]==0, "find no handler!\n");
         //3. get handler's trampoline addr
         S_ADDRX tramp_saddrx = handler_offset + base_saddrx;
-        CC_LAYOUT_ITER cc_iter = cc_layout.upper_bound(Range<S_ADDRX>(tramp_saddrx));
-        if(cc_iter!=cc_layout.end() && tramp_saddrx<=(--cc_iter)->first.high() && tramp_saddrx>=cc_iter->first.low()){
-            S_ADDRX start = cc_iter->first.low();
-            ASSERTM(cc_iter->second==TRAMP_JMP32_PTR && *(UINT8*)start==JMP32_OPCODE, "Must be trampoline32!\n");
+        const CC_LAYOUT::ENTRY *entry = cc_layout.find_cover(tramp_saddrx);
+        if(entry){
+            S_ADDRX start = entry->low;
+            ASSERTM(entry->ptr==TRAMP_JMP32_PTR && *(UINT8*)start==JMP32_OPCODE, "Must be trampoline32!\n");
             ASSERT(start==tramp_saddrx);
             INT32 offset32 = *(INT32*)(start+OFFSET_POS);
             S_ADDRX target_saddrx = start + JMP32_LEN + offset32;
-            ASSERT(target_saddrx==handler_iter->second); 
+            ASSERT(target_saddrx==rbbl_addrs[handler_slot]); 
             S_ADDRX target_patch_code = cc_used_base;
             //patch template
             cc_used_base = patch_sigreturn_ss_template(target_patch_code, _ss_type, _ss_offset, _gs_base, sigreturn_paddrx, target_saddrx);
@@ -1796,17 +2358,17 @@ void CodeVariantManager::patch_sigaction_entry(BOOL is_first_cc, P_ADDRX handler
     }
 }
 
-void CodeVariantManager::patch_all_sigaction_entry(BOOL is_first_cc)
+void CodeVariantManager::patch_all_sigaction_entry(UINT32 cv_id)
 {
     for(SIG_HANDLERS::iterator it = _sig_handlers.begin(); it!=_sig_handlers.end(); it++){
         SIG_INFO &sig_info = it->second;
-        BOOL &handled = is_first_cc ? sig_info.cv1_handled : sig_info.cv2_handled;
+        BOOL &handled = sig_info.cv_handled[cv_id];
         if(!handled){
             P_ADDRX handler_paddrx = sig_info.sighandler;
-            P_ADDRX sigreturn_paddrx = find_cc_paddrx_from_all_orig(sig_info.sigreturn, is_first_cc);
+            P_ADDRX sigreturn_paddrx = find_cc_paddrx_from_all_orig(sig_info.sigreturn, cv_id);
             for(CVM_MAPS::iterator iter = _all_cvm_maps.begin(); iter!=_all_cvm_maps.end(); iter++){
                 CodeVariantManager *cvm = iter->second;
-                cvm->patch_sigaction_entry(is_first_cc, handler_paddrx, sigreturn_paddrx);
+                cvm->patch_sigaction_entry(cv_id, handler_paddrx, sigreturn_paddrx);
             }
             handled = true;
         }
@@ -1820,24 +2382,22 @@ P_ADDRX CodeVariantManager::handle_sigaction(P_ADDRX orig_sighandler_addr, P_ADD
     else{
         if(_has_init){
             //wait all ready to make sure patch code cache safely
-            wait_for_code_variant_ready(true);
-            wait_for_code_variant_ready(false);
+            wait_for_all_code_variants_ready();
             //1. pause gen code variants
             pause_gen_code_variants();
             //2. record sighandler and sigreturn
-            SIG_INFO sig_info = {orig_sighandler_addr, orig_sigreturn_addr, false, false};
+            SIG_INFO sig_info = {orig_sighandler_addr, orig_sigreturn_addr, {false}};
             _sig_handlers.insert(std::make_pair(orig_sighandler_addr, sig_info));
             //3. patch template into sighandler
-            patch_all_sigaction_entry(true);
-            patch_all_sigaction_entry(false);
+            for(UINT32 cv_id = 0; cv_id<Options::_cv_num; cv_id++)
+                patch_all_sigaction_entry(cv_id);
             //4. continue to gen code
             continue_gen_code_variants();
             //5. wait code variants
-            wait_for_code_variant_ready(true);
-            wait_for_code_variant_ready(false);
+            wait_for_all_code_variants_ready();
             return old_pc;
         }else{
-            SIG_INFO sig_info = {orig_sighandler_addr, orig_sigreturn_addr, false, false};
+            SIG_INFO sig_info = {orig_sighandler_addr, orig_sigreturn_addr, {false}};
             _sig_handlers.insert(std::make_pair(orig_sighandler_addr, sig_info));
             return old_pc;
         }
@@ -0,0 +1,424 @@
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <vector>
+
+#include "db_format.h"
+#include "relocation.h"
+#include "netlink.h"
+
+static UINT32 crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table()
+{
+    for(UINT32 idx = 0; idx<256; idx++){
+        UINT32 crc = idx;
+        for(INT32 bit = 0; bit<8; bit++)
+            crc = (crc&1) ? (crc>>1)^0xedb88320 : (crc>>1);
+        crc_table[idx] = crc;
+    }
+}
+
+UINT32 DBFormat::crc32(const void *data, SIZE len, UINT32 crc)
+{
+    pthread_once(&crc_table_once, init_crc_table);
+    const UINT8 *ptr = (const UINT8*)data;
+    crc = ~crc;
+    for(SIZE idx = 0; idx<len; idx++)
+        crc = crc_table[(crc^ptr[idx])&0xff]^(crc>>8);
+    return ~crc;
+}
+
+static inline S_ADDRX align_section(S_ADDRX addr)
+{
+    return (addr+DB_SECTION_ALIGN-1)&(~(S_ADDRX)(DB_SECTION_ALIGN-1));
+}
+
+static UINT32 calculate_header_crc(const DBFormat::HEADER *header)
+{
+    DBFormat::HEADER temp = *header;
+    temp.header_crc = 0;
+    UINT32 crc = DBFormat::crc32(&temp, sizeof(DBFormat::HEADER));
+    return DBFormat::crc32(header+1, header->section_num*sizeof(DBFormat::SECTION), crc);
+}
+
+S_ADDRX DBFormat::init_db(S_ADDRX db_start, UINT32 ss_type, const std::string &elf_id, UINT32 section_num)
+{
+    SIZE header_size = get_header_size(section_num);
+    memset((void*)db_start, 0, header_size);
+    HEADER *header = (HEADER*)db_start;
+    header->magic = DB_MAGIC;
+    header->version = DB_VERSION;
+    header->ss_type = ss_type;
+    header->section_num = section_num;
+    strncpy(header->elf_id, elf_id.c_str(), DB_ELF_ID_LEN-1);
+    return align_section(db_start + header_size);
+}
+
+S_ADDRX DBFormat::add_section(S_ADDRX db_start, UINT32 sec_idx, UINT32 type, S_ADDRX sec_start, SIZE sec_size, UINT64 entry_num)
+{
+    HEADER *header = (HEADER*)db_start;
+    ASSERT(sec_idx<header->section_num && (sec_start&(DB_SECTION_ALIGN-1))==0);
+    SECTION *section = (SECTION*)(header+1) + sec_idx;
+    section->type = type;
+    section->offset = sec_start - db_start;
+    section->size = sec_size;
+    section->entry_num = entry_num;
+    section->crc = crc32((const void*)sec_start, sec_size);
+    //pad the gap with zero, so that the db is reproducible
+    S_ADDRX next_start = align_section(sec_start + sec_size);
+    memset((void*)(sec_start + sec_size), 0, next_start - sec_start - sec_size);
+    return next_start;
+}
+
+SIZE DBFormat::finish_db(S_ADDRX db_start, S_ADDRX db_end)
+{
+    HEADER *header = (HEADER*)db_start;
+    header->file_size = db_end - db_start;
+    header->header_crc = calculate_header_crc(header);
+    return header->file_size;
+}
+
+const char *DBFormat::check_db(S_ADDRX db_start, SIZE db_size, UINT32 ss_type, const std::string &elf_id, \
+    BOOL need_section_crc)
+{
+    const HEADER *header = (const HEADER*)db_start;
+    //1. check header
+    if(db_size<sizeof(HEADER) || header->magic!=DB_MAGIC)
+        return is_v1_db(db_start, db_size) ? "v1 db (upgrade it by -u)" : "bad magic";
+    if(header->version!=DB_VERSION)
+        return "unsupported version";
+    if(header->section_num>DB_SEC_TYPE_NUM || get_header_size(header->section_num)>db_size)
+        return "bad section directory";
+    if(header->file_size!=db_size)
+        return "truncated db";
+    if(header->header_crc!=calculate_header_crc(header))
+        return "header crc mismatch";
+    if(header->ss_type!=ss_type)
+        return "shadow stack type mismatch";
+    if(header->elf_id[0]!='\0' && !elf_id.empty() && strncmp(header->elf_id, elf_id.c_str(), DB_ELF_ID_LEN-1)!=0)
+        return "stale db (elf id mismatch)";
+    //2. check sections
+    const SECTION *section = (const SECTION*)(header+1);
+    for(UINT32 idx = 0; idx<header->section_num; idx++, section++){
+        if(section->offset>db_size || section->size>(db_size-section->offset) || (section->offset&(DB_SECTION_ALIGN-1))!=0)
+            return "section out of range";
+        if(need_section_crc && section->crc!=crc32((const void*)(db_start+section->offset), section->size))
+            return "section crc mismatch";
+    }
+    return NULL;
+}
+
+BOOL DBFormat::is_trusted_db(const struct stat &statbuf)
+{
+    if(!S_ISREG(statbuf.st_mode))
+        return false;
+    if(statbuf.st_uid!=0 && statbuf.st_uid!=geteuid())
+        return false;
+    return (statbuf.st_mode&(S_IWGRP|S_IWOTH))==0;
+}
+
+BOOL DBFormat::check_db_header(const std::string &db_path, UINT32 ss_type, const std::string &elf_id, BOOL need_trusted)
+{
+    HEADER header;
+    INT32 fd = open(db_path.c_str(), O_RDONLY);
+    if(fd==-1)
+        return false;
+    struct stat statbuf;
+    if(need_trusted && (fstat(fd, &statbuf)!=0 || !is_trusted_db(statbuf))){
+        ERR("db cache entry %s is not owned by root or the current user, or is writable by others, ignore it!\n", db_path.c_str());
+        close(fd);
+        return false;
+    }
+    ssize_t read_size = pread(fd, &header, sizeof(HEADER), 0);
+    close(fd);
+    if(read_size!=(ssize_t)sizeof(HEADER))
+        return false;
+    if(header.magic!=DB_MAGIC || header.version!=DB_VERSION || header.ss_type!=ss_type)
+        return false;
+    if(header.elf_id[0]!='\0' && !elf_id.empty() && strncmp(header.elf_id, elf_id.c_str(), DB_ELF_ID_LEN-1)!=0)
+        return false;
+    return true;
+}
+
+const DBFormat::SECTION *DBFormat::get_section(S_ADDRX db_start, UINT32 type)
+{
+    const HEADER *header = (const HEADER*)db_start;
+    const SECTION *section = (const SECTION*)(header+1);
+    for(UINT32 idx = 0; idx<header->section_num; idx++, section++){
+        if(section->type==type)
+            return section;
+    }
+    return NULL;
+}
+
+BOOL DBFormat::is_v1_db(S_ADDRX db_start, SIZE db_size)
+{
+    //v1 db is headerless and always starts with the position fixed rbbl segment
+    return db_size>=2*sizeof(UINT32) && *(UINT32*)db_start==DB_SEC_FIXED_RBBL;
+}
+
+static inline void append_u64(std::vector<UINT8> &buf, UINT64 value)
+{
+    buf.insert(buf.end(), (UINT8*)&value, (UINT8*)&value + sizeof(UINT64));
+}
+
+SIZE DBFormat::convert_v1_section(S_ADDRX v1_start, SIZE v1_size, S_ADDRX &v1_ptr, UINT32 type, std::vector<UINT8> &v2_buf, \
+    UINT64 &entry_num)
+{
+    S_ADDRX v1_end = v1_start + v1_size;
+    SIZE old_size = v2_buf.size();
+    //1. read v1 seg type and num
+    FATAL(v1_ptr+2*sizeof(UINT32)>v1_end, "v1 db is truncated!\n");
+    UINT32 *ptr_32 = (UINT32*)v1_ptr;
+    UINT32 seg_type = *ptr_32++;
+    FATAL(seg_type!=type, "v1 seg type (%d) is wrong, should be %d!\n", seg_type, type);
+    entry_num = *ptr_32++;
+    v1_ptr = (S_ADDRX)ptr_32;
+    //2. convert the entries
+    switch(type){
+        case DB_SEC_FIXED_RBBL:
+        case DB_SEC_MOVABLE_RBBL:
+            //rbbl records are the same in v1 and v2
+            for(UINT64 idx = 0; idx<entry_num; idx++){
+                SIZE record_size = RandomBBL::get_rbbl_record_size(v1_ptr, v1_end);
+                v2_buf.insert(v2_buf.end(), (UINT8*)v1_ptr, (UINT8*)v1_ptr + record_size);
+                v1_ptr += record_size;
+            }
+            break;
+        case DB_SEC_SWITCH_CASE_JMPIN:
+        case DB_SEC_MAIN_JUMP_TABLE:
+            //widen the 32bit offsets and nums into 64bit
+            for(UINT64 idx = 0; idx<entry_num; idx++){
+                FATAL((S_ADDRX)(ptr_32+2)>v1_end, "v1 db is truncated!\n");
+                append_u64(v2_buf, *ptr_32++);
+                UINT32 target_num = *ptr_32;
+                append_u64(v2_buf, *ptr_32++);
+                FATAL((S_ADDRX)(ptr_32+target_num)>v1_end, "v1 db is truncated!\n");
+                for(UINT32 target_idx = 0; target_idx<target_num; target_idx++)
+                    append_u64(v2_buf, *ptr_32++);
+            }
+            v1_ptr = (S_ADDRX)ptr_32;
+            break;
+        default:
+            ASSERTM(0, "Unkown v1 seg type %d!\n", type);
+    }
+    //3. align the next section
+    SIZE sec_size = v2_buf.size() - old_size;
+    while(v2_buf.size()%DB_SECTION_ALIGN!=0)
+        v2_buf.push_back(0);
+    return sec_size;
+}
+
+static const UINT8 *map_db_file(const std::string &db_path, SIZE &db_size)
+{
+    INT32 fd = open(db_path.c_str(), O_RDONLY);
+    if(fd==-1)
+        return NULL;
+    struct stat statbuf;
+    if(fstat(fd, &statbuf)!=0 || statbuf.st_size==0){
+        close(fd);
+        return NULL;
+    }
+    db_size = statbuf.st_size;
+    void *map_start = mmap(NULL, db_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return map_start==MAP_FAILED ? NULL : (const UINT8*)map_start;
+}
+
+BOOL DBFormat::convert_v1_db(const std::string &db_path, UINT32 ss_type)
+{
+    //1. map the v1 db
+    SIZE v1_size = 0;
+    const UINT8 *v1_start = map_db_file(db_path, v1_size);
+    FATAL(!v1_start, "Map db file %s failed!\n", db_path.c_str());
+    if(!is_v1_db((S_ADDRX)v1_start, v1_size)){
+        munmap((void*)v1_start, v1_size);
+        return false;
+    }
+    //2. convert the sections in v1 order, v1 db has no rbbu section and elf id
+    const UINT32 v1_order[] = {DB_SEC_FIXED_RBBL, DB_SEC_MOVABLE_RBBL, DB_SEC_SWITCH_CASE_JMPIN, DB_SEC_MAIN_JUMP_TABLE};
+    const UINT32 section_num = sizeof(v1_order)/sizeof(UINT32);
+    SIZE header_size = align_section(get_header_size(section_num));
+    std::vector<UINT8> v2_buf(header_size, 0);
+    SIZE sec_offsets[section_num], sec_sizes[section_num];
+    UINT64 entry_nums[section_num];
+    S_ADDRX v1_ptr = (S_ADDRX)v1_start;
+    for(UINT32 idx = 0; idx<section_num; idx++){
+        sec_offsets[idx] = v2_buf.size();
+        sec_sizes[idx] = convert_v1_section((S_ADDRX)v1_start, v1_size, v1_ptr, v1_order[idx], v2_buf, entry_nums[idx]);
+    }
+    FATAL(v1_ptr!=(S_ADDRX)v1_start+v1_size, "%s has unknown v1 segments!\n", db_path.c_str());
+    munmap((void*)v1_start, v1_size);
+    //3. fill the header and directory
+    S_ADDRX db_start = (S_ADDRX)&v2_buf[0];
+    init_db(db_start, ss_type, std::string(""), section_num);
+    for(UINT32 idx = 0; idx<section_num; idx++)
+        add_section(db_start, idx, v1_order[idx], db_start+sec_offsets[idx], sec_sizes[idx], entry_nums[idx]);
+    SIZE db_size = finish_db(db_start, db_start+v2_buf.size());
+    //4. write into the temp file and rename it atomically
+    std::string tmp_path;
+    INT32 fd = create_tmp_db(db_path, tmp_path);
+    SIZE written = 0;
+    while(written<db_size){
+        ssize_t ret = write(fd, &v2_buf[written], db_size-written);
+        FATAL(ret<=0, "Write %s failed!\n", tmp_path.c_str());
+        written += ret;
+    }
+    close(fd);
+    INT32 ret = rename(tmp_path.c_str(), db_path.c_str());
+    FATAL(ret!=0, "Rename %s failed!\n", tmp_path.c_str());
+    return true;
+}
+
+INT32 DBFormat::create_tmp_db(const std::string &db_path, std::string &tmp_path)
+{
+    //1. mkstemp opens the file with O_CREAT|O_EXCL, so it never follows a planted symlink
+    std::vector<char> tmp_name(db_path.begin(), db_path.end());
+    const char *tmp_suffix = ".XXXXXX";
+    tmp_name.insert(tmp_name.end(), tmp_suffix, tmp_suffix + strlen(tmp_suffix) + 1);
+    INT32 fd = mkstemp(&tmp_name[0]);
+    FATAL(fd==-1, "Create the temp file of %s failed!\n", db_path.c_str());
+    tmp_path = std::string(&tmp_name[0]);
+    //2. mkstemp creates the file with 0600
+    INT32 ret = fchmod(fd, DB_FILE_MODE);
+    FATAL(ret!=0, "Chmod %s failed!\n", tmp_path.c_str());
+    return fd;
+}
+
+static BOOL get_ss_type_from_suffix(const std::string &file_name, UINT32 &ss_type)
+{
+    const char *suffixes[LKM_SS_TYPE_NUM] = {".oss", ".sss", ".pss"};
+    for(UINT32 type = 0; type<LKM_SS_TYPE_NUM; type++){
+        SIZE suffix_len = strlen(suffixes[type]);
+        if(file_name.length()>suffix_len && file_name.compare(file_name.length()-suffix_len, suffix_len, suffixes[type])==0){
+            ss_type = type;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DBFormat::upgrade_db_files(std::string db_path)
+{
+    if(db_path[db_path.length()-1]!='/')
+        db_path += '/';
+    DIR *dir = opendir(db_path.c_str());
+    FATAL(!dir, "%s is not legal directory path!\n", db_path.c_str());
+    SIZE converted_num = 0;
+    struct dirent *entry = NULL;
+    while((entry = readdir(dir))!=NULL){
+        UINT32 ss_type;
+        std::string file_name = std::string(entry->d_name);
+        if(!get_ss_type_from_suffix(file_name, ss_type))
+            continue;
+        if(convert_v1_db(db_path + file_name, ss_type)){
+            INFO("[DB] %s is upgraded to v%d\n", file_name.c_str(), DB_VERSION);
+            converted_num++;
+        }
+    }
+    closedir(dir);
+    INFO("[DB] %ld db files are upgraded in %s\n", converted_num, db_path.c_str());
+}
+
+DBWriter::DBWriter(std::string db_path, UINT32 ss_type, const std::string &elf_id, UINT32 section_num)
+    : _path(db_path), _buf_used(0), _sec_idx(0), _sec_start(0), _sec_crc(0)
+{
+    //1. create the temp file, other applications may read the db (cache) at the same time
+    _fd = DBFormat::create_tmp_db(db_path, _tmp_path);
+    //2. allocate the aligned buffer
+    INT32 ret = posix_memalign((void**)&_buf, X86_PAGE_SIZE, DB_WRITER_BUF_SIZE);
+    FATAL(ret!=0, "Allocate db writer buffer failed!\n");
+    //3. init the header, sections start after the header and directory
+    _header.resize(sizeof(DBFormat::HEADER) + section_num*sizeof(DBFormat::SECTION), 0);
+    _flushed_size = DBFormat::init_db((S_ADDRX)&_header[0], ss_type, elf_id, section_num) - (S_ADDRX)&_header[0];
+}
+
+DBWriter::~DBWriter()
+{
+    free(_buf);
+    //the db is not finished, so the temp file is dropped
+    if(_fd!=-1){
+        close(_fd);
+        unlink(_tmp_path.c_str());
+    }
+}
+
+void DBWriter::flush()
+{
+    SIZE written = 0;
+    while(written<_buf_used){
+        ssize_t ret = pwrite(_fd, _buf+written, _buf_used-written, _flushed_size+written);
+        FATAL(ret<=0, "Write %s failed!\n", _tmp_path.c_str());
+        written += ret;
+    }
+    _flushed_size += _buf_used;
+    _buf_used = 0;
+}
+
+S_ADDRX DBWriter::reserve(SIZE size)
+{
+    FATAL(size>DB_WRITER_BUF_SIZE, "%ld bytes are too large for db writer!\n", size);
+    if(_buf_used+size>DB_WRITER_BUF_SIZE)
+        flush();
+    return (S_ADDRX)(_buf + _buf_used);
+}
+
+void DBWriter::commit(SIZE used_size)
+{
+    ASSERT(_buf_used+used_size<=DB_WRITER_BUF_SIZE);
+    _sec_crc = DBFormat::crc32(_buf+_buf_used, used_size, _sec_crc);
+    _buf_used += used_size;
+}
+
+void DBWriter::begin_section()
+{
+    ASSERT((get_curr_offset()&(DB_SECTION_ALIGN-1))==0);
+    _sec_start = get_curr_offset();
+    _sec_crc = 0;
+}
+
+void DBWriter::end_section(UINT32 type, UINT64 entry_num)
+{
+    DBFormat::HEADER *header = (DBFormat::HEADER*)&_header[0];
+    FATAL(_sec_idx>=header->section_num, "Too many sections in %s!\n", _path.c_str());
+    DBFormat::SECTION *section = (DBFormat::SECTION*)(header+1) + _sec_idx++;
+    section->type = type;
+    section->offset = _sec_start;
+    section->size = get_curr_offset() - _sec_start;
+    section->entry_num = entry_num;
+    section->crc = _sec_crc;
+    //pad the next section with zero
+    SIZE pad_size = align_section(get_curr_offset()) - get_curr_offset();
+    memset((void*)reserve(pad_size), 0, pad_size);
+    _buf_used += pad_size;
+}
+
+SIZE DBWriter::finish()
+{
+    //1. flush the sections
+    flush();
+    //2. seal and write the header
+    DBFormat::HEADER *header = (DBFormat::HEADER*)&_header[0];
+    ASSERT(_sec_idx==header->section_num);
+    header->file_size = _flushed_size;
+    header->header_crc = calculate_header_crc(header);
+    ssize_t ret = pwrite(_fd, &_header[0], _header.size(), 0);
+    FATAL(ret!=(ssize_t)_header.size(), "Write %s header failed!\n", _tmp_path.c_str());
+    //3. close the file
+    INT32 close_ret = close(_fd);
+    FATAL(close_ret!=0, "Close %s failed!\n", _tmp_path.c_str());
+    _fd = -1;
+    //4. rename is atomic
+    INT32 rename_ret = rename(_tmp_path.c_str(), _path.c_str());
+    FATAL(rename_ret!=0, "Rename %s to %s failed!\n", _tmp_path.c_str(), _path.c_str());
+    return header->file_size;
+}
+
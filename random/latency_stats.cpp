@@ -0,0 +1,196 @@
+#include <signal.h>
+#include <string.h>
+
+#include "latency_stats.h"
+
+LatencyHistogram::LatencyHistogram()
+    :_total_count(0), _min(0), _max(0), _sum(0)
+{
+    memset(_counts, 0, sizeof(_counts));
+}
+
+UINT32 LatencyHistogram::get_bucket_idx(UINT64 value)
+{
+    if(value<HIST_SUB_BUCKET_NUM)
+        return (UINT32)value;
+    //value>>exp is in [HIST_HALF_SUB_BUCKET_NUM, HIST_SUB_BUCKET_NUM)
+    UINT32 exp = 63 - __builtin_clzll(value) - (HIST_SUB_BUCKET_BITS - 1);
+    if(exp>HIST_MAX_EXP)
+        return HIST_BUCKET_NUM - 1;
+    return HIST_SUB_BUCKET_NUM + (exp - 1)*HIST_HALF_SUB_BUCKET_NUM + (UINT32)(value>>exp) - HIST_HALF_SUB_BUCKET_NUM;
+}
+
+UINT64 LatencyHistogram::get_bucket_high(UINT32 idx)
+{
+    if(idx<HIST_SUB_BUCKET_NUM)
+        return idx;
+    UINT32 exp = (idx - HIST_SUB_BUCKET_NUM)/HIST_HALF_SUB_BUCKET_NUM + 1;
+    UINT64 sub_bucket = (idx - HIST_SUB_BUCKET_NUM)%HIST_HALF_SUB_BUCKET_NUM + HIST_HALF_SUB_BUCKET_NUM;
+    return ((sub_bucket + 1)<<exp) - 1;
+}
+
+void LatencyHistogram::record(UINT64 value)
+{
+    _counts[get_bucket_idx(value)]++;
+    if(_total_count==0 || value<_min)
+        _min = value;
+    if(value>_max)
+        _max = value;
+    _sum += value;
+    _total_count++;
+}
+
+UINT64 LatencyHistogram::get_percentile(double percentile) const
+{
+    if(_total_count==0)
+        return 0;
+    UINT64 target_count = (UINT64)(percentile/100.0*_total_count + 0.5);
+    if(target_count==0)
+        target_count = 1;
+    UINT64 curr_count = 0;
+    for(UINT32 idx = 0; idx<HIST_BUCKET_NUM; idx++){
+        curr_count += _counts[idx];
+        if(curr_count>=target_count){
+            UINT64 value = get_bucket_high(idx);
+            return value<_max ? value : _max;
+        }
+    }
+    return _max;
+}
+
+void LatencyHistogram::dump(FILE *fp, const char *name, const char *unit) const
+{
+    fprintf(fp, "{\"name\": \"%s\", \"unit\": \"%s\", \"count\": %llu, \"min\": %llu, \"mean\": %llu, ", name, unit, \
+        _total_count, _min, _total_count==0 ? 0 : _sum/_total_count);
+    fprintf(fp, "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, \"buckets\": [", \
+        get_percentile(50), get_percentile(90), get_percentile(99), get_percentile(99.9), _max);
+    BOOL is_first = true;
+    for(UINT32 idx = 0; idx<HIST_BUCKET_NUM; idx++){
+        if(_counts[idx]==0)
+            continue;
+        fprintf(fp, "%s[%llu, %llu]", is_first ? "" : ", ", get_bucket_high(idx), _counts[idx]);
+        is_first = false;
+    }
+    fprintf(fp, "]}");
+}
+
+BOOL LatencyStats::_is_enabled = false;
+std::string LatencyStats::_log_path;
+LatencyHistogram LatencyStats::_phases[PHASE_NUM];
+LatencyStats::MODULE_HISTOGRAMS LatencyStats::_modules;
+LatencyHistogram LatencyStats::_layouts[LAYOUT_COUNTER_NUM];
+pthread_mutex_t LatencyStats::_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_t LatencyStats::_dump_thread;
+const char *LatencyStats::_phase_names[PHASE_NUM] = {
+    "stop_total", "wait_cv", "translate_pc", "patch_ss", "patch_pc", "gen_cv",
+};
+const char *LatencyStats::_layout_names[LAYOUT_COUNTER_NUM] = {
+    "rbbl_num", "eliminated_jmp_num", "relaxed_br_num", "tail_br_num", "relaxed_bytes",
+};
+static volatile BOOL need_stop_dump = false;
+
+void *LatencyStats::wait_for_dump_signal(void *arg)
+{
+    sigset_t *sigset = (sigset_t*)arg;
+    INT32 sig;
+    while(1){
+        sigwait(sigset, &sig);
+        if(need_stop_dump)
+            break;
+        dump();
+    }
+    return NULL;
+}
+
+void LatencyStats::init(std::string log_path)
+{
+    _log_path = log_path;
+    _is_enabled = true;
+    //1. block SIGUSR1, so it is only received by the dump thread
+    static sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);
+    INT32 ret = pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+    FATAL(ret!=0, "pthread_sigmask failed!\n");
+    //2. create the dump thread
+    need_stop_dump = false;
+    ret = pthread_create(&_dump_thread, NULL, wait_for_dump_signal, (void*)&sigset);
+    FATAL(ret!=0, "pthread_create failed!\n");
+}
+
+void LatencyStats::record(PHASE phase, UINT64 start_ns, UINT64 end_ns)
+{
+    if(!_is_enabled)
+        return ;
+    pthread_mutex_lock(&_mutex);
+    _phases[phase].record(end_ns - start_ns);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void LatencyStats::record_module(const std::string &module_name, UINT64 time_ns)
+{
+    if(!_is_enabled)
+        return ;
+    pthread_mutex_lock(&_mutex);
+    MODULE_HISTOGRAMS::iterator iter = _modules.find(module_name);
+    if(iter==_modules.end())
+        iter = _modules.insert(std::make_pair(module_name, new LatencyHistogram())).first;
+    iter->second->record(time_ns);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void LatencyStats::record_layout(const UINT64 counters[LAYOUT_COUNTER_NUM])
+{
+    if(!_is_enabled)
+        return ;
+    pthread_mutex_lock(&_mutex);
+    for(INT32 counter = 0; counter<LAYOUT_COUNTER_NUM; counter++)
+        _layouts[counter].record(counters[counter]);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void LatencyStats::dump()
+{
+    FILE *fp = fopen(_log_path.c_str(), "w");
+    if(!fp){
+        ERR("Failed to open latency log %s!\n", _log_path.c_str());
+        return ;
+    }
+    pthread_mutex_lock(&_mutex);
+    fprintf(fp, "{\"phases\": [\n");
+    for(INT32 phase = 0; phase<PHASE_NUM; phase++){
+        fprintf(fp, "  ");
+        _phases[phase].dump(fp, _phase_names[phase]);
+        fprintf(fp, "%s\n", phase==PHASE_NUM-1 ? "" : ",");
+    }
+    fprintf(fp, "],\n\"modules\": [\n");
+    for(MODULE_HISTOGRAMS::iterator iter = _modules.begin(); iter!=_modules.end(); iter++){
+        fprintf(fp, "%s  ", iter==_modules.begin() ? "" : ",\n");
+        iter->second->dump(fp, iter->first.c_str());
+    }
+    fprintf(fp, "\n],\n\"layouts\": [\n");
+    for(INT32 counter = 0; counter<LAYOUT_COUNTER_NUM; counter++){
+        fprintf(fp, "  ");
+        _layouts[counter].dump(fp, _layout_names[counter], "count");
+        fprintf(fp, "%s\n", counter==LAYOUT_COUNTER_NUM-1 ? "" : ",");
+    }
+    fprintf(fp, "]}\n");
+    pthread_mutex_unlock(&_mutex);
+    fclose(fp);
+}
+
+void LatencyStats::destroy()
+{
+    if(!_is_enabled)
+        return ;
+    //1. stop the dump thread
+    need_stop_dump = true;
+    pthread_kill(_dump_thread, SIGUSR1);
+    pthread_join(_dump_thread, NULL);
+    //2. dump at exit and free
+    dump();
+    for(MODULE_HISTOGRAMS::iterator iter = _modules.begin(); iter!=_modules.end(); iter++)
+        delete iter->second;
+    _modules.clear();
+    _is_enabled = false;
+}
@@ -20,7 +20,7 @@ struct msghdr NetLink::msg = {0};
 
 extern std::string get_real_name_from_path(std::string path);
 
-void NetLink::connect_with_lkm(std::string elf_path)
+void NetLink::connect_with_lkm(std::string elf_path, UINT32 cv_num, BOOL use_huge_page)
 {
 	// 1.open socket
     sock_fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_USER);
@@ -48,9 +48,9 @@ void NetLink::connect_with_lkm(std::string elf_path)
     msg.msg_namelen = sizeof(dest_addr);
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
-    // 6.connect with lkm
+    // 6.connect with lkm, cc_offset is the number of code variants in the ring, ss_offset tells lkm to advise huge pages
     std::string name = get_real_name_from_path(elf_path);
-    MESG_BAG mesg = {CONNECT, 0, 0, {0}, 0, 0, 0, LKM_OFFSET_SS_TYPE, "\0", "Connect with LKM"};
+    MESG_BAG mesg = {CONNECT, 0, 0, {0}, (long)cv_num, use_huge_page ? 1 : 0, 0, LKM_OFFSET_SS_TYPE, "\0", "Connect with LKM"};
     ASSERT(name.length()<=256);
     strcpy(mesg.app_name, name.c_str());
     NetLink::send_mesg(mesg);
@@ -64,11 +64,10 @@ void NetLink::send_mesg(MESG_BAG mesg)
     sendmsg(sock_fd, &msg, 0);
 }
 
-void NetLink::send_cv_ready_mesg(int protected_pid, BOOL is_cv1, long new_pc, long additional_ips[MAX_STOP_NUM], std::string elf_path)
+void NetLink::send_cv_ready_mesg(int protected_pid, UINT32 cv_id, long new_pc, long additional_ips[MAX_STOP_NUM], std::string elf_path)
 {
     std::string name = get_real_name_from_path(elf_path);
-    int cvn_ready = is_cv1 ? CV1_IS_READY : CV2_IS_READY;
-    MESG_BAG msg_content = {cvn_ready, protected_pid, new_pc, {0}, 0, 0, 0, LKM_OFFSET_SS_TYPE, "\0", "Code variant is ready!"};
+    MESG_BAG msg_content = {CV_IS_READY, protected_pid, new_pc, {0}, (long)cv_id, 0, 0, LKM_OFFSET_SS_TYPE, "\0", "Code variant is ready!"};
     strcpy(msg_content.app_name, name.c_str());
     memcpy(msg_content.additional_ips, additional_ips, MAX_STOP_NUM*sizeof(long));
     send_mesg(msg_content);
@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "random_generator.h"
+
+#ifndef SYS_getrandom
+#define SYS_getrandom 318
+#endif
+
+__thread UINT64 RandomGenerator::_state[4];
+__thread BOOL RandomGenerator::_has_seeded = false;
+
+UINT64 RandomGenerator::splitmix64(UINT64 &x)
+{
+    UINT64 z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z>>30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z>>27))*0x94d049bb133111ebULL;
+    return z ^ (z>>31);
+}
+
+void RandomGenerator::seed_from_os()
+{
+    UINT64 seed_value[2];
+    //1. getrandom is not supported by old kernels, so read /dev/urandom instead
+    long ret = syscall(SYS_getrandom, seed_value, sizeof(seed_value), 0);
+    if(ret!=(long)sizeof(seed_value)){
+        INT32 fd = open("/dev/urandom", O_RDONLY);
+        FATAL(fd<0, "open /dev/urandom failed!\n");
+        ret = read(fd, seed_value, sizeof(seed_value));
+        FATAL(ret!=(long)sizeof(seed_value), "read /dev/urandom failed!\n");
+        close(fd);
+    }
+    //2. expand the seed into the state
+    seed(seed_value[0], seed_value[1]);
+}
+
+void RandomGenerator::seed(UINT64 seed, UINT64 stream)
+{
+    UINT64 x = seed ^ splitmix64(stream);
+    for(INT32 idx = 0; idx<4; idx++)
+        _state[idx] = splitmix64(x);
+    _has_seeded = true;
+}
+
+UINT64 RandomGenerator::next()
+{
+    if(!_has_seeded)
+        seed_from_os();
+    UINT64 result = rotl(_state[1]*5, 7)*9;
+    UINT64 t = _state[1]<<17;
+    _state[2] ^= _state[0];
+    _state[3] ^= _state[1];
+    _state[1] ^= _state[2];
+    _state[0] ^= _state[3];
+    _state[2] ^= t;
+    _state[3] = rotl(_state[3], 45);
+    return result;
+}
+
+UINT64 RandomGenerator::next_bounded(UINT64 bound)
+{
+    ASSERT(bound!=0);
+    __uint128_t m = (__uint128_t)next()*bound;
+    UINT64 low = (UINT64)m;
+    if(low<bound){
+        //reject the draws in the biased low part, threshold is 2^64 mod bound
+        UINT64 threshold = (0 - bound)%bound;
+        while(low<threshold){
+            m = (__uint128_t)next()*bound;
+            low = (UINT64)m;
+        }
+    }
+    return (UINT64)(m>>64);
+}
+
+UINT64 RandomGenerator::hash_string(const std::string &str)
+{
+    UINT64 hash = 0xcbf29ce484222325ULL;
+    for(SIZE idx = 0; idx<str.length(); idx++){
+        hash ^= (UINT8)str[idx];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -1,3 +1,7 @@
+#include <string.h>
+#include <new>
+#include <algorithm>
+
 #include "relocation.h"
 #include "utility.h"
 #include "disassembler.h"
@@ -5,7 +9,20 @@
 RandomBBL::RandomBBL(F_SIZE origin_start, F_SIZE origin_end, BOOL has_lock_and_repeat_prefix, BOOL has_fallthrough_bbl, \
     std::vector<BBL_RELA> reloc_info, std::string random_template)
     :_origin_bbl_start(origin_start), _origin_bbl_end(origin_end), _has_lock_and_repeat_prefix(has_lock_and_repeat_prefix), \
-        _has_fallthrough_bbl(has_fallthrough_bbl), _reloc_table(reloc_info), _random_template(random_template)
+        _has_fallthrough_bbl(has_fallthrough_bbl), _reloc_table(reloc_info), _random_template(random_template), \
+        _slot(0), _reloc_slots(NULL)
+{
+    _reloc_ptr = _reloc_table.empty() ? NULL : &_reloc_table[0];
+    _reloc_num = _reloc_table.size();
+    _template_ptr = (const UINT8*)_random_template.data();
+    _template_len = _random_template.length();
+}
+
+RandomBBL::RandomBBL(F_SIZE origin_start, F_SIZE origin_end, BOOL has_lock_and_repeat_prefix, BOOL has_fallthrough_bbl, \
+    const BBL_RELA *reloc_ptr, SIZE reloc_num, const UINT8 *template_ptr, SIZE template_len)
+    :_origin_bbl_start(origin_start), _origin_bbl_end(origin_end), _has_lock_and_repeat_prefix(has_lock_and_repeat_prefix), \
+        _has_fallthrough_bbl(has_fallthrough_bbl), _reloc_ptr(reloc_ptr), _reloc_num(reloc_num), _template_ptr(template_ptr), \
+        _template_len(template_len), _slot(0), _reloc_slots(NULL)
 {
     ;
 }
@@ -15,15 +32,69 @@ RandomBBL::~RandomBBL()
     ;
 }
 
-static inline S_ADDRX get_saddr_from_offset(F_SIZE offset, RBBL_CC_MAPS &rbbl_maps)
+SIZE RandomBBL::init_slots(RBBL_SLOT slot, RBBL_SLOT *reloc_slots, const F_SIZE *slot_offsets, SIZE slot_num)
+{
+    SIZE unresolved_num = 0;
+    for(SIZE idx = 0; idx<_reloc_num; idx++){
+        const BBL_RELA &rela = _reloc_ptr[idx];
+        RBBL_SLOT target_slot = (RBBL_SLOT)slot_num;
+        switch(rela.r_type){
+            case BRANCH_RELA_TYPE:
+            case HIGH32_CC_RELA_TYPE:
+            case LOW32_CC_RELA_TYPE:
+                //if has no fallthrough instruction, the cc address targets the invalid instruction
+                if(rela.r_type==BRANCH_RELA_TYPE || _has_fallthrough_bbl){
+                    const F_SIZE *ret = std::lower_bound(slot_offsets, slot_offsets + slot_num, (F_SIZE)rela.r_value);
+                    if(ret!=slot_offsets+slot_num && *ret==(F_SIZE)rela.r_value)
+                        target_slot = ret - slot_offsets;
+                    else{
+                        //release builds report the unresolved targets once per module (init_rbbl_slots)
+                        ASSERTM(0, "rbbl(offset: %lx) find failed!\n", (F_SIZE)rela.r_value);
+                        unresolved_num++;
+                    }
+                }
+                break;
+            default: break;
+        }
+        reloc_slots[idx] = target_slot;
+    }
+    _slot = slot;
+    _reloc_slots = reloc_slots;
+    return unresolved_num;
+}
+
+#define JMP_REL32_OPCODE 0xe9
+#define JMP_REL8_OPCODE 0xeb
+#define JCC_REL32_ESCAPE 0x0f
+#define JCC_REL8_OPCODE_BASE 0x70
+#define JMP_REL32_INSTR_LEN 5
+#define JMP_REL32_RELAXED_SIZE 3//jmp rel32 (5 bytes) -> jmp rel8 (2 bytes)
+#define JCC_REL32_RELAXED_SIZE 4//jcc rel32 (6 bytes) -> jcc rel8 (2 bytes)
+
+INT32 RandomBBL::get_tail_branch(BOOL has_reduce_jmp, SIZE &relaxed_size) const
 {
-    RBBL_CC_MAPS::iterator ret = rbbl_maps.find(offset);
-    ASSERTM(ret!=rbbl_maps.end(), "rbbl(offset: %lx) find failed!\n", offset);
-    return ret->second;
+    //1. the trailing branch is the last relocation, or the one before the reduced jmp rel32
+    INT32 idx = (INT32)_reloc_num - (has_reduce_jmp ? 2 : 1);
+    if(idx<0)
+        return -1;
+    const BBL_RELA &rela = _reloc_ptr[idx];
+    SIZE gen_len = has_reduce_jmp ? _template_len - JMP_REL32_INSTR_LEN : _template_len;
+    if(rela.r_type!=BRANCH_RELA_TYPE || rela.r_byte_size!=4 || (SIZE)(rela.r_byte_pos + 4)!=gen_len)
+        return -1;
+    //2. judge the opcode, call rel32 can not be relaxed
+    SIZE pos = rela.r_byte_pos;
+    if(pos>=1 && _template_ptr[pos-1]==JMP_REL32_OPCODE){
+        relaxed_size = JMP_REL32_RELAXED_SIZE;
+        return idx;
+    }else if(pos>=2 && _template_ptr[pos-2]==JCC_REL32_ESCAPE && (_template_ptr[pos-1]&0xf0)==0x80){
+        relaxed_size = JCC_REL32_RELAXED_SIZE;
+        return idx;
+    }else
+        return -1;
 }
 
 void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_ADDRX orig_x_load_base, \
-    P_SIZE cc_offset, P_SIZE ss_offset, P_ADDRX gs_base, LKM_SS_TYPE ss_type, RBBL_CC_MAPS &rbbl_maps, P_SIZE jmpin_offset)
+    P_SIZE cc_offset, P_SIZE ss_offset, P_ADDRX gs_base, LKM_SS_TYPE ss_type, const S_ADDRX *rbbl_addrs, P_SIZE jmpin_offset)
 {
     //code cache address in protected process
     P_ADDRX cc_load_base = orig_x_load_base + cc_offset;
@@ -39,15 +110,40 @@ void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_A
     P_ADDRX curr_rbbl_in_prot = gen_addr - cc_base + cc_load_base;
     //the load address of origin bbl in protected process
     P_ADDRX curr_bbl_in_prot = orig_x_load_base + _origin_bbl_start;
-    //1. copy template to target address
-    ASSERT(gen_size>=_random_template.size() || gen_size==(_random_template.size()-5));//optimize
-    _random_template.copy((INT8 *)gen_addr, gen_size);
+    //1. copy template to target address, the reduced size is the sum of the reduced last jmp rel32 (5 bytes) and the relaxed
+    //   trailing branch (3 or 4 bytes), so both of them are decoded from the gen_size
+    SIZE reduced_size = gen_size<_template_len ? _template_len - gen_size : 0;
+    BOOL has_reduce_jmp = reduced_size>=JMP_REL32_INSTR_LEN;
+    INT32 tail_idx = -1;
+    if(reduced_size!=(has_reduce_jmp ? JMP_REL32_INSTR_LEN : 0)){
+        SIZE relaxed_size = 0;
+        tail_idx = get_tail_branch(has_reduce_jmp, relaxed_size);
+        FATAL(tail_idx<0 || reduced_size!=((has_reduce_jmp ? JMP_REL32_INSTR_LEN : 0) + relaxed_size), \
+            "wrong generated size %d of rbbl 0x%lx (template size %d)!\n", (INT32)gen_size, _origin_bbl_start, (INT32)_template_len);
+    }
+    if(tail_idx<0)
+        memcpy((void*)gen_addr, _template_ptr, gen_size<_template_len ? gen_size : _template_len);
+    else{
+        //generate the rel8 form of the trailing branch, it ends at the end of the generated code
+        const BBL_RELA &rela = _reloc_ptr[tail_idx];
+        BOOL is_jmp = _template_ptr[rela.r_byte_pos-1]==JMP_REL32_OPCODE;
+        SIZE branch_pos = rela.r_byte_pos - (is_jmp ? 1 : 2);
+        memcpy((void*)gen_addr, _template_ptr, branch_pos);
+        UINT8 *branch_addr = (UINT8*)(gen_addr + branch_pos);
+        branch_addr[0] = is_jmp ? JMP_REL8_OPCODE : (JCC_REL8_OPCODE_BASE | (_template_ptr[rela.r_byte_pos-1]&0xf));
+        INT64 offset64 = rbbl_addrs[_reloc_slots[tail_idx]] - (gen_addr + gen_size);
+        FATAL(offset64<-128 || offset64>127, "relaxed branch of rbbl 0x%lx is out of rel8 range!\n", _origin_bbl_start);
+        branch_addr[1] = (UINT8)(INT8)offset64;
+    }
     //2. relocate the rbbl
-    for(BBL_RELA_VEC_ITER iter = _reloc_table.begin(); iter!=_reloc_table.end(); iter++){
-        BBL_RELA &rela = *iter;
+    for(SIZE idx = 0; idx<_reloc_num; idx++){
+        const BBL_RELA &rela = _reloc_ptr[idx];
+        //trailing branch is relaxed
+        if((INT32)idx==tail_idx)
+            continue;
         //last relocation is reduced by optimzation
         if(rela.r_byte_pos>=gen_size){
-            ASSERT(rela.r_byte_pos==(gen_size+1));//JMP_REL32
+            ASSERT(has_reduce_jmp && rela.r_byte_pos==(_template_len-4));//JMP_REL32
             break;
         }
         S_ADDRX reloc_addr = rela.r_byte_pos + gen_addr;
@@ -67,8 +163,7 @@ void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_A
                     //r_addend    = -Offset, r_value = target_addr
                     ASSERTM(rela.r_byte_size==4, "we only handle 32bits branch(loop loopnz... is not considered)!\n");
                     //find target rbbl in protected process
-                    F_SIZE target_bbl_offset = rela.r_value;
-                    S_ADDRX target_rbbl_in_shuf = get_saddr_from_offset(target_bbl_offset, rbbl_maps);
+                    S_ADDRX target_rbbl_in_shuf = rbbl_addrs[_reloc_slots[idx]];
                     P_ADDRX target_rbbl_in_prot = target_rbbl_in_shuf - cc_base + cc_load_base;
                     //obtain the offset
                     INT32 new_rel32 = target_rbbl_in_prot - curr_rbbl_in_prot + rela.r_addend;
@@ -91,10 +186,8 @@ void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_A
                 break;
             case HIGH32_CC_RELA_TYPE:
                 {
-                    //find target rbbl in protected process
-                    F_SIZE target_bbl_offset = rela.r_value;
-                    //if has no fallthrough instruction insert invalid instruction 
-                    S_ADDRX target_rbbl_in_shuf = _has_fallthrough_bbl ? get_saddr_from_offset(target_bbl_offset, rbbl_maps) : cc_base;
+                    //find target rbbl in protected process (slot of invalid instruction if has no fallthrough instruction)
+                    S_ADDRX target_rbbl_in_shuf = rbbl_addrs[_reloc_slots[idx]];
                     P_ADDRX target_rbbl_in_prot = target_rbbl_in_shuf - cc_base + cc_load_base;
                     //relocate
                     *(INT32*)reloc_addr = (INT32)(target_rbbl_in_prot>>32);
@@ -102,10 +195,8 @@ void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_A
                 break;
             case LOW32_CC_RELA_TYPE:
                 {
-                    //find target rbbl in protected process
-                    F_SIZE target_bbl_offset = rela.r_value;
-                    //if has no fallthrough instruction insert invalid instruction 
-                    S_ADDRX target_rbbl_in_shuf = _has_fallthrough_bbl ? get_saddr_from_offset(target_bbl_offset, rbbl_maps) : cc_base;
+                    //find target rbbl in protected process (slot of invalid instruction if has no fallthrough instruction)
+                    S_ADDRX target_rbbl_in_shuf = rbbl_addrs[_reloc_slots[idx]];
                     P_ADDRX target_rbbl_in_prot = target_rbbl_in_shuf - cc_base + cc_load_base;
                     //relocate
                     *(INT32*)reloc_addr = (INT32)target_rbbl_in_prot;
@@ -153,43 +244,88 @@ void RandomBBL::gen_code(S_ADDRX cc_base, S_ADDRX gen_addr, S_SIZE gen_size, P_A
     }
 }
 
-RandomBBL *RandomBBL::read_rbbl(S_ADDRX r_addrx, SIZE &used_size)
+//bbl start, bbl end, prefix, fallthrough and table size
+#define RBBL_RECORD_HEAD_SIZE (2*sizeof(UINT32) + 2*sizeof(UINT8) + sizeof(UINT16))
+
+//the record must end before r_end (the end of its section), the zero-copy db skips the crcs of sections, so a truncated
+//or broken record is rejected before reading past the section
+static SIZE parse_rbbl_record(S_ADDRX r_addrx, S_ADDRX r_end, F_SIZE &origin_bbl_start, F_SIZE &origin_bbl_end, \
+    BOOL &has_lock_and_repeat_prefix, BOOL &has_fallthrough_bbl, const BBL_RELA *&reloc_ptr, SIZE &table_size, \
+    const UINT8 *&template_ptr, SIZE &template_len)
 {
     UINT32 *ptr_32 = NULL;
     UINT8 *ptr_8 = NULL;
     UINT16 *ptr_16 = NULL;
-    BBL_RELA *ptr_rela = NULL;
+    FATAL(r_addrx>r_end || r_end-r_addrx<RBBL_RECORD_HEAD_SIZE, "rbbl record (%lx) exceeds the section end!\n", r_addrx);
     //1. read bbl start
     ptr_32 = (UINT32*)r_addrx;
-    F_SIZE origin_bbl_start = (F_SIZE)*ptr_32++;
+    origin_bbl_start = (F_SIZE)*ptr_32++;
     //2. read bbl end
-    F_SIZE origin_bbl_end = (F_SIZE)*ptr_32++;
+    origin_bbl_end = (F_SIZE)*ptr_32++;
     //3. read prefix    
     ptr_8 = (UINT8*)ptr_32;
-    BOOL has_lock_and_repeat_prefix = *ptr_8++;
+    has_lock_and_repeat_prefix = *ptr_8++;
     //4. read fallthrough    
-    BOOL has_fallthrough_bbl = *ptr_8++;
+    has_fallthrough_bbl = *ptr_8++;
     //5. read relocation information
      //5.1 read table size
     ptr_16 = (UINT16*)ptr_8;
-    SIZE table_size = *ptr_16++;
-    BBL_RELA_VEC reloc_vec;
+    table_size = *ptr_16++;
      //5.2 read reloction
-    ptr_rela = (BBL_RELA*)ptr_16;
-    for(SIZE index = 0; index<table_size; index++)
-        reloc_vec.push_back(*ptr_rela++);
+    reloc_ptr = (const BBL_RELA*)ptr_16;
+    FATAL((S_ADDRX)(reloc_ptr + table_size) + sizeof(UINT16)>r_end, "relocations of rbbl record (%lx) exceed the section end!\n", r_addrx);
     //6. read template information
      //6.1 read template size
-    ptr_16 = (UINT16*)ptr_rela;
-    SIZE template_len = (SIZE)*ptr_16++;
+    ptr_16 = (UINT16*)(reloc_ptr + table_size);
+    template_len = (SIZE)*ptr_16++;
      //6.2 read template byte
-    std::string random_template = std::string((const INT8 *)ptr_16, template_len);
-    //7. set used size
-    used_size = (S_ADDRX)ptr_16 + template_len - r_addrx;
+    template_ptr = (const UINT8*)ptr_16;
+    FATAL((S_ADDRX)template_ptr + template_len>r_end, "template of rbbl record (%lx) exceeds the section end!\n", r_addrx);
+    //7. return used size
+    return (S_ADDRX)ptr_16 + template_len - r_addrx;
+}
+
+RandomBBL *RandomBBL::read_rbbl(S_ADDRX r_addrx, S_ADDRX r_end, SIZE &used_size)
+{
+    F_SIZE origin_bbl_start, origin_bbl_end;
+    BOOL has_lock_and_repeat_prefix, has_fallthrough_bbl;
+    const BBL_RELA *reloc_ptr = NULL;
+    const UINT8 *template_ptr = NULL;
+    SIZE table_size, template_len;
+    used_size = parse_rbbl_record(r_addrx, r_end, origin_bbl_start, origin_bbl_end, has_lock_and_repeat_prefix, has_fallthrough_bbl, \
+        reloc_ptr, table_size, template_ptr, template_len);
+    //copy relocations and template
+    BBL_RELA_VEC reloc_vec(reloc_ptr, reloc_ptr + table_size);
+    std::string random_template = std::string((const INT8 *)template_ptr, template_len);
     
     return new RandomBBL(origin_bbl_start, origin_bbl_end, has_lock_and_repeat_prefix, has_fallthrough_bbl, reloc_vec, random_template);
 }
 
+RandomBBL *RandomBBL::read_rbbl_view(S_ADDRX r_addrx, S_ADDRX r_end, void *view_place, SIZE &used_size)
+{
+    F_SIZE origin_bbl_start, origin_bbl_end;
+    BOOL has_lock_and_repeat_prefix, has_fallthrough_bbl;
+    const BBL_RELA *reloc_ptr = NULL;
+    const UINT8 *template_ptr = NULL;
+    SIZE table_size, template_len;
+    used_size = parse_rbbl_record(r_addrx, r_end, origin_bbl_start, origin_bbl_end, has_lock_and_repeat_prefix, has_fallthrough_bbl, \
+        reloc_ptr, table_size, template_ptr, template_len);
+    
+    return new (view_place) RandomBBL(origin_bbl_start, origin_bbl_end, has_lock_and_repeat_prefix, has_fallthrough_bbl, \
+        table_size==0 ? NULL : reloc_ptr, table_size, template_ptr, template_len);
+}
+
+SIZE RandomBBL::get_rbbl_record_size(S_ADDRX r_addrx, S_ADDRX r_end)
+{
+    F_SIZE origin_bbl_start, origin_bbl_end;
+    BOOL has_lock_and_repeat_prefix, has_fallthrough_bbl;
+    const BBL_RELA *reloc_ptr = NULL;
+    const UINT8 *template_ptr = NULL;
+    SIZE table_size, template_len;
+    return parse_rbbl_record(r_addrx, r_end, origin_bbl_start, origin_bbl_end, has_lock_and_repeat_prefix, has_fallthrough_bbl, \
+        reloc_ptr, table_size, template_ptr, template_len);
+}
+
 SIZE RandomBBL::store_rbbl(S_ADDRX s_addrx)
 {
     UINT32 *ptr_32 = NULL;
@@ -208,22 +344,22 @@ SIZE RandomBBL::store_rbbl(S_ADDRX s_addrx)
     *ptr_8++ = (UINT8)_has_fallthrough_bbl;
     //5. store relocation information
     //5.1 store table size
-    SIZE table_size = _reloc_table.size();
+    SIZE table_size = _reloc_num;
     ASSERT(table_size<USHRT_MAX);
     ptr_16 = (UINT16*)ptr_8;
     *ptr_16++ = (UINT16)table_size;
     //5.2 store reloction
     ptr_rela = (BBL_RELA*)ptr_16;
-    for(BBL_RELA_VEC::iterator iter = _reloc_table.begin(); iter!=_reloc_table.end(); iter++)
-        *ptr_rela++ = *iter;
+    for(SIZE idx = 0; idx<_reloc_num; idx++)
+        *ptr_rela++ = _reloc_ptr[idx];
     //6. store template information
     //6.1 store template size
-    SIZE template_len = _random_template.length();
+    SIZE template_len = _template_len;
     ASSERT(template_len<USHRT_MAX);
     ptr_16 = (UINT16*)ptr_rela;
     *ptr_16++ = (UINT16)template_len;
     //6.2 store template byte
-    _random_template.copy((INT8 *)ptr_16, template_len);
+    memcpy((void*)ptr_16, _template_ptr, template_len);
     
     return (S_ADDRX)ptr_16 + template_len - s_addrx;
 }
@@ -231,8 +367,8 @@ SIZE RandomBBL::store_rbbl(S_ADDRX s_addrx)
 void RandomBBL::dump_template(P_ADDRX relocation_base)
 {
     ERR("RandomBBL: origin_bbl_range[%lx, %lx) template_size(%d) relocation_num(%d)\n", \
-        _origin_bbl_start, _origin_bbl_end, (INT32)_random_template.length(), (INT32)_reloc_table.size());
-    Disassembler::dump_string(_random_template, relocation_base); 
+        _origin_bbl_start, _origin_bbl_end, (INT32)_template_len, (INT32)_reloc_num);
+    Disassembler::dump_string(std::string((const INT8 *)_template_ptr, _template_len), relocation_base); 
 }
 
 static std::string type_to_string[] = {
@@ -251,10 +387,10 @@ static std::string type_to_string[] = {
 
 void RandomBBL::dump_relocation()
 {
-    INT32 entry_num = (INT32)_reloc_table.size();
+    INT32 entry_num = (INT32)_reloc_num;
     ERR(" No          Type           RelaPos RelaSize   Addend            Value\n");
     for(INT32 idx = 0; idx!=entry_num; idx++){
-        BBL_RELA &rela = _reloc_table[idx];
+        const BBL_RELA &rela = _reloc_ptr[idx];
         PRINT("%3d %22s %8x %8d %8x %16llx\n", idx, type_to_string[rela.r_type].c_str(), rela.r_byte_pos, rela.r_byte_size, \
             rela.r_addend, rela.r_value);
     }
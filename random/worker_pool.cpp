@@ -0,0 +1,206 @@
+#include <unistd.h>
+
+#include "worker_pool.h"
+
+INT32 WorkerPool::_thread_num = 0;
+pthread_t *WorkerPool::_threads = NULL;
+WorkerPool::WORKER_QUEUE *WorkerPool::_queues = NULL;
+volatile SIZE WorkerPool::_queued_num = 0;
+volatile UINT32 WorkerPool::_next_queue = 0;
+BOOL WorkerPool::_need_stop = false;
+pthread_mutex_t WorkerPool::_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t WorkerPool::_idle_cond = PTHREAD_COND_INITIALIZER;
+
+BOOL WorkerPool::pop_task(INT32 queue_idx, PRIORITY priority, TASK &task)
+{
+    WORKER_QUEUE &queue = _queues[queue_idx];
+    std::deque<TASK> &tasks = queue.tasks[priority];
+    BOOL has_task = false;
+    pthread_mutex_lock(&queue.mutex);
+    if(!tasks.empty()){
+        //the owner handles its tasks in the submitted order
+        task = tasks.front();
+        tasks.pop_front();
+        has_task = true;
+    }
+    pthread_mutex_unlock(&queue.mutex);
+    if(has_task)
+        __sync_fetch_and_sub(&_queued_num, 1);
+    return has_task;
+}
+
+BOOL WorkerPool::steal_task(INT32 queue_idx, PRIORITY priority, TASK &task)
+{
+    //steal from the back of the other queues
+    for(INT32 num = 0; num<_thread_num; num++){
+        INT32 victim = (queue_idx + 1 + num)%_thread_num;
+        if(victim==queue_idx)
+            continue;
+        WORKER_QUEUE &queue = _queues[victim];
+        std::deque<TASK> &tasks = queue.tasks[priority];
+        BOOL has_task = false;
+        pthread_mutex_lock(&queue.mutex);
+        if(!tasks.empty()){
+            task = tasks.back();
+            tasks.pop_back();
+            has_task = true;
+        }
+        pthread_mutex_unlock(&queue.mutex);
+        if(has_task){
+            __sync_fetch_and_sub(&_queued_num, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+BOOL WorkerPool::get_task(INT32 queue_idx, TASK &task)
+{
+    //the high priority tasks of all queues are handled before the own normal tasks
+    for(INT32 priority = HIGH_PRIORITY; priority<PRIORITY_NUM; priority++){
+        if(pop_task(queue_idx, (PRIORITY)priority, task) || steal_task(queue_idx, (PRIORITY)priority, task))
+            return true;
+    }
+    return false;
+}
+
+BOOL WorkerPool::take_batch_task(BATCH *batch, PRIORITY priority, TASK &task)
+{
+    for(INT32 queue_idx = 0; queue_idx<_thread_num; queue_idx++){
+        WORKER_QUEUE &queue = _queues[queue_idx];
+        std::deque<TASK> &tasks = queue.tasks[priority];
+        BOOL has_task = false;
+        pthread_mutex_lock(&queue.mutex);
+        for(std::deque<TASK>::reverse_iterator iter = tasks.rbegin(); iter!=tasks.rend(); iter++){
+            if(iter->batch==batch){
+                task = *iter;
+                tasks.erase(--iter.base());
+                has_task = true;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&queue.mutex);
+        if(has_task){
+            __sync_fetch_and_sub(&_queued_num, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::execute_task(TASK &task)
+{
+    task.handler(task.ctx, task.idx);
+    //the batch lives in the stack of the submitter, so it is only touched under its mutex
+    BATCH *batch = task.batch;
+    pthread_mutex_lock(&batch->mutex);
+    if(--batch->remaining==0)
+        pthread_cond_signal(&batch->done);
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+void *WorkerPool::worker_loop(void *arg)
+{
+    INT32 queue_idx = (INT32)(S_ADDRX)arg;
+    TASK task;
+    while(1){
+        if(get_task(queue_idx, task)){
+            execute_task(task);
+            continue;
+        }
+        //sleep until tasks are submitted
+        pthread_mutex_lock(&_idle_mutex);
+        while(_queued_num==0 && !_need_stop)
+            pthread_cond_wait(&_idle_cond, &_idle_mutex);
+        BOOL need_stop = _need_stop && _queued_num==0;
+        pthread_mutex_unlock(&_idle_mutex);
+        if(need_stop)
+            break;
+    }
+    return NULL;
+}
+
+void WorkerPool::init(INT32 thread_num)
+{
+    ASSERT(_threads==NULL);
+    if(thread_num<=0){
+        INT32 cpu_num = (INT32)sysconf(_SC_NPROCESSORS_ONLN);
+        thread_num = cpu_num>1 ? cpu_num : 1;
+    }
+    _thread_num = thread_num;
+    _need_stop = false;
+    _queues = new WORKER_QUEUE[_thread_num];
+    for(INT32 idx = 0; idx<_thread_num; idx++)
+        pthread_mutex_init(&_queues[idx].mutex, NULL);
+    _threads = new pthread_t[_thread_num];
+    for(INT32 idx = 0; idx<_thread_num; idx++){
+        INT32 ret = pthread_create(&_threads[idx], NULL, worker_loop, (void*)(S_ADDRX)idx);
+        FATAL(ret!=0, "pthread_create failed!\n");
+    }
+}
+
+void WorkerPool::destroy()
+{
+    if(!_threads)
+        return ;
+    //1. wake up all workers, they exit after all queued tasks are handled
+    pthread_mutex_lock(&_idle_mutex);
+    _need_stop = true;
+    pthread_cond_broadcast(&_idle_cond);
+    pthread_mutex_unlock(&_idle_mutex);
+    //2. join and free
+    for(INT32 idx = 0; idx<_thread_num; idx++)
+        pthread_join(_threads[idx], NULL);
+    for(INT32 idx = 0; idx<_thread_num; idx++)
+        pthread_mutex_destroy(&_queues[idx].mutex);
+    delete []_threads;
+    delete []_queues;
+    _threads = NULL;
+    _queues = NULL;
+    _thread_num = 0;
+}
+
+void WorkerPool::run_batch(TASK_HANDLER handler, void *ctx, SIZE task_num, PRIORITY priority)
+{
+    if(task_num==0)
+        return ;
+    //1. handle in the calling thread if there is no worker or only one task
+    if(!_threads || task_num==1){
+        for(SIZE idx = 0; idx<task_num; idx++)
+            handler(ctx, idx);
+        return ;
+    }
+    //2. count the tasks first, so the workers never sleep with queued tasks
+    BATCH batch;
+    batch.remaining = task_num;
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    pthread_mutex_lock(&_idle_mutex);
+    __sync_fetch_and_add(&_queued_num, task_num);
+    pthread_mutex_unlock(&_idle_mutex);
+    //3. deal the tasks into the queues of workers
+    UINT32 queue_idx = __sync_fetch_and_add(&_next_queue, 1);
+    for(SIZE idx = 0; idx<task_num; idx++, queue_idx++){
+        TASK task = {handler, ctx, idx, &batch};
+        WORKER_QUEUE &queue = _queues[queue_idx%_thread_num];
+        pthread_mutex_lock(&queue.mutex);
+        queue.tasks[priority].push_back(task);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+    //4. wake up the idle workers
+    pthread_mutex_lock(&_idle_mutex);
+    pthread_cond_broadcast(&_idle_cond);
+    pthread_mutex_unlock(&_idle_mutex);
+    //5. help to handle the tasks of this batch (the switcher never handles the generation tasks in the stop window),
+    //   and wait for the tasks handled by workers
+    TASK task;
+    while(batch.remaining!=0 && take_batch_task(&batch, priority, task))
+        execute_task(task);
+    pthread_mutex_lock(&batch.mutex);
+    while(batch.remaining!=0)
+        pthread_cond_wait(&batch.done, &batch.mutex);
+    pthread_mutex_unlock(&batch.mutex);
+    pthread_cond_destroy(&batch.done);
+    pthread_mutex_destroy(&batch.mutex);
+}
+